@@ -0,0 +1,154 @@
+#ifndef PACHI_BITBOARD_H
+#define PACHI_BITBOARD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "move.h"
+
+/* Bitboards: one bit per coord, same layout as board maps (including the
+ * S_OFFBOARD margin), so neighbor sets are just shifts by 1 and stride.
+ * 512 bits covers 21x21 (two avx2 registers). Shifts have avx2 versions,
+ * other ops are plain loops over the words the compiler vectorizes.
+ * Offboard bits must be masked out after shifts (board_statics.onboard). */
+
+#define BB_WORDS 8
+
+typedef struct {
+	uint64_t w[BB_WORDS];
+} bitboard_t;
+
+static inline void bb_clear(bitboard_t *bb)  {  memset(bb, 0, sizeof(*bb));  }
+
+static inline void bb_set(bitboard_t *bb, coord_t c)    {  bb->w[c >> 6] |=  (1ULL << (c & 63));  }
+static inline void bb_unset(bitboard_t *bb, coord_t c)  {  bb->w[c >> 6] &= ~(1ULL << (c & 63));  }
+static inline bool bb_test(bitboard_t *bb, coord_t c)   {  return (bb->w[c >> 6] >> (c & 63)) & 1;  }
+
+static inline void
+bb_or(bitboard_t *r, bitboard_t *a, bitboard_t *b)
+{
+	for (int i = 0; i < BB_WORDS; i++)  r->w[i] = a->w[i] | b->w[i];
+}
+
+static inline void
+bb_and(bitboard_t *r, bitboard_t *a, bitboard_t *b)
+{
+	for (int i = 0; i < BB_WORDS; i++)  r->w[i] = a->w[i] & b->w[i];
+}
+
+static inline void
+bb_not(bitboard_t *r, bitboard_t *a)
+{
+	for (int i = 0; i < BB_WORDS; i++)  r->w[i] = ~a->w[i];
+}
+
+/* r = a & ~b */
+static inline void
+bb_andnot(bitboard_t *r, bitboard_t *a, bitboard_t *b)
+{
+	for (int i = 0; i < BB_WORDS; i++)  r->w[i] = a->w[i] & ~b->w[i];
+}
+
+static inline bool
+bb_empty(bitboard_t *bb)
+{
+	uint64_t x = 0;
+	for (int i = 0; i < BB_WORDS; i++)  x |= bb->w[i];
+	return !x;
+}
+
+static inline int
+bb_count(bitboard_t *bb)
+{
+	int n = 0;
+	for (int i = 0; i < BB_WORDS; i++)  n += __builtin_popcountll(bb->w[i]);
+	return n;
+}
+
+#ifdef __AVX2__
+
+/* r = a shifted towards higher coords by n bits (0 < n < 64) */
+static inline void
+bb_shl(bitboard_t *r, bitboard_t *a, int n)
+{
+	__m256i lo = _mm256_loadu_si256((__m256i*)&a->w[0]);
+	__m256i hi = _mm256_loadu_si256((__m256i*)&a->w[4]);
+	/* Previous word for each lane */
+	__m256i plo = _mm256_permute4x64_epi64(lo, _MM_SHUFFLE(2, 1, 0, 3));	/* w3 w0 w1 w2 */
+	__m256i phi = _mm256_permute4x64_epi64(hi, _MM_SHUFFLE(2, 1, 0, 3));	/* w7 w4 w5 w6 */
+	phi = _mm256_blend_epi32(phi, plo, 0x03);
+	plo = _mm256_blend_epi32(plo, _mm256_setzero_si256(), 0x03);
+	__m128i sn = _mm_cvtsi32_si128(n), sc = _mm_cvtsi32_si128(64 - n);
+	lo = _mm256_or_si256(_mm256_sll_epi64(lo, sn), _mm256_srl_epi64(plo, sc));
+	hi = _mm256_or_si256(_mm256_sll_epi64(hi, sn), _mm256_srl_epi64(phi, sc));
+	_mm256_storeu_si256((__m256i*)&r->w[0], lo);
+	_mm256_storeu_si256((__m256i*)&r->w[4], hi);
+}
+
+/* r = a shifted towards lower coords by n bits (0 < n < 64) */
+static inline void
+bb_shr(bitboard_t *r, bitboard_t *a, int n)
+{
+	__m256i lo = _mm256_loadu_si256((__m256i*)&a->w[0]);
+	__m256i hi = _mm256_loadu_si256((__m256i*)&a->w[4]);
+	/* Next word for each lane */
+	__m256i nlo = _mm256_permute4x64_epi64(lo, _MM_SHUFFLE(0, 3, 2, 1));	/* w1 w2 w3 w0 */
+	__m256i nhi = _mm256_permute4x64_epi64(hi, _MM_SHUFFLE(0, 3, 2, 1));	/* w5 w6 w7 w4 */
+	nlo = _mm256_blend_epi32(nlo, nhi, 0xc0);
+	nhi = _mm256_blend_epi32(nhi, _mm256_setzero_si256(), 0xc0);
+	__m128i sn = _mm_cvtsi32_si128(n), sc = _mm_cvtsi32_si128(64 - n);
+	lo = _mm256_or_si256(_mm256_srl_epi64(lo, sn), _mm256_sll_epi64(nlo, sc));
+	hi = _mm256_or_si256(_mm256_srl_epi64(hi, sn), _mm256_sll_epi64(nhi, sc));
+	_mm256_storeu_si256((__m256i*)&r->w[0], lo);
+	_mm256_storeu_si256((__m256i*)&r->w[4], hi);
+}
+
+#else
+
+/* r = a shifted towards higher coords by n bits (0 < n < 64) */
+static inline void
+bb_shl(bitboard_t *r, bitboard_t *a, int n)
+{
+	for (int i = BB_WORDS - 1; i > 0; i--)
+		r->w[i] = (a->w[i] << n) | (a->w[i - 1] >> (64 - n));
+	r->w[0] = a->w[0] << n;
+}
+
+/* r = a shifted towards lower coords by n bits (0 < n < 64) */
+static inline void
+bb_shr(bitboard_t *r, bitboard_t *a, int n)
+{
+	for (int i = 0; i < BB_WORDS - 1; i++)
+		r->w[i] = (a->w[i] >> n) | (a->w[i + 1] << (64 - n));
+	r->w[BB_WORDS - 1] = a->w[BB_WORDS - 1] >> n;
+}
+
+#endif /* __AVX2__ */
+
+/* r = points next to a (may include a itself and offboard points) */
+static inline void
+bb_neighbors(bitboard_t *r, bitboard_t *a, int stride)
+{
+	bitboard_t t;
+	bb_shl(r, a, 1);
+	bb_shr(&t, a, 1);       bb_or(r, r, &t);
+	bb_shl(&t, a, stride);  bb_or(r, r, &t);
+	bb_shr(&t, a, stride);  bb_or(r, r, &t);
+}
+
+/* For each coord set in bitboard */
+#define foreach_bb_coord(bb_) \
+	do { \
+		bitboard_t *bb__ = (bb_); \
+		for (int bw__ = 0; bw__ < BB_WORDS; bw__++) \
+			for (uint64_t bx__ = bb__->w[bw__]; bx__; bx__ &= bx__ - 1) { \
+				coord_t c = bw__ * 64 + __builtin_ctzll(bx__);
+#define foreach_bb_coord_end \
+			} \
+	} while (0)
+
+#endif
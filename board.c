@@ -1,5 +1,6 @@
 #include <assert.h>
 #include <math.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -82,6 +83,80 @@ board_copy(board_t *b2, board_t *b1)
 	b2->move_history = NULL;
 }
 
+/* Copy what playouts need except group info. */
+static void
+board_copy_hot(board_t *b2, board_t *b1)
+{
+	int n = board_max_coords(b1);
+
+	/* Header, coord maps (only coords in use), lists (only used part),
+	 * then fields after the maps up to cold data. */
+	memcpy(b2, b1, offsetof(board_t, b));
+	memcpy(b2->b, b1->b, n * sizeof(b1->b[0]));
+	memcpy(b2->n, b1->n, n * sizeof(b1->n[0]));
+	memcpy(b2->g, b1->g, n * sizeof(b1->g[0]));
+	memcpy(b2->p, b1->p, n * sizeof(b1->p[0]));
+#ifdef BOARD_BITBOARD
+	memcpy(b2->bb, b1->bb, sizeof(b1->bb));
+#endif
+#ifdef BOARD_PAT3
+	memcpy(b2->pat3, b1->pat3, n * sizeof(b1->pat3[0]));
+#endif
+	memcpy(b2->f, b1->f, b1->flen * sizeof(b1->f[0]));
+	b2->flen = b1->flen;
+	memcpy(b2->fmap, b1->fmap, n * sizeof(b1->fmap[0]));
+#ifdef WANT_BOARD_C
+	memcpy(b2->c, b1->c, b1->clen * sizeof(b1->c[0]));
+	b2->clen = b1->clen;
+#endif
+	memcpy(&b2->playout_board, &b1->playout_board, offsetof(board_t, cold) - offsetof(board_t, playout_board));
+
+#if defined(DCNN) && defined(DCNN_DARKFOREST)
+	if (darkforest_dcnn)  /* dcnn input planes (leaf dcnn) */
+		memcpy(b2->moveno, b1->moveno, sizeof(b1->moveno));
+#endif
+
+	// XXX: Special semantics.
+	b2->fbook = NULL;
+	b2->move_history = NULL;
+}
+
+void
+board_copy_playout(board_t *b2, board_t *b1)
+{
+	board_copy_hot(b2, b1);
+	b2->ps = NULL;
+
+	/* Group info only matters for group ids (and 0). New groups
+	 * reset their info, so leftovers elsewhere are harmless. */
+	for (coord_t c = 0; c < board_max_coords(b1); c++)
+		if (group_at(b1, c) == c)
+			b2->gi[c] = b1->gi[c];
+}
+
+void
+board_checkpoint(board_checkpoint_t *cp, board_t *b)
+{
+	cp->b = b;
+	cp->ngroups = 0;
+	for (coord_t c = 0; c < board_max_coords(b); c++)
+		if (group_at(b, c) == c)
+			cp->groups[cp->ngroups++] = c;
+}
+
+void
+board_restore(board_t *b, board_checkpoint_t *cp)
+{
+	void *ps = b->ps;
+	board_copy_hot(b, cp->b);
+	b->ps = ps;
+
+	for (int i = 0; i < cp->ngroups; i++) {
+		group_t g = cp->groups[i];
+		b->gi[g] = cp->b->gi[g];
+	}
+}
+
 void
 board_done(board_t *board)
 {
@@ -140,6 +215,15 @@ board_statics_init(board_t *board)
 		bs->coord[c][1] = c / stride;
 	} foreach_point_end;
 
+#ifdef BOARD_BITBOARD
+	assert(BB_WORDS * 64 >= BOARD_MAX_COORDS);
+	foreach_point(board) {
+		int x = c % stride, y = c / stride;
+		if (x >= 1 && x <= size && y >= 1 && y <= size)
+			bb_set(&bs->onboard, c);
+	} foreach_point_end;
+#endif
+
 	/* Initialize zobrist hashtable. */
 	/* We will need these to be stable across Pachi runs for certain kinds
 	 * of pattern matching, thus we do not use fast_random() for this. */
@@ -545,6 +629,67 @@ board_is_one_point_eye(board_t *b, coord_t c, enum stone eye_color)
 		!board_is_false_eyelike(b, c, eye_color));
 }
 
+#ifdef BOARD_BITBOARD
+
+void
+group_stones_bb(board_t *b, group_t g, bitboard_t *stones)
+{
+	bb_clear(stones);
+	foreach_in_group(b, g) {
+		bb_set(stones, c);
+	} foreach_in_group_end;
+}
+
+void
+board_empty_bb(board_t *b, bitboard_t *empty)
+{
+	bitboard_t stones;
+	bb_or(&stones, board_bb(b, S_BLACK), board_bb(b, S_WHITE));
+	bb_andnot(empty, &board_statics.onboard, &stones);
+}
+
+void
+group_libs_bb(board_t *b, group_t g, bitboard_t *libs)
+{
+	bitboard_t stones, empty;
+	group_stones_bb(b, g, &stones);
+	bb_neighbors(libs, &stones, board_stride(b));
+	board_empty_bb(b, &empty);
+	bb_and(libs, libs, &empty);
+}
+
+/* Whole board version of board_is_eyelike():
+ * empty points with all neighbors own stones or offboard. */
+static void
+board_eyelike_bb(board_t *b, enum stone color, bitboard_t *empty, bitboard_t *eyes)
+{
+	int stride = board_stride(b);
+	bitboard_t own, t;
+	bb_not(&own, &board_statics.onboard);
+	bb_or(&own, &own, board_bb(b, color));
+
+	bb_shl(eyes, &own, 1);
+	bb_shr(&t, &own, 1);       bb_and(eyes, eyes, &t);
+	bb_shl(&t, &own, stride);  bb_and(eyes, eyes, &t);
+	bb_shr(&t, &own, stride);  bb_and(eyes, eyes, &t);
+	bb_and(eyes, eyes, empty);
+}
+
+void
+board_fast_owners(board_t *b, bool eyes, bitboard_t *black, bitboard_t *white)
+{
+	*black = *board_bb(b, S_BLACK);
+	*white = *board_bb(b, S_WHITE);
+	if (!eyes)  return;
+
+	bitboard_t empty, e;
+	board_empty_bb(b, &empty);
+	board_eyelike_bb(b, S_WHITE, &empty, &e);  bb_or(white, white, &e);
+	board_eyelike_bb(b, S_BLACK, &empty, &e);  bb_or(black, black, &e);
+}
+
+#endif /* BOARD_BITBOARD */
+
 enum stone
 board_eye_color(board_t *b, coord_t c)
 {
@@ -561,7 +706,13 @@ floating_t
 board_fast_score(board_t *board)
 {
 	int scores[S_MAX] = { 0, };
-	
+
+#ifdef BOARD_BITBOARD
+	bitboard_t black, white;
+	board_fast_owners(board, board->rules != RULES_STONES_ONLY, &black, &white);
+	scores[S_BLACK] = bb_count(&black);
+	scores[S_WHITE] = bb_count(&white);
+#else
 	foreach_point(board) {
 		enum stone color = board_at(board, c);
 		if (color == S_NONE && board->rules != RULES_STONES_ONLY)
@@ -569,6 +720,7 @@ board_fast_score(board_t *board)
 		scores[color]++;
 		// fprintf(stderr, "%d, %d ++%d = %d\n", coord_x(c), coord_y(c), color, scores[color]);
 	} foreach_point_end;
+#endif
 
 	return board_score(board, scores);
 }
@@ -983,6 +1135,7 @@ board_capturable_rm(board_t *board, group_t group, coord_t lib)
 
 #define FULL_BOARD
 #include "board_play.h"
+#include "board_play_fixed.h"
 
 int
 board_play(board_t *b, move_t *m)
@@ -991,5 +1144,5 @@ board_play(board_t *b, move_t *m)
         assert(!quick_board(b));
 #endif
 
-	return board_play_(b, m);
+	return board_play_fixed(b, m);
 }
@@ -8,6 +8,7 @@
 #include "stone.h"
 #include "move.h"
 #include "mq.h"
+#include "bitboard.h"
 
 struct ownermap;
 
@@ -22,6 +23,8 @@ struct ownermap;
 //#define BOARD_PAT3              /* Incremental 3x3 pattern codes */
                                   /* XXX faster without ?! */
 
+#define BOARD_BITBOARD            /* Stone bitboards: playout scoring, ownermap, dragon liberties */
+
 //#define BOARD_HASH_COMPAT	  /* Enable to get same hashes as old Pachi versions. */
 
 #ifdef EXTRA_CHECKS
@@ -123,6 +126,10 @@ typedef struct {
 	hash_t h[BOARD_MAX_COORDS][2];      /* Fixed zobrist hashes for all coords (black and white) */
 	
 	uint8_t coord[BOARD_MAX_COORDS][2]; /* Cached x-y coord info so we avoid division. */
+
+#ifdef BOARD_BITBOARD
+	bitboard_t onboard;                 /* On-board points (no margin) */
+#endif
 } board_statics_t;
 
 /* Only one board size in use at any given time so don't need array */
@@ -164,6 +171,10 @@ FB_ONLY(bool superko_violation);  /* Whether we tried to add a hash twice; board
 	group_info_t gi[BOARD_MAX_COORDS]; /* Group information - indexed by gid (which is coord of base group stone) */
 	coord_t p[BOARD_MAX_COORDS];       /* Positions of next stones in the stone group; 0 == last stone */
 
+#ifdef BOARD_BITBOARD
+	bitboard_t bb[2];                  /* Stones of each color, see board_bb() */
+#endif
+
 #ifdef BOARD_PAT3       
 FB_ONLY(hash3_t pat3)[BOARD_MAX_COORDS];   /* 3x3 pattern hash for each position; see pattern3.h for encoding
 					    * specification. The information is only valid for empty points. */
@@ -189,17 +200,6 @@ FB_ONLY(hash_t hash);                             /* Hash of current board posit
 FB_ONLY(hash_t hash_history)[BOARD_HASH_HISTORY]; /* Last hashes encountered, for superko check. */
 	int    hash_history_next;                 /* (circular buffer) */
 
-#ifdef JOSEKIFIX						/* XXX move elsewhere ? */
-FB_ONLY(int external_joseki_engine_moves_left_by_quadrant)[4];  /* Moves left for external joseki engine mode */
-FB_ONLY(int influence_fuseki_by_quadrant)[4];	  /* Keep track where influence fuseki countermeasures have been enabled */
-#endif
-
-/*************************************************************************************************************/
-
-#if defined(DCNN) && defined(DCNN_DARKFOREST)
-FB_ONLY(int moveno)[BOARD_MAX_COORDS];     /* Move number for each coord */
-#endif
-
 #ifdef BOARD_UNDO_CHECKS
 	int quicked;                       /* Guard against invalid quick_play() / quick_undo() uses */
 #endif
@@ -211,6 +211,20 @@ FB_ONLY(int moveno)[BOARD_MAX_COORDS];     /* Move number for each coord */
 	 
 	void *ps;                          /* Playout-specific state; persistent through board development,
 					    * initialized by play_random_game() and free()'d at board destroy time */
+
+/*************************************************************************************************************/
+/* Cold data: never used in playouts, not copied by board_copy_playout(). */
+
+	char cold[0];
+
+#ifdef JOSEKIFIX						/* XXX move elsewhere ? */
+FB_ONLY(int external_joseki_engine_moves_left_by_quadrant)[4];  /* Moves left for external joseki engine mode */
+FB_ONLY(int influence_fuseki_by_quadrant)[4];	  /* Keep track where influence fuseki countermeasures have been enabled */
+#endif
+
+#if defined(DCNN) && defined(DCNN_DARKFOREST)
+FB_ONLY(int moveno)[BOARD_MAX_COORDS];     /* Move number for each coord (copied if darkforest is in use) */
+#endif
 } board_t;
 
 
@@ -280,6 +294,15 @@ FB_ONLY(int moveno)[BOARD_MAX_COORDS];     /* Move number for each coord */
 
 #define groupnext_at(b_, c) ((b_)->p[c])
 
+#ifdef BOARD_BITBOARD
+#define board_bb(b_, color)         (&(b_)->bb[(color) - 1])	/* Stones of given color */
+#define board_bb_add(b_, c, color)  bb_set(board_bb(b_, color), (c))
+#define board_bb_rm(b_, c, color)   bb_unset(board_bb(b_, color), (c))
+#else
+#define board_bb_add(b_, c, color)
+#define board_bb_rm(b_, c, color)
+#endif
+
 /* Check g looks like a valid group. */
 #define sane_group(b, g)   ((g) && sane_coord(g) && group_at((b), (g)) == (g))
 
@@ -293,6 +316,17 @@ static bool          group_captured(board_t *b, group_t g);
 /* group_other_lib() makes sense only for groups with two liberties. */
 static coord_t       group_other_lib(board_t *b, group_t g, coord_t lib);
 
+#ifdef BOARD_BITBOARD
+/* Group stones / all liberties as bitboards
+ * (group_libs() is exact only up to GROUP_REFILL_LIBS). */
+void group_stones_bb(board_t *b, group_t g, bitboard_t *stones);
+void group_libs_bb(board_t *b, group_t g, bitboard_t *libs);
+void board_empty_bb(board_t *b, bitboard_t *empty);
+/* Playout scoring owners: stones plus 1pt eyelike points (if @eyes),
+ * see board_fast_score(). */
+void board_fast_owners(board_t *b, bool eyes, bitboard_t *black, bitboard_t *white);
+#endif
+
 
 #ifdef BOARD_HASH_COMPAT
 #define hash_at(coord, color) (*(&board_statics.h[0][0] + ((color) == S_BLACK ? board_statics.max_coords : 0) + (coord)))
@@ -303,6 +337,22 @@ static coord_t       group_other_lib(board_t *b, group_t g, coord_t lib);
 board_t *board_new(int size, char *fbookfile);
 void board_delete(board_t **board);
 void board_copy(board_t *board2, board_t *board1);
+/* Faster board_copy() for playouts and tree descent: only copies data
+ * playouts need, and only existing groups' info (bulk of board_t). */
+void board_copy_playout(board_t *board2, board_t *board1);
+
+/* Board checkpoint: playout boards can be restored to checkpoint position
+ * without scanning for groups. Restored board keeps its playout state (ps)
+ * and must have been board_copy_playout()'d from checkpoint board.
+ * Checkpoint board must not change while in use. */
+typedef struct {
+	board_t *b;
+	int      ngroups;
+	group_t  groups[BOARD_MAX_COORDS];
+} board_checkpoint_t;
+
+void board_checkpoint(board_checkpoint_t *cp, board_t *b);
+void board_restore(board_t *b, board_checkpoint_t *cp);
 void board_done(board_t *board);
 
 void board_resize(board_t *b, int size);
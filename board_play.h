@@ -91,6 +91,7 @@ static void
 board_remove_stone(board_t *board, group_t group, coord_t c, enum stone color)
 {
 	board_at(board, c) = S_NONE;
+	board_bb_rm(board, c, color);
 	group_at(board, c) = 0;
 #ifdef FULL_BOARD
 	board_hash_update(board, c, color);
@@ -214,6 +215,7 @@ new_group(board_t *board, coord_t coord)
 	groupnext_at(board, coord) = 0;
 
 	group_info_t *gi = group_info(board, group);
+	memset(gi, 0, sizeof(*gi));  /* Not necessarily clear, see board_copy_playout() */
 	foreach_neighbor(board, coord, {
 		if (board_at(board, c) == S_NONE)
 			/* board_group_addlib is ridiculously expensive for us */
@@ -292,6 +294,7 @@ board_play_outside(board_t *board, move_t *m, int f)
 	});
 
 	board_at(board, coord) = color;
+	board_bb_add(board, coord, color);
 	if (unlikely(!group))
 		group = new_group(board, coord);
 
@@ -368,6 +371,7 @@ board_play_in_eye(board_t *board, move_t *m, int f)
 	}
 
 	board_at(board, coord) = color;
+	board_bb_add(board, coord, color);
 	group_t group = new_group(board, coord);
 
 	board_commit_move(board, m);
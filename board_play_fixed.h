@@ -0,0 +1,101 @@
+/* Board size specialized board_play() code.
+ *
+ * Fixed size builds (BOARD_SIZE) are faster since board stride and
+ * neighbor offsets are compile-time constants, but they only play one
+ * size. Here board_play.h is instantiated for the common sizes (9, 13, 19)
+ * on top of the generic version and board_play_fixed() dispatches on
+ * current board size, so one binary gets fixed-size code for all of them.
+ *
+ * Include right after board_play.h (same FULL_BOARD / BOARD_UNDO setting).
+ * Instantiated functions get a _<size> suffix. */
+
+#ifndef BOARD_PLAY_SIZE
+
+#ifndef BOARD_SIZE
+#define BOARD_PLAY_SIZE 9
+#include "board_play_fixed.h"
+#undef  BOARD_PLAY_SIZE
+#define BOARD_PLAY_SIZE 13
+#include "board_play_fixed.h"
+#undef  BOARD_PLAY_SIZE
+#define BOARD_PLAY_SIZE 19
+#include "board_play_fixed.h"
+#undef  BOARD_PLAY_SIZE
+#endif
+
+static inline int
+board_play_fixed(board_t *board, move_t *m)
+{
+#ifndef BOARD_SIZE
+	switch (the_board_rsize()) {
+		case 19:  return board_play__19(board, m);
+		case 13:  return board_play__13(board, m);
+		case 9:   return board_play__9(board, m);
+	}
+#endif
+	return board_play_(board, m);	/* Generic version */
+}
+
+#else  /* BOARD_PLAY_SIZE */
+
+#define board_play_fixed_cat_(name, size)  name ## _ ## size
+#define board_play_fixed_cat(name, size)   board_play_fixed_cat_(name, size)
+#define board_play_fixed_name(name)        board_play_fixed_cat(name, BOARD_PLAY_SIZE)
+
+#pragma push_macro("the_board_stride")
+#pragma push_macro("the_board_rsize")
+#pragma push_macro("the_board_rsize2")
+#pragma push_macro("board_stride")
+#pragma push_macro("board_max_coords")
+#undef  the_board_stride
+#undef  the_board_rsize
+#undef  the_board_rsize2
+#undef  board_stride
+#undef  board_max_coords
+#define the_board_stride()	(BOARD_PLAY_SIZE + 2)
+#define the_board_rsize()	(BOARD_PLAY_SIZE)
+#define the_board_rsize2()	(BOARD_PLAY_SIZE * BOARD_PLAY_SIZE)
+#define board_stride(b)		(BOARD_PLAY_SIZE + 2)
+#define board_max_coords(b)	((BOARD_PLAY_SIZE + 2) * (BOARD_PLAY_SIZE + 2))
+
+#define group_has_lib			board_play_fixed_name(group_has_lib)
+#define board_group_addlib		board_play_fixed_name(board_group_addlib)
+#define board_group_find_extra_libs	board_play_fixed_name(board_group_find_extra_libs)
+#define board_group_rmlib		board_play_fixed_name(board_group_rmlib)
+#define board_remove_stone		board_play_fixed_name(board_remove_stone)
+#define board_group_capture		board_play_fixed_name(board_group_capture)
+#define add_to_group			board_play_fixed_name(add_to_group)
+#define merge_groups			board_play_fixed_name(merge_groups)
+#define new_group			board_play_fixed_name(new_group)
+#define play_one_neighbor		board_play_fixed_name(play_one_neighbor)
+#define board_play_outside		board_play_fixed_name(board_play_outside)
+#define capturing_something		board_play_fixed_name(capturing_something)
+#define board_play_in_eye		board_play_fixed_name(board_play_in_eye)
+#define board_play_f			board_play_fixed_name(board_play_f)
+#define board_play_			board_play_fixed_name(board_play_)
+
+#include "board_play.h"
+
+#undef group_has_lib
+#undef board_group_addlib
+#undef board_group_find_extra_libs
+#undef board_group_rmlib
+#undef board_remove_stone
+#undef board_group_capture
+#undef add_to_group
+#undef merge_groups
+#undef new_group
+#undef play_one_neighbor
+#undef board_play_outside
+#undef capturing_something
+#undef board_play_in_eye
+#undef board_play_f
+#undef board_play_
+
+#pragma pop_macro("the_board_stride")
+#pragma pop_macro("the_board_rsize")
+#pragma pop_macro("the_board_rsize2")
+#pragma pop_macro("board_stride")
+#pragma pop_macro("board_max_coords")
+
+#endif /* BOARD_PLAY_SIZE */
@@ -109,6 +109,7 @@ board_commit_move(board_t *b, move_t *m)
 
 #define BOARD_UNDO
 #include "board_play.h"
+#include "board_play_fixed.h"
 
 int
 board_quick_play(board_t *b, move_t *m, board_undo_t *u)
@@ -118,7 +119,7 @@ board_quick_play(board_t *b, move_t *m, board_undo_t *u)
 	undo_init(b, m, u);
 	b->u = u;
 	
-	int r = board_play_(b, m);
+	int r = board_play_fixed(b, m);
 #ifdef BOARD_UNDO_CHECKS
 	if (r >= 0)
 		b->quicked++;
@@ -200,6 +201,7 @@ restore_enemies(board_t *b, board_undo_t *u, move_t *m)
 
 		for (int j = 0; stones[j]; j++) {
 			board_at(b, stones[j]) = other_color;
+			board_bb_add(b, stones[j], other_color);
 			group_at(b, stones[j]) = old_group;
 			groupnext_at(b, stones[j]) = stones[j + 1];
 
@@ -238,6 +240,7 @@ board_undo_stone(board_t *b, board_undo_t *u, move_t *m)
 		memset(group_info(b, group_at(b, coord)), 0, sizeof(group_info_t));
 	
 	board_at(b, coord) = S_NONE;
+	board_bb_rm(b, coord, color);
 	group_at(b, coord) = 0;
 	groupnext_at(b, coord) = u->next_at;
 	
@@ -273,6 +276,7 @@ restore_suicide(board_t *b, board_undo_t *u, move_t *m)
 
 		for (int j = 0; stones[j]; j++) {
 			board_at(b, stones[j]) = other_color;
+			board_bb_add(b, stones[j], other_color);
 			group_at(b, stones[j]) = old_group;
 			groupnext_at(b, stones[j]) = stones[j + 1];
 
@@ -310,6 +314,7 @@ board_undo_suicide(board_t *b, board_undo_t *u, move_t *m)
 	undo_merge(b, u, m);
 
 	board_at(b, coord) = S_NONE;
+	board_bb_rm(b, coord, m->color);
 	group_at(b, coord) = 0;
 	groupnext_at(b, coord) = u->next_at;
 
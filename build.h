@@ -0,0 +1,7 @@
+#define PACHI_GIT_BRANCH   "master"
+#define PACHI_GIT_HASH     "f12e511"
+#define PACHI_BUILD_DATE   "Oct 16 2026"
+#define PACHI_BUILD_TARGET "cooperlake"
+#define PACHI_CFLAGS       "-Wall -ggdb3 -O3 -D_GNU_SOURCE -frename-registers -DDATA_DIR='/usr/share/pachi-go' -march=native -DDCNN -DDCNN_CAFFE -DDCNN_DETLEF -DDCNN_DARKFOREST -DJOSEKIFIX -DKATAGO_BINARY='katago_cpu' -DKATAGO_CONFIG='katago.cfg' -DKATAGO_MODEL='g170e-b10c128-s1141046784-d204142634.bin.gz' -fomit-frame-pointer -std=gnu99 -pthread -Wsign-compare -Wno-format-zero-length -Winit-self -Wimplicit-fallthrough   "
+#define PACHI_COMPILER     "cc (Debian 12.2.0-14+deb12u1) 12.2.0"
+#define PACHI_CC1          " /usr/lib/gcc/x86_64-linux-gnu/12/cc1 -E -quiet -v -imultiarch x86_64-linux-gnu -dD -D_REENTRANT -D _GNU_SOURCE -D DATA_DIR='/usr/share/pachi-go' -D DCNN -D DCNN_CAFFE -D DCNN_DETLEF -D DCNN_DARKFOREST -D JOSEKIFIX -D KATAGO_BINARY='katago_cpu' -D KATAGO_CONFIG='katago.cfg' -D KATAGO_MODEL='g170e-b10c128-s1141046784-d204142634.bin.gz' - -march=cooperlake -mmmx -mpopcnt -msse -msse2 -msse3 -mssse3 -msse4.1 -msse4.2 -mavx -mavx2 -mno-sse4a -mno-fma4 -mno-xop -mfma -mavx512f -mbmi -mbmi2 -maes -mpclmul -mavx512vl -mavx512bw -mavx512dq -mavx512cd -mno-avx512er -mno-avx512pf -mavx512vbmi -mavx512ifma -mno-avx5124vnniw -mno-avx5124fmaps -mavx512vpopcntdq -mavx512vbmi2 -mgfni -mvpclmulqdq -mavx512vnni -mavx512bitalg -mavx512bf16 -mno-avx512vp2intersect -mno-3dnow -madx -mabm -mcldemote -mclflushopt -mclwb -mno-clzero -mcx16 -mno-enqcmd -mf16c -mfsgsbase -mfxsr -mno-hle -msahf -mno-lwp -mlzcnt -mmovbe -mmovdir64b -mmovdiri -mno-mwaitx -mno-pconfig -mpku -mno-prefetchwt1 -mprfchw -mno-ptwrite -mrdpid -mrdrnd -mrdseed -mno-rtm -mserialize -mno-sgx -msha -mshstk -mno-tbm -mtsxldtrk -mvaes -mno-waitpkg -mwbnoinvd -mxsave -mxsavec -mxsaveopt -mxsaves -mamx-tile -mamx-int8 -mamx-bf16 -mno-uintr -mno-hreset -mno-kl -mno-widekl -mavxvnni -mavx512fp16 --param l1-cache-size=48 --param l1-cache-line-size=64 --param l2-cache-size=307200 -mtune=generic -std=gnu99 -Wall -Wsign-compare -Wno-format-zero-length -Winit-self -Wimplicit-fallthrough=3 -frename-registers -fomit-frame-pointer -ggdb3 -fworking-directory -O3 -fasynchronous-unwind-tables -dumpbase -"
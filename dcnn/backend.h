@@ -0,0 +1,26 @@
+#ifndef PACHI_DCNN_BACKEND_H
+#define PACHI_DCNN_BACKEND_H
+
+/* Helpers shared by dcnn inference backends. */
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+#define DCNN_OUTPUT_MIN 0.00001f
+
+/* Copy network output to result, clamping tiny values. */
+static inline void
+dcnn_output_copy(float *restrict dst, const float *restrict src, int n)
+{
+	int i = 0;
+#ifdef __SSE__
+	const __m128 min = _mm_set1_ps(DCNN_OUTPUT_MIN);
+	for (; i + 4 <= n; i += 4)
+		_mm_storeu_ps(dst + i, _mm_max_ps(_mm_loadu_ps(src + i), min));
+#endif
+	for (; i < n; i++)
+		dst[i] = (src[i] > DCNN_OUTPUT_MIN ? src[i] : DCNN_OUTPUT_MIN);
+}
+
+#endif /* PACHI_DCNN_BACKEND_H */
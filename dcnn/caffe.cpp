@@ -15,6 +15,8 @@ using namespace caffe;
 extern "C" {
 #include "debug.h"
 #include "util.h"
+#include "dcnn/caffe.h"
+#include "dcnn/backend.h"
 
 static shared_ptr<Net<float> > net;
 static int net_size = 0;		/* board size */
@@ -93,24 +95,41 @@ caffe_done()
 	net_size = 0;
 }
 	
-void
-caffe_get_data(float *data, float *result, int size, int planes, int psize)
+/* Input blob memory for @n positions of [planes][size][size], zeroed.
+ * Blob stays allocated between calls (shrinking batch size doesn't
+ * reallocate), caller builds input planes in there directly. */
+float *
+caffe_input(int n, int size, int planes)
 {
 	assert(net && net_size == size);
-	Blob<float> *blob = new Blob<float>(1, planes, psize, psize);
-	blob->set_cpu_data(data);
-	vector<Blob<float>*> bottom;
-	bottom.push_back(blob);
-	const vector<Blob<float>*>& rr = net->Forward(bottom);
-	assert(shape_size(rr[0]->shape()) >= size * size);
+	assert(n > 0);
 	
-	for (int i = 0; i < size * size; i++) {
-		result[i] = rr[0]->cpu_data()[i];
-		if (result[i] < 0.00001)
-			result[i] = 0.00001;
+	/* Resize batch dimension if needed. */
+	Blob<float> *input = net->input_blobs()[0];
+	if (input->shape(0) != n || input->shape(1) != planes) {
+		input->Reshape(n, planes, size, size);
+		net->Reshape();
 	}
+	float *data = input->mutable_cpu_data();
+	memset(data, 0, input->count() * sizeof(float));
+	return data;
+}
+
+/* Run network on input blob (@n positions), result for position i
+ * goes to results[i]. */
+void
+caffe_forward(float **results, int n, int size)
+{
+	assert(net && net_size == size);
+	assert(net->input_blobs()[0]->shape(0) == n);
+
+	const vector<Blob<float>*>& rr = net->Forward();
+	int stride = shape_size(rr[0]->shape()) / n;
+	assert(stride >= size * size);
 	
-	delete blob;
+	const float *out = rr[0]->cpu_data();
+	for (int k = 0; k < n; k++)
+		dcnn_output_copy(results[k], out + k * stride, size * size);
 }
 
 	
@@ -10,9 +10,10 @@ extern "C" {
 bool caffe_ready(void);
 void caffe_init(int size, char *model, char *weights, char *name, int default_size);
 void caffe_done(void);
-void caffe_get_data(float *data, float *result, int size, int planes, int psize);
+float *caffe_input(int n, int size, int planes);
+void caffe_forward(float **results, int n, int size);
 
-#ifdef DCNN
+#ifdef DCNN_CAFFE
 void quiet_caffe(int argc, char *argv[]);
 #else
 #define quiet_caffe(argc, argv) ((void)0)
@@ -0,0 +1,944 @@
+#define DEBUG
+#include <assert.h>
+#include <ctype.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "debug.h"
+#include "util.h"
+#include "threadpool.h"
+#include "topology.h"
+#include "dcnn/cpunet.h"
+#include "dcnn/backend.h"
+
+/* Built-in cpu inference engine, see cpunet.h
+ *
+ * Network topology comes from the .prototxt (text format), weights from
+ * the Caffe .trained file (binary protobuf), matched by layer name like
+ * Caffe does. Both parsers only know the few fields we need.
+ *
+ * Convolutions are done directly on zero-padded planes: with row stride
+ * W = size + 2*pad, output plane row-major with the same stride is just a
+ * sum of shifted input planes scaled by kernel weights, so each
+ * (input channel, kernel offset) is a single long axpy. Junk columns
+ * x >= size are dropped afterwards. With avx2 we do the same thing but
+ * 4 output channels x 24 positions at a time so accumulators stay in
+ * registers. Output channels are split among threads.
+ *
+ * Quantized mode (cpunet_set_quantize()): weights are converted to int8
+ * at load time (per output channel scale), conv inputs to 7-bit unsigned
+ * (per layer scale, inputs are >= 0 after relu / for input planes).
+ * Input planes are interleaved by groups of 4 channels so that each
+ * 32-bit lane holds 4 channels of one position: that's a 4-way dot
+ * product per lane with maddubs + madd on avx2. 7 bits keep maddubs
+ * pairs from saturating. Layers outputs are dequantized back to float. */
+
+enum layer_type {  LAYER_CONV, LAYER_RELU, LAYER_SOFTMAX, LAYER_FLATTEN  };
+
+typedef struct {
+	char *name;
+	enum layer_type type;
+	int  in, out;		/* Channels */
+	int  k, pad;
+	bool bias_term;
+	float *w;		/* [out][in][k][k] */
+	float *b;		/* [out] */
+	int    icg;		/* Quantized: input channel groups of 4 */
+	int8_t *wq;		/* Quantized: [out][icg][k][k][4] */
+	float  *wscale;		/* Quantized: [out] */
+} layer_t;
+
+typedef struct {
+	layer_t *layers;
+	int  nlayers;
+	int  size;		/* Board size */
+	int  max_channels;
+	int  max_pad;
+	float *buf[2];		/* [max_channels][size][size] */
+	float *padded;		/* [max_channels][size + 2*max_pad]^2 + slack */
+	uint8_t *qpadded;	/* Quantized: [max_channels/4][size + 2*max_pad]^2 + slack][4] */
+	float *input;		/* Input planes for cpunet_input() */
+	int input_size;		/* Allocated floats */
+	int input_planes;
+} net_t;
+
+static net_t *net = NULL;
+static pthread_mutex_t net_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int nthreads = 0;
+static bool quantize = false;
+
+
+/**********************************************************************************/
+/* Simd kernels */
+
+typedef void (*axpy_t)(float *restrict y, const float *restrict x, float a, int n);
+
+static axpy_t axpy;
+static bool   use_avx2 = false;
+
+/* Output positions per avx2 register block (3 x 8 floats).
+ * Padded planes need that much slack at the end. */
+#define CONV_CHUNK 24
+#define CONV_CHUNK_INT8 16
+#define CONV_SLACK CONV_CHUNK
+
+static void
+axpy_c(float *restrict y, const float *restrict x, float a, int n)
+{
+	for (int i = 0; i < n; i++)
+		y[i] += a * x[i];
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse")))
+static void
+axpy_sse(float *restrict y, const float *restrict x, float a, int n)
+{
+	__m128 va = _mm_set1_ps(a);
+	int i = 0;
+	for (; i + 4 <= n; i += 4)
+		_mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i), _mm_mul_ps(va, _mm_loadu_ps(x + i))));
+	for (; i < n; i++)
+		y[i] += a * x[i];
+}
+
+__attribute__((target("avx2,fma")))
+static void
+axpy_avx2(float *restrict y, const float *restrict x, float a, int n)
+{
+	__m256 va = _mm256_set1_ps(a);
+	int i = 0;
+	for (; i + 16 <= n; i += 16) {
+		_mm256_storeu_ps(y + i,     _mm256_fmadd_ps(va, _mm256_loadu_ps(x + i),     _mm256_loadu_ps(y + i)));
+		_mm256_storeu_ps(y + i + 8, _mm256_fmadd_ps(va, _mm256_loadu_ps(x + i + 8), _mm256_loadu_ps(y + i + 8)));
+	}
+	for (; i + 8 <= n; i += 8)
+		_mm256_storeu_ps(y + i, _mm256_fmadd_ps(va, _mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i)));
+	for (; i < n; i++)
+		y[i] += a * x[i];
+}
+
+/* 4 output channels starting at @oc, all positions: acc[4][nround] */
+__attribute__((target("avx2,fma")))
+static void
+conv_oc4_avx2(const float *weights, const float *bias, int in, int k, int w,
+	      const float *padded, float *acc, int nround)
+{
+	int k2 = k * k;
+	int offsets[k2];
+	for (int t = 0; t < k2; t++)
+		offsets[t] = (t / k) * w + t % k;
+	const float *w0 = weights, *w1 = w0 + in * k2, *w2 = w1 + in * k2, *w3 = w2 + in * k2;
+
+	for (int i = 0; i < nround; i += CONV_CHUNK) {
+		__m256 a00 = _mm256_set1_ps(bias[0]), a01 = a00, a02 = a00;
+		__m256 a10 = _mm256_set1_ps(bias[1]), a11 = a10, a12 = a10;
+		__m256 a20 = _mm256_set1_ps(bias[2]), a21 = a20, a22 = a20;
+		__m256 a30 = _mm256_set1_ps(bias[3]), a31 = a30, a32 = a30;
+		for (int ic = 0; ic < in; ic++) {
+			const float *plane = padded + (size_t)ic * w * w + i;
+			int wi = ic * k2;
+			for (int t = 0; t < k2; t++, wi++) {
+				const float *x = plane + offsets[t];
+				__m256 x0 = _mm256_loadu_ps(x), x1 = _mm256_loadu_ps(x + 8), x2 = _mm256_loadu_ps(x + 16);
+				__m256 v;
+				v = _mm256_broadcast_ss(w0 + wi);
+				a00 = _mm256_fmadd_ps(v, x0, a00);  a01 = _mm256_fmadd_ps(v, x1, a01);  a02 = _mm256_fmadd_ps(v, x2, a02);
+				v = _mm256_broadcast_ss(w1 + wi);
+				a10 = _mm256_fmadd_ps(v, x0, a10);  a11 = _mm256_fmadd_ps(v, x1, a11);  a12 = _mm256_fmadd_ps(v, x2, a12);
+				v = _mm256_broadcast_ss(w2 + wi);
+				a20 = _mm256_fmadd_ps(v, x0, a20);  a21 = _mm256_fmadd_ps(v, x1, a21);  a22 = _mm256_fmadd_ps(v, x2, a22);
+				v = _mm256_broadcast_ss(w3 + wi);
+				a30 = _mm256_fmadd_ps(v, x0, a30);  a31 = _mm256_fmadd_ps(v, x1, a31);  a32 = _mm256_fmadd_ps(v, x2, a32);
+			}
+		}
+		float *o = acc + i;
+		_mm256_storeu_ps(o,  a00);  _mm256_storeu_ps(o + 8,  a01);  _mm256_storeu_ps(o + 16,  a02);  o += nround;
+		_mm256_storeu_ps(o,  a10);  _mm256_storeu_ps(o + 8,  a11);  _mm256_storeu_ps(o + 16,  a12);  o += nround;
+		_mm256_storeu_ps(o,  a20);  _mm256_storeu_ps(o + 8,  a21);  _mm256_storeu_ps(o + 16,  a22);  o += nround;
+		_mm256_storeu_ps(o,  a30);  _mm256_storeu_ps(o + 8,  a31);  _mm256_storeu_ps(o + 16,  a32);
+	}
+}
+
+/* Quantized version of conv_oc4_avx2(), 16 positions per block.
+ * @padded: [icg][ps][4] 7-bit activations, @wq: [4][icg][k2][4] */
+__attribute__((target("avx2,fma")))
+static void
+conv_oc4_int8_avx2(const int8_t *wq, int icg, int k, int w, int ps,
+		   const uint8_t *padded, int32_t *acc, int nround)
+{
+	int k2 = k * k;
+	int offsets[k2];
+	for (int t = 0; t < k2; t++)
+		offsets[t] = ((t / k) * w + t % k) * 4;
+	const int32_t *w0 = (const int32_t*)wq, *w1 = w0 + icg * k2, *w2 = w1 + icg * k2, *w3 = w2 + icg * k2;
+	const __m256i ones = _mm256_set1_epi16(1);
+
+#define DOT4(acc, x, v)  acc = _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_maddubs_epi16(x, v), ones))
+	for (int i = 0; i < nround; i += CONV_CHUNK_INT8) {
+		__m256i a00 = _mm256_setzero_si256(), a01 = a00, a10 = a00, a11 = a00;
+		__m256i a20 = a00, a21 = a00, a30 = a00, a31 = a00;
+		for (int g = 0; g < icg; g++) {
+			const uint8_t *plane = padded + ((size_t)g * ps + i) * 4;
+			int wi = g * k2;
+			for (int t = 0; t < k2; t++, wi++) {
+				const uint8_t *x = plane + offsets[t];
+				__m256i x0 = _mm256_loadu_si256((const __m256i*)x), x1 = _mm256_loadu_si256((const __m256i*)(x + 32));
+				__m256i v;
+				v = _mm256_set1_epi32(w0[wi]);  DOT4(a00, x0, v);  DOT4(a01, x1, v);
+				v = _mm256_set1_epi32(w1[wi]);  DOT4(a10, x0, v);  DOT4(a11, x1, v);
+				v = _mm256_set1_epi32(w2[wi]);  DOT4(a20, x0, v);  DOT4(a21, x1, v);
+				v = _mm256_set1_epi32(w3[wi]);  DOT4(a30, x0, v);  DOT4(a31, x1, v);
+			}
+		}
+		int32_t *o = acc + i;
+		_mm256_storeu_si256((__m256i*)o, a00);  _mm256_storeu_si256((__m256i*)(o + 8), a01);  o += nround;
+		_mm256_storeu_si256((__m256i*)o, a10);  _mm256_storeu_si256((__m256i*)(o + 8), a11);  o += nround;
+		_mm256_storeu_si256((__m256i*)o, a20);  _mm256_storeu_si256((__m256i*)(o + 8), a21);  o += nround;
+		_mm256_storeu_si256((__m256i*)o, a30);  _mm256_storeu_si256((__m256i*)(o + 8), a31);
+	}
+#undef DOT4
+}
+#endif
+
+static void
+select_kernels(void)
+{
+	char *name = "c";
+	axpy = axpy_c;
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {  axpy = axpy_avx2;  use_avx2 = true;  name = "avx2";  }
+	else if (__builtin_cpu_supports("sse"))				     {  axpy = axpy_sse;   name = "sse";   }
+#endif
+	if (DEBUGL(2))  fprintf(stderr, "cpunet: using %s kernels\n", name);
+}
+
+
+/**********************************************************************************/
+/* Prototxt parser (protobuf text format) */
+
+typedef struct pt_node {
+	char *key;
+	char *value;		/* NULL for messages */
+	struct pt_node *child;
+	struct pt_node *next;
+} pt_node_t;
+
+typedef struct {
+	char *p;
+	char tok[256];
+	int  line;
+} pt_lexer_t;
+
+/* Next token in lex->tok, false at eof. */
+static bool
+pt_token(pt_lexer_t *lex)
+{
+	char *p = lex->p;
+	while (*p) {
+		if (*p == '\n')  lex->line++;
+		if (isspace(*p))  {  p++;  continue;  }
+		if (*p == '#')    {  while (*p && *p != '\n')  p++;  continue;  }
+		break;
+	}
+	if (!*p)  {  lex->p = p;  return false;  }
+
+	int n = 0;
+	if (*p == '{' || *p == '}' || *p == ':')
+		lex->tok[n++] = *p++;
+	else if (*p == '"' || *p == '\'') {
+		char quote = *p++;
+		while (*p && *p != quote && n < 255)  lex->tok[n++] = *p++;
+		if (*p)  p++;
+	}
+	else while (*p && !isspace(*p) && !strchr("{}:#", *p) && n < 255)
+		lex->tok[n++] = *p++;
+	lex->tok[n] = 0;
+	lex->p = p;
+	return true;
+}
+
+static pt_node_t *
+pt_parse_message(pt_lexer_t *lex, bool toplevel)
+{
+	pt_node_t *first = NULL, **last = &first;
+	while (pt_token(lex)) {
+		if (!strcmp(lex->tok, "}")) {
+			if (toplevel)  die("cpunet: prototxt line %i: unexpected '}'\n", lex->line);
+			return first;
+		}
+		pt_node_t *node = calloc2(1, pt_node_t);
+		node->key = strdup(lex->tok);
+		*last = node;  last = &node->next;
+
+		if (!pt_token(lex))  die("cpunet: prototxt: unexpected eof\n");
+		if (!strcmp(lex->tok, ":") && !pt_token(lex))  die("cpunet: prototxt: unexpected eof\n");
+		if (!strcmp(lex->tok, "{"))  node->child = pt_parse_message(lex, false);
+		else			     node->value = strdup(lex->tok);
+	}
+	if (!toplevel)  die("cpunet: prototxt: unexpected eof\n");
+	return first;
+}
+
+static void
+pt_free(pt_node_t *node)
+{
+	while (node) {
+		pt_node_t *next = node->next;
+		pt_free(node->child);
+		free(node->key);  free(node->value);  free(node);
+		node = next;
+	}
+}
+
+static pt_node_t *
+pt_get(pt_node_t *msg, char *key)
+{
+	for (pt_node_t *n = msg; n; n = n->next)
+		if (!strcmp(n->key, key))
+			return n;
+	return NULL;
+}
+
+static int
+pt_get_int(pt_node_t *msg, char *key, int default_value)
+{
+	pt_node_t *n = pt_get(msg, key);
+	return (n && n->value ? atoi(n->value) : default_value);
+}
+
+static char *
+pt_get_str(pt_node_t *msg, char *key)
+{
+	pt_node_t *n = pt_get(msg, key);
+	return (n ? n->value : NULL);
+}
+
+
+/**********************************************************************************/
+/* Caffe weights parser (protobuf wire format) */
+
+typedef struct {
+	const uint8_t *p, *end;
+} pb_t;
+
+static uint64_t
+pb_varint(pb_t *pb)
+{
+	uint64_t v = 0;
+	for (int shift = 0; pb->p < pb->end && shift < 64; shift += 7) {
+		uint8_t byte = *pb->p++;
+		v |= (uint64_t)(byte & 0x7f) << shift;
+		if (!(byte & 0x80))  return v;
+	}
+	die("cpunet: corrupted weights file\n");
+}
+
+/* Read next field header, false at end of message. */
+static bool
+pb_field(pb_t *pb, int *field, int *wire)
+{
+	if (pb->p >= pb->end)  return false;
+	uint64_t key = pb_varint(pb);
+	*field = key >> 3;  *wire = key & 7;
+	return true;
+}
+
+static pb_t
+pb_bytes(pb_t *pb)
+{
+	uint64_t len = pb_varint(pb);
+	if (len > (uint64_t)(pb->end - pb->p))  die("cpunet: corrupted weights file\n");
+	pb_t sub = { pb->p, pb->p + len };
+	pb->p += len;
+	return sub;
+}
+
+static void
+pb_skip(pb_t *pb, int wire)
+{
+	switch (wire) {
+		case 0:  pb_varint(pb);  break;
+		case 1:  pb->p += 8;  break;
+		case 2:  pb_bytes(pb);  break;
+		case 5:  pb->p += 4;  break;
+		default: die("cpunet: corrupted weights file\n");
+	}
+	if (pb->p > pb->end)  die("cpunet: corrupted weights file\n");
+}
+
+typedef struct {
+	float *data;
+	int    count;
+} blob_t;
+
+/* BlobProto: we only need the data (repeated float data = 5). */
+static blob_t
+pb_blob(pb_t pb)
+{
+	blob_t blob = { NULL, 0 };
+	int field, wire;
+	while (pb_field(&pb, &field, &wire)) {
+		if (field == 5 && wire == 2) {  /* packed */
+			pb_t data = pb_bytes(&pb);
+			int n = (data.end - data.p) / sizeof(float);
+			blob.data = crealloc(blob.data, (blob.count + n) * sizeof(float));
+			memcpy(blob.data + blob.count, data.p, n * sizeof(float));
+			blob.count += n;
+		}
+		else if (field == 5 && wire == 5) {
+			blob.data = crealloc(blob.data, (blob.count + 1) * sizeof(float));
+			memcpy(blob.data + blob.count++, pb.p, sizeof(float));
+			pb.p += 4;
+		}
+		else  pb_skip(&pb, wire);
+	}
+	return blob;
+}
+
+/* Find layer @name blobs in NetParameter. Handles both current
+ * (layer = 100: name = 1, blobs = 7) and V1 (layers = 2: name = 4, blobs = 6) formats. */
+static int
+pb_layer_blobs(pb_t pb, char *name, blob_t *blobs, int max_blobs)
+{
+	int field, wire;
+	while (pb_field(&pb, &field, &wire)) {
+		if (wire != 2 || (field != 100 && field != 2)) {  pb_skip(&pb, wire);  continue;  }
+
+		pb_t layer = pb_bytes(&pb);
+		int name_field  = (field == 100 ? 1 : 4);
+		int blobs_field = (field == 100 ? 7 : 6);
+		bool match = false;
+		int n = 0;
+		int f, w;
+		for (pb_t l = layer; pb_field(&l, &f, &w); ) {
+			if (f == name_field && w == 2) {
+				pb_t s = pb_bytes(&l);
+				match = (s.end - s.p == (long)strlen(name) && !memcmp(s.p, name, s.end - s.p));
+			}
+			else  pb_skip(&l, w);
+		}
+		if (!match)  continue;
+
+		for (pb_t l = layer; pb_field(&l, &f, &w); ) {
+			if (f == blobs_field && w == 2 && n < max_blobs)  blobs[n++] = pb_blob(pb_bytes(&l));
+			else  pb_skip(&l, w);
+		}
+		return n;
+	}
+	return 0;
+}
+
+
+/**********************************************************************************/
+/* Network setup */
+
+static void
+net_free(net_t *n)
+{
+	if (!n)  return;
+	for (int i = 0; i < n->nlayers; i++) {
+		free(n->layers[i].name);
+		free(n->layers[i].w);
+		free(n->layers[i].b);
+		free(n->layers[i].wq);
+		free(n->layers[i].wscale);
+	}
+	free(n->layers);
+	free(n->buf[0]);  free(n->buf[1]);  free(n->padded);  free(n->qpadded);
+	free(n->input);
+	free(n);
+}
+
+static bool
+layer_type_is(char *type, char *name, char *v1_name)
+{
+	return (!strcmp(type, name) || !strcmp(type, v1_name));
+}
+
+static net_t *
+net_load_model(char *model_file)
+{
+	FILE *f = fopen(model_file, "r");
+	if (!f)  fail(model_file);
+	fseek(f, 0, SEEK_END);
+	long len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	char *text = cmalloc(len + 1);
+	if (fread(text, 1, len, f) != (size_t)len)  fail(model_file);
+	text[len] = 0;
+	fclose(f);
+
+	pt_lexer_t lex = { text, "", 1 };
+	pt_node_t *root = pt_parse_message(&lex, true);
+	free(text);
+
+	net_t *n = calloc2(1, net_t);
+	for (pt_node_t *l = root; l; l = l->next) {
+		if (strcmp(l->key, "layer") && strcmp(l->key, "layers"))  continue;
+		char *name = pt_get_str(l->child, "name");
+		char *type = pt_get_str(l->child, "type");
+		if (!name || !type)  die("cpunet: %s: layer without name or type\n", model_file);
+
+		layer_t layer = { 0, };
+		if (layer_type_is(type, "Input", "INPUT") ||
+		    layer_type_is(type, "Data", "DATA"))  continue;
+		else if (layer_type_is(type, "Convolution", "CONVOLUTION")) {
+			pt_node_t *p = pt_get(l->child, "convolution_param");
+			if (!p)  die("cpunet: %s: layer %s: missing convolution_param\n", model_file, name);
+			layer.type = LAYER_CONV;
+			layer.out = pt_get_int(p->child, "num_output", 0);
+			layer.k   = pt_get_int(p->child, "kernel_size", 0);
+			layer.pad = pt_get_int(p->child, "pad", 0);
+			char *bias = pt_get_str(p->child, "bias_term");
+			layer.bias_term = !bias || !strcmp(bias, "true");
+			if (pt_get_int(p->child, "stride", 1) != 1 || pt_get_int(p->child, "group", 1) != 1 ||
+			    layer.k != 2 * layer.pad + 1 || !layer.out)
+				die("cpunet: %s: layer %s: unsupported convolution (need stride 1, 'same' padding)\n", model_file, name);
+		}
+		else if (layer_type_is(type, "ReLU", "RELU"))		layer.type = LAYER_RELU;
+		else if (layer_type_is(type, "Softmax", "SOFTMAX"))	layer.type = LAYER_SOFTMAX;
+		else if (layer_type_is(type, "Flatten", "FLATTEN"))	layer.type = LAYER_FLATTEN;
+		else  die("cpunet: %s: layer %s: unsupported layer type %s, use caffe backend\n", model_file, name, type);
+
+		layer.name = strdup(name);
+		n->layers = crealloc(n->layers, (n->nlayers + 1) * sizeof(layer_t));
+		n->layers[n->nlayers++] = layer;
+	}
+	pt_free(root);
+	return n;
+}
+
+static void
+net_load_weights(net_t *n, char *weights_file)
+{
+	FILE *f = fopen(weights_file, "rb");
+	if (!f)  fail(weights_file);
+	fseek(f, 0, SEEK_END);
+	long len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	uint8_t *data = cmalloc(len);
+	if (fread(data, 1, len, f) != (size_t)len)  fail(weights_file);
+	fclose(f);
+
+	pb_t pb = { data, data + len };
+	int in = 0;  /* Unknown until first conv layer */
+	for (int i = 0; i < n->nlayers; i++) {
+		layer_t *l = &n->layers[i];
+		if (l->type != LAYER_CONV)  continue;
+
+		blob_t blobs[2] = { { NULL, 0 }, };
+		int nblobs = pb_layer_blobs(pb, l->name, blobs, 2);
+		if (nblobs < 1 + l->bias_term)  die("cpunet: %s: missing weights for layer %s\n", weights_file, l->name);
+		l->w = blobs[0].data;
+		l->b = (l->bias_term ? blobs[1].data : calloc2(l->out, float));
+		if (!l->bias_term)  free(blobs[1].data);
+
+		l->in = blobs[0].count / (l->out * l->k * l->k);
+		if (l->in * l->out * l->k * l->k != blobs[0].count || (in && l->in != in) ||
+		    (l->bias_term && blobs[1].count != l->out))
+			die("cpunet: %s: layer %s: weights don't match network\n", weights_file, l->name);
+		in = l->out;
+
+		n->max_channels = MAX(n->max_channels, MAX(l->in, l->out));
+		n->max_pad = MAX(n->max_pad, l->pad);
+	}
+	free(data);
+	if (!in)  die("cpunet: no convolution layers in network\n");
+}
+
+/* Convert conv weights to int8 */
+static void
+net_quantize(net_t *n)
+{
+	for (int i = 0; i < n->nlayers; i++) {
+		layer_t *l = &n->layers[i];
+		if (l->type != LAYER_CONV || l->wq)  continue;
+
+		int k2 = l->k * l->k;
+		l->icg = (l->in + 3) / 4;
+		l->wq = calloc2(l->out * l->icg * k2 * 4, int8_t);
+		l->wscale = calloc2(l->out, float);
+		for (int oc = 0; oc < l->out; oc++) {
+			const float *w = l->w + (size_t)oc * l->in * k2;
+			float max = 0;
+			for (int j = 0; j < l->in * k2; j++)
+				max = MAX(max, fabsf(w[j]));
+			l->wscale[oc] = (max > 0 ? max / 127 : 1);
+			for (int ic = 0; ic < l->in; ic++)
+			for (int t = 0; t < k2; t++)
+				l->wq[(((size_t)oc * l->icg + ic / 4) * k2 + t) * 4 + ic % 4] = lrintf(w[ic * k2 + t] / l->wscale[oc]);
+		}
+	}
+}
+
+/* Quantized plane size (positions) */
+#define qplane_size(w)  ((w) * (w) + (w) + CONV_SLACK)
+
+static void
+net_resize(net_t *n, int size)
+{
+	free(n->buf[0]);  free(n->buf[1]);  free(n->padded);  free(n->qpadded);
+	int w = size + 2 * n->max_pad;
+	n->size = size;
+	n->buf[0] = calloc2(n->max_channels * size * size, float);
+	n->buf[1] = calloc2(n->max_channels * size * size, float);
+	n->padded = calloc2(n->max_channels * w * w + w + CONV_SLACK, float);  /* + slack for shifted reads */
+	n->qpadded = calloc2((n->max_channels + 3) / 4 * qplane_size(w) * 4, uint8_t);
+}
+
+
+/**********************************************************************************/
+/* Forward pass */
+
+typedef struct {
+	layer_t *l;
+	float *padded;
+	float *out;
+	int size;
+	int oc_start, oc_end;
+	uint8_t *qpadded;	/* Quantized input */
+	float qscale;		/* Quantized input scale */
+} conv_job_t;
+
+static void *
+conv_job(void *arg)
+{
+	conv_job_t *job = arg;
+	topology_pin(TOPO_DCNN, -1);
+	layer_t *l = job->l;
+	int size = job->size;
+	int w = size + 2 * l->pad;
+	int n = size * w;	/* Output rows with padded stride */
+	int k2 = l->k * l->k;
+	int oc = job->oc_start;
+
+#if defined(__x86_64__) || defined(__i386__)
+	if (use_avx2) {
+		int nround = (n + CONV_CHUNK - 1) / CONV_CHUNK * CONV_CHUNK;
+		float acc4[4 * nround];
+		for (; oc + 4 <= job->oc_end; oc += 4) {
+			conv_oc4_avx2(l->w + (size_t)oc * l->in * k2, l->b + oc, l->in, l->k, w,
+				      job->padded, acc4, nround);
+			for (int j = 0; j < 4; j++) {
+				float *out = job->out + (size_t)(oc + j) * size * size;
+				for (int y = 0; y < size; y++)
+					memcpy(out + y * size, acc4 + j * nround + y * w, size * sizeof(float));
+			}
+		}
+	}
+#endif
+
+	float acc[n];
+	for (; oc < job->oc_end; oc++) {
+		for (int i = 0; i < n; i++)
+			acc[i] = l->b[oc];
+		const float *wk = l->w + (size_t)oc * l->in * k2;
+		for (int ic = 0; ic < l->in; ic++) {
+			const float *plane = job->padded + (size_t)ic * w * w;
+			for (int ky = 0; ky < l->k; ky++)
+			for (int kx = 0; kx < l->k; kx++, wk++)
+				axpy(acc, plane + ky * w + kx, *wk, n);
+		}
+		float *out = job->out + (size_t)oc * size * size;
+		for (int y = 0; y < size; y++)
+			memcpy(out + y * size, acc + y * w, size * sizeof(float));
+	}
+	return NULL;
+}
+
+static void *
+conv_job_int8(void *arg)
+{
+	conv_job_t *job = arg;
+	topology_pin(TOPO_DCNN, -1);
+	layer_t *l = job->l;
+	int size = job->size;
+	int w = size + 2 * l->pad;
+	int ps = qplane_size(w);
+	int n = size * w;	/* Output rows with padded stride */
+	int k2 = l->k * l->k;
+	int nround = (n + CONV_CHUNK_INT8 - 1) / CONV_CHUNK_INT8 * CONV_CHUNK_INT8;
+	int32_t acc[4 * nround];
+	int oc = job->oc_start;
+
+	while (oc < job->oc_end) {
+		int noc = 1;
+#if defined(__x86_64__) || defined(__i386__)
+		if (use_avx2 && oc + 4 <= job->oc_end) {
+			noc = 4;
+			conv_oc4_int8_avx2(l->wq + (size_t)oc * l->icg * k2 * 4, l->icg, l->k, w, ps,
+					   job->qpadded, acc, nround);
+		} else
+#endif
+		{
+			memset(acc, 0, n * sizeof(int32_t));
+			const int8_t *wq = l->wq + (size_t)oc * l->icg * k2 * 4;
+			for (int g = 0; g < l->icg; g++)
+			for (int t = 0; t < k2; t++, wq += 4) {
+				const uint8_t *x = job->qpadded + ((size_t)g * ps + (t / l->k) * w + t % l->k) * 4;
+				for (int i = 0; i < n; i++, x += 4)
+					acc[i] += x[0] * wq[0] + x[1] * wq[1] + x[2] * wq[2] + x[3] * wq[3];
+			}
+		}
+
+		/* Dequantize */
+		for (int j = 0; j < noc; j++, oc++) {
+			float scale = job->qscale * l->wscale[oc];
+			float *out = job->out + (size_t)oc * size * size;
+			int32_t *a = acc + j * nround;
+			for (int y = 0; y < size; y++)
+			for (int x = 0; x < size; x++)
+				out[y * size + x] = a[y * w + x] * scale + l->b[oc];
+		}
+	}
+	return NULL;
+}
+
+static void
+conv_run_jobs(layer_t *l, conv_job_t *proto, void *(*fn)(void *))
+{
+	int threads = MIN(nthreads, l->out);
+	if (threads <= 1) {
+		proto->oc_start = 0;  proto->oc_end = l->out;
+		fn(proto);
+		return;
+	}
+
+	conv_job_t jobs[threads];
+	threadpool_batch_t batch = THREADPOOL_BATCH_INIT;
+	for (int t = 0; t < threads; t++) {
+		jobs[t] = *proto;
+		jobs[t].oc_start = l->out * t / threads;
+		jobs[t].oc_end = l->out * (t + 1) / threads;
+		threadpool_run(&batch, fn, &jobs[t]);
+	}
+	threadpool_wait(&batch);
+}
+
+/* Quantized convolution, false if input can't be quantized. */
+static bool
+conv_forward_int8(net_t *n, layer_t *l, float *in, float *out)
+{
+	int size = n->size;
+	int w = size + 2 * l->pad;
+	int ps = qplane_size(w);
+	int count = l->in * size * size;
+
+	float max = 0;
+	for (int i = 0; i < count; i++) {
+		if (in[i] < 0)  return false;
+		max = MAX(max, in[i]);
+	}
+	float scale = (max > 0 ? max / 127 : 1);
+
+	/* Zero-padded input planes, 4 channels interleaved */
+	memset(n->qpadded, 0, (size_t)l->icg * ps * 4);
+	for (int c = 0; c < l->in; c++)
+	for (int y = 0; y < size; y++)
+	for (int x = 0; x < size; x++) {
+		int p = (y + l->pad) * w + x + l->pad;
+		n->qpadded[((size_t)(c / 4) * ps + p) * 4 + c % 4] = lrintf(in[(c * size + y) * size + x] / scale);
+	}
+
+	conv_job_t job = { l, NULL, out, size, 0, 0, n->qpadded, scale };
+	conv_run_jobs(l, &job, conv_job_int8);
+	return true;
+}
+
+static void
+conv_forward(net_t *n, layer_t *l, float *in, float *out, bool quantized)
+{
+	int size = n->size;
+	int w = size + 2 * l->pad;
+
+	if (quantized && l->wq && conv_forward_int8(n, l, in, out))
+		return;
+
+	/* Zero-padded input planes */
+	memset(n->padded, 0, (l->in * w * w + w + CONV_SLACK) * sizeof(float));
+	for (int c = 0; c < l->in; c++)
+	for (int y = 0; y < size; y++)
+		memcpy(n->padded + (c * w + y + l->pad) * w + l->pad, in + (c * size + y) * size, size * sizeof(float));
+
+	conv_job_t job = { l, n->padded, out, size, 0, 0, NULL, 0 };
+	conv_run_jobs(l, &job, conv_job);
+}
+
+static void
+softmax(float *v, int n, int stride)
+{
+	float max = v[0];
+	for (int i = 1; i < n; i++)  max = MAX(max, v[i * stride]);
+	float sum = 0;
+	for (int i = 0; i < n; i++)  sum += (v[i * stride] = expf(v[i * stride] - max));
+	for (int i = 0; i < n; i++)  v[i * stride] /= sum;
+}
+
+/* Run network on one input, returns output buffer. */
+static float *
+net_forward(net_t *n, float *input, int planes, bool quantized)
+{
+	int size = n->size, size2 = size * size;
+	float *cur = input, *next = n->buf[0];
+	int channels = planes;
+	bool flat = false;
+	if (n->layers[0].type != LAYER_CONV) {  /* Don't modify input in place */
+		memcpy(n->buf[1], input, planes * size2 * sizeof(float));
+		cur = n->buf[1];
+	}
+
+	for (int i = 0; i < n->nlayers; i++) {
+		layer_t *l = &n->layers[i];
+		switch (l->type) {
+			case LAYER_CONV:
+				if (l->in != channels)  die("cpunet: layer %s: expected %i input planes, got %i\n", l->name, l->in, channels);
+				conv_forward(n, l, cur, next, quantized);
+				channels = l->out;
+				cur = next;
+				next = (cur == n->buf[0] ? n->buf[1] : n->buf[0]);
+				break;
+			case LAYER_RELU:
+				for (int j = 0; j < channels * size2; j++)
+					cur[j] = MAX(cur[j], 0);
+				break;
+			case LAYER_FLATTEN:
+				flat = true;
+				break;
+			case LAYER_SOFTMAX:  /* Caffe default axis 1: channels, or everything if flattened */
+				if (flat)  softmax(cur, channels * size2, 1);
+				else       for (int j = 0; j < size2; j++)  softmax(cur + j, channels, size2);
+				break;
+		}
+	}
+	return cur;
+}
+
+
+/**********************************************************************************/
+
+bool
+cpunet_ready(void)
+{
+	return (net != NULL);
+}
+
+void
+cpunet_set_threads(int threads)
+{
+	nthreads = threads;
+}
+
+void
+cpunet_set_quantize(bool q)
+{
+	pthread_mutex_lock(&net_mutex);
+	quantize = q;
+	if (net && quantize)  net_quantize(net);
+	pthread_mutex_unlock(&net_mutex);
+}
+
+bool
+cpunet_quantized(void)
+{
+	return quantize;
+}
+
+void
+cpunet_init(int size, char *model, char *weights, char *name, int default_size)
+{
+	if (net && net->size == size)  return;   /* Nothing to do. */
+
+	if (!net) {
+		char model_file[256];    get_data_file(model_file, model);
+		char weights_file[256];  get_data_file(weights_file, weights);
+		if (!file_exists(model_file) || !file_exists(weights_file)) {
+			if (DEBUGL(1))  fprintf(stderr, "Loading dcnn files: %s, %s\n"
+						        "Couldn't find dcnn files, aborting.\n", model, weights);
+#ifdef _WIN32
+			popup("ERROR: Couldn't find Pachi data files.\n");
+#endif
+			exit(1);
+		}
+
+		select_kernels();
+		if (!nthreads)  nthreads = get_nprocessors();
+		net = net_load_model(model_file);
+		net_load_weights(net, weights_file);
+		if (quantize)  net_quantize(net);
+	}
+
+	/* Network is fully convolutional, just resize buffers. */
+	net_resize(net, size);
+
+	if (DEBUGL(1))
+		fprintf(stderr, "Loaded %s dcnn for %ix%i (built-in cpu engine%s)\n", name, size, size,
+			(quantize ? ", int8" : ""));
+}
+
+void
+cpunet_done(void)
+{
+	net_free(net);
+	net = NULL;
+}
+
+static void
+net_forward_batch(float *data, float **results, int n, int size, int planes)
+{
+	for (int k = 0; k < n; k++) {
+		float *out = net_forward(net, data + (size_t)k * planes * size * size, planes, quantize);
+		dcnn_output_copy(results[k], out, size * size);
+	}
+}
+
+/* Input buffer for @n positions, zeroed. Stays allocated between calls,
+ * caller builds input planes there and calls cpunet_forward(). */
+float *
+cpunet_input(int n, int size, int planes)
+{
+	assert(net && net->size == size);
+
+	pthread_mutex_lock(&net_mutex);
+	int count = n * planes * size * size;
+	if (count > net->input_size) {
+		free(net->input);
+		net->input = calloc2(count, float);
+		net->input_size = count;
+	}
+	else  memset(net->input, 0, count * sizeof(float));
+	net->input_planes = planes;
+	pthread_mutex_unlock(&net_mutex);
+	return net->input;
+}
+
+void
+cpunet_forward(float **results, int n, int size)
+{
+	assert(net && net->size == size);
+
+	pthread_mutex_lock(&net_mutex);
+	assert(n * net->input_planes * size * size <= net->input_size);
+	net_forward_batch(net->input, results, n, size, net->input_planes);
+	pthread_mutex_unlock(&net_mutex);
+}
+
+void
+cpunet_compare_quantized(float *data, int size, int planes, float *rfloat, float *rquant)
+{
+	assert(net && net->size == size);
+
+	pthread_mutex_lock(&net_mutex);
+	net_quantize(net);
+	dcnn_output_copy(rfloat, net_forward(net, data, planes, false), size * size);
+	dcnn_output_copy(rquant, net_forward(net, data, planes, true), size * size);
+	pthread_mutex_unlock(&net_mutex);
+}
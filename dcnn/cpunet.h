@@ -0,0 +1,23 @@
+#ifndef PACHI_DCNN_CPUNET_H
+#define PACHI_DCNN_CPUNET_H
+
+/* Built-in cpu inference engine for dcnn networks.
+ * Loads Caffe weights files directly (no Caffe / protobuf needed) and
+ * runs convolution / relu / softmax layers with avx2 / sse kernels.
+ * Only plain sequential networks are supported (detlef, darkforest).
+ * Optionally convolutions run with int8 weights / activations. */
+
+bool cpunet_ready(void);
+void cpunet_init(int size, char *model, char *weights, char *name, int default_size);
+void cpunet_done(void);
+float *cpunet_input(int n, int size, int planes);
+void cpunet_forward(float **results, int n, int size);
+void cpunet_set_threads(int threads);
+
+/* Use int8 quantized convolutions */
+void cpunet_set_quantize(bool quantize);
+bool cpunet_quantized(void);
+/* Evaluate one position with both float and int8 paths (accuracy checks) */
+void cpunet_compare_quantized(float *data, int size, int planes, float *rfloat, float *rquant);
+
+#endif /* PACHI_DCNN_CPUNET_H */
@@ -2,18 +2,19 @@
 #include <assert.h>
 #include <unistd.h>
 #include <math.h>
-
-/* Don't #include <openblas/cblas.h> just for this (build hell). */
-void openblas_set_num_threads(int num_threads);
+#include <pthread.h>
 
 #include "debug.h"
 #include "board.h"
 #include "engine.h"
 #include "caffe.h"
+#include "cpunet.h"
 #include "dcnn.h"
+#include "dcnn/dcnn_cache.h"
 #include "timeinfo.h"
 
-typedef void (*dcnn_evaluate_t)(board_t *b, enum stone color, float result[]);
+/* Fill dcnn input planes for position (data is zeroed already) */
+typedef void (*dcnn_planes_t)(board_t *b, enum stone color, float *data);
 typedef bool (*dcnn_supported_board_size_t)(board_t *b);
 
 typedef struct {
@@ -23,7 +24,8 @@ typedef struct {
 	char *weights_filename;
 	int  default_size;
 	dcnn_supported_board_size_t supported_board_size;
-	dcnn_evaluate_t             eval;
+	int                         planes;
+	dcnn_planes_t               make_planes;
 	int  *global_var;
 } dcnn_t;
 
@@ -34,32 +36,99 @@ static bool board_15x15(board_t *b)        {  return (board_rsize(b) == 15);  }
 static bool board_13x13_and_up(board_t *b) {  return (board_rsize(b) >= 13);  }
 
 #ifdef DCNN_DETLEF
-static void detlef54_dcnn_eval(board_t *b, enum stone color, float result[]);
-static void detlef44_dcnn_eval(board_t *b, enum stone color, float result[]);
+static void detlef54_dcnn_planes(board_t *b, enum stone color, float *data);
+static void detlef44_dcnn_planes(board_t *b, enum stone color, float *data);
 #endif
 #ifdef DCNN_DARKFOREST
-static void darkforest_dcnn_eval(board_t *b, enum stone color, float result[]);
+static void darkforest_dcnn_planes(board_t *b, enum stone color, float *data);
 #endif
 
 int darkforest_dcnn = 0;
 
 static dcnn_t dcnns[] = {
 #ifdef DCNN_DETLEF
-{  "detlef",     "Detlef's 54%", "detlef54.prototxt",  "detlef54.trained", 19, board_13x13_and_up,   detlef54_dcnn_eval },
-{  "detlef54",   "Detlef's 54%", "detlef54.prototxt",  "detlef54.trained", 19, board_13x13_and_up,   detlef54_dcnn_eval },
-{  "detlef44",   "Detlef's 44%", "detlef44.prototxt",  "detlef44.trained", 19, board_19x19,          detlef44_dcnn_eval },
+{  "detlef",     "Detlef's 54%", "detlef54.prototxt",  "detlef54.trained", 19, board_13x13_and_up, 13, detlef54_dcnn_planes },
+{  "detlef54",   "Detlef's 54%", "detlef54.prototxt",  "detlef54.trained", 19, board_13x13_and_up, 13, detlef54_dcnn_planes },
+{  "detlef44",   "Detlef's 44%", "detlef44.prototxt",  "detlef44.trained", 19, board_19x19,         2, detlef44_dcnn_planes },
 #endif
 #ifdef DCNN_DARKFOREST
-{  "df",         "Darkforest",   "df2.prototxt",       "df2.trained",      19, board_19x19,          darkforest_dcnn_eval,  &darkforest_dcnn },
-{  "darkforest", "Darkforest",   "df2.prototxt",       "df2.trained",      19, board_19x19,          darkforest_dcnn_eval,  &darkforest_dcnn },
-{  "df",         "Darkforest",   "df2_15x15.prototxt", "df2.trained",      15, board_15x15,          darkforest_dcnn_eval,  &darkforest_dcnn },
-{  "darkforest", "Darkforest",   "df2_15x15.prototxt", "df2.trained",      15, board_15x15,          darkforest_dcnn_eval,  &darkforest_dcnn },
+{  "df",         "Darkforest",   "df2.prototxt",       "df2.trained",      19, board_19x19,        25, darkforest_dcnn_planes,  &darkforest_dcnn },
+{  "darkforest", "Darkforest",   "df2.prototxt",       "df2.trained",      19, board_19x19,        25, darkforest_dcnn_planes,  &darkforest_dcnn },
+{  "df",         "Darkforest",   "df2_15x15.prototxt", "df2.trained",      15, board_15x15,        25, darkforest_dcnn_planes,  &darkforest_dcnn },
+{  "darkforest", "Darkforest",   "df2_15x15.prototxt", "df2.trained",      15, board_15x15,        25, darkforest_dcnn_planes,  &darkforest_dcnn },
 #endif
 {  0, }
 };
 
 static dcnn_t *dcnn = NULL;
 
+
+/* Inference backends
+ * input() returns backend's (zeroed) input buffer for n positions so
+ * plane builders write there directly, forward() runs the network on it.
+ * Both called with eval_mutex held. */
+
+typedef struct {
+	char *name;
+	bool (*ready)(void);
+	void (*init)(int size, char *model, char *weights, char *name, int default_size);
+	void (*done)(void);
+	float* (*input)(int n, int size, int planes);
+	void (*forward)(float **results, int n, int size);
+	void (*set_threads)(int threads);
+} dcnn_backend_t;
+
+#ifdef DCNN_CAFFE
+/* Don't #include <openblas/cblas.h> just for this (build hell). */
+void openblas_set_num_threads(int num_threads);
+static void caffe_set_threads(int threads)  {  openblas_set_num_threads(threads);  }
+#endif
+
+static dcnn_backend_t backends[] = {
+#ifdef DCNN_CAFFE
+{  "caffe",  caffe_ready,   caffe_init,   caffe_done,   caffe_input,   caffe_forward,   caffe_set_threads  },
+#endif
+{  "cpu",    cpunet_ready,  cpunet_init,  cpunet_done,  cpunet_input,  cpunet_forward,  cpunet_set_threads },
+{  0, }
+};
+
+static dcnn_backend_t *backend = &backends[0];
+static pthread_mutex_t eval_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void
+set_dcnn_backend(char *name)
+{
+	for (int i = 0; backends[i].name; i++)
+		if (!strcmp(name, backends[i].name)) {
+			backend = &backends[i];
+			return;
+		}
+	
+	die("Unknown dcnn backend '%s'\n", name);
+}
+
+bool
+dcnn_ready(void)
+{
+	return backend->ready();
+}
+
+/* Int8 quantized inference, only built-in cpu engine supports it. */
+void
+dcnn_set_quantize(bool quantize)
+{
+	if (quantize)  set_dcnn_backend("cpu");
+	cpunet_set_quantize(quantize);
+	dcnn_cache_clear();
+}
+
+bool
+dcnn_quantized(void)
+{
+	return (!strcmp(backend->name, "cpu") && cpunet_quantized());
+}
+
+
 #define dcnn_supported_board_size(b) (dcnn->supported_board_size(b))
 
 /* Find dcnn entry for @name (can also be model/weights filename). */
@@ -111,7 +180,7 @@ void require_dcnn(void)  {  dcnn_required = true;  }
 bool
 using_dcnn(board_t *b)
 {
-	bool r = dcnn_enabled && dcnn_supported_board_size(b) && caffe_ready();
+	bool r = dcnn_enabled && dcnn_supported_board_size(b) && backend->ready();
 	if (dcnn_required && !r)  die("dcnn required but not used, aborting.\n");
 	return r;
 }
@@ -123,20 +192,24 @@ dcnn_set_threads(int threads)
 	if (!dcnn_enabled)
 		return;
 	
-	openblas_set_num_threads(threads);
+	backend->set_threads(threads);
 }
 
 void
 dcnn_init(board_t *b)
 {
 	if (!dcnn)  dcnn = &dcnns[0];
-	if (dcnn_enabled && !dcnn_supported_board_size(b) && find_dcnn_for_board(b))
-		caffe_done();  /* Reload net */	
+	if (dcnn_enabled && !dcnn_supported_board_size(b) && find_dcnn_for_board(b)) {
+		backend->done();  /* Reload net */
+		dcnn_cache_clear();
+	}
 	if (dcnn_enabled && dcnn_supported_board_size(b)) {
-		caffe_init(board_rsize(b), dcnn->model_filename, dcnn->weights_filename, dcnn->full_name, dcnn->default_size);
+		backend->init(board_rsize(b), dcnn->model_filename, dcnn->weights_filename, dcnn->full_name, dcnn->default_size);
 		dcnn_blunder_init();
 	}
-	if (dcnn_required && !caffe_ready())  die("dcnn required, aborting.\n");
+	if (dcnn_required && !backend->ready())  die("dcnn required, aborting.\n");
+	if (cpunet_quantized() && strcmp(backend->name, "cpu"))
+		die("dcnn: quantized inference needs built-in cpu engine (--dcnn-backend=cpu)\n");
 }
 
 void
@@ -147,7 +220,14 @@ dcnn_evaluate_raw(board_t *b, enum stone color, float result[], ownermap_t *owne
 	assert(is_player_color(color));
 #endif
 	double time_start = time_now();
-	dcnn->eval(b, color, result);
+	if (!dcnn_cache_get(b, color, result)) {
+		int size = board_rsize(b);
+		pthread_mutex_lock(&eval_mutex);
+		dcnn->make_planes(b, color, backend->input(1, size, dcnn->planes));
+		backend->forward(&result, 1, size);
+		pthread_mutex_unlock(&eval_mutex);
+		dcnn_cache_put(b, color, result);
+	}
 	
 	if (debugl) {
 		if (!extra_log)  extra_log = "";
@@ -173,6 +253,60 @@ dcnn_evaluate(board_t *b, enum stone color, float result[], ownermap_t *ownermap
 	dcnn_fix_blunders(b, color, result, ownermap, debugl);
 }
 
+/* Raw dcnn output for @n positions at once (doesn't fix blunders).
+ * All boards must have the same size. Network runs with batch size @n,
+ * much faster than evaluating them one by one. */
+void
+dcnn_evaluate_batch(board_t **boards, enum stone *colors, int n, float **results)
+{
+	assert(n > 0);
+	int size = board_rsize(boards[0]);
+	int psize = dcnn->planes * size * size;
+	int todo[n];		/* Positions not in cache */
+	float *rr[n];
+	int k = 0;
+
+	double time_start = time_now();
+	for (int i = 0; i < n; i++) {
+#ifdef EXTRA_CHECKS
+		assert(!quick_board(boards[i]));
+		assert(is_player_color(colors[i]));
+#endif
+		assert(board_rsize(boards[i]) == size);
+		if (dcnn_cache_get(boards[i], colors[i], results[i]))  continue;
+		todo[k] = i;  rr[k++] = results[i];
+	}
+
+	if (k) {
+		pthread_mutex_lock(&eval_mutex);
+		float *data = backend->input(k, size, dcnn->planes);
+		for (int j = 0; j < k; j++)
+			dcnn->make_planes(boards[todo[j]], colors[todo[j]], data + j * psize);
+		backend->forward(rr, k, size);
+		pthread_mutex_unlock(&eval_mutex);
+	}
+	if (DEBUGL(3))  fprintf(stderr, "dcnn batch of %i in %.2fs\n", k, time_now() - time_start);
+
+	for (int j = 0; j < k; j++)
+		dcnn_cache_put(boards[todo[j]], colors[todo[j]], results[todo[j]]);
+}
+
+
+/* Evaluate position with both float and quantized network (accuracy checks).
+ * Raw outputs, bypasses cache. */
+bool
+dcnn_quantize_compare(board_t *b, enum stone color, float rfloat[], float rquant[])
+{
+	if (!dcnn_quantized() || !using_dcnn(b))  return false;
+	
+	int size = board_rsize(b);
+	float data[dcnn->planes * size * size];
+	memset(data, 0, sizeof(data));
+	dcnn->make_planes(b, color, data);
+	cpunet_compare_quantized(data, size, dcnn->planes, rfloat, rquant);
+	return true;
+}
+
 
 #ifdef DCNN_DETLEF
 /********************************************************************************************************/
@@ -183,13 +317,12 @@ dcnn_evaluate(board_t *b, enum stone color, float result[], ownermap_t *ownermap
  * http://physik.de/CNNlast.tar.gz */
 
 static void
-detlef54_dcnn_eval(board_t *b, enum stone color, float result[])
+detlef54_dcnn_planes(board_t *b, enum stone color, float *data_)
 {
 	assert(dcnn_supported_board_size(b));
 
 	int size = board_rsize(b);
-	float data[13][size][size];
-	memset(data, 0, sizeof(data));
+	float (*data)[size][size] = (float (*)[size][size])data_;	/* [13][size][size] */
 
 	for (int x = 0; x < size; x++)
 	for (int y = 0; y < size; y++) {
@@ -208,8 +341,6 @@ detlef54_dcnn_eval(board_t *b, enum stone color, float result[])
 		else if (c == last_move3(b).coord)   data[11][y][x] = 1.0;
 		else if (c == last_move4(b).coord)   data[12][y][x] = 1.0;
 	}
-
-	caffe_get_data((float*)data, result, size, 13, size);
 }
 
 
@@ -221,13 +352,12 @@ detlef54_dcnn_eval(board_t *b, enum stone color, float result[])
  * http://physik.de/net.tgz */
 
 static void
-detlef44_dcnn_eval(board_t *b, enum stone color, float result[])
+detlef44_dcnn_planes(board_t *b, enum stone color, float *data_)
 {
 	enum stone other_color = stone_other(color);
 
 	int size = board_rsize(b);
-	float data[2][size][size];
-	memset(data, 0, sizeof(data));
+	float (*data)[size][size] = (float (*)[size][size])data_;	/* [2][size][size] */
 
 	for (int y = 0; y < size; y++)
 	for (int x = 0; x < size; x++) {
@@ -235,8 +365,6 @@ detlef44_dcnn_eval(board_t *b, enum stone color, float result[])
 		if (board_at(b, c) == color)        data[0][y][x] = 1;
 		if (board_at(b, c) == other_color)  data[1][y][x] = 1;			
 	}
-
-	caffe_get_data((float*)data, result, size, 2, size);
 }
 #endif /* DCNN_DETLEF */
 
@@ -294,12 +422,11 @@ df_board_history_decay(board_t *b, coord_t coord, enum stone color)
 }
 
 static void
-darkforest_dcnn_eval(board_t *b, enum stone color, float result[])
+darkforest_dcnn_planes(board_t *b, enum stone color, float *data_)
 {
 	enum stone other_color = stone_other(color);
 	int size = board_rsize(b);
-	float data[25][size][size];
-	memset(data, 0, sizeof(data));
+	float (*data)[size][size] = (float (*)[size][size])data_;	/* [25][size][size] */
 	
 	float our_dist[size * size];
 	float opponent_dist[size * size];
@@ -360,8 +487,6 @@ darkforest_dcnn_eval(board_t *b, enum stone color, float result[])
 		/* planes 16-24: encode rank - set 9th plane for 9d */
 		data[24][y][x] = 1.0;
 	}
-
-	caffe_get_data((float*)data, result, size, 25, size);
 }
 #endif /* DCNN_DARKFOREST */
 
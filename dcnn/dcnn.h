@@ -1,6 +1,8 @@
 #ifndef PACHI_DCNN_H
 #define PACHI_DCNN_H
 
+/* Max positions per dcnn_evaluate_batch() call we make. */
+#define DCNN_BATCH_MAX 8
 
 #ifdef DCNN
 
@@ -12,6 +14,12 @@
 void set_dcnn(char *name);
 void list_dcnns(void);
 int dcnn_default_board_size(void);
+/* Choose inference backend (caffe, cpu) */
+void set_dcnn_backend(char *name);
+bool dcnn_ready(void);
+/* Int8 quantized inference (built-in cpu engine) */
+void dcnn_set_quantize(bool quantize);
+bool dcnn_quantized(void);
 
 /* Ensure / disable / check dcnn */
 void require_dcnn(void);
@@ -29,6 +37,10 @@ void dcnn_init(board_t *b);
 void dcnn_evaluate(board_t *b, enum stone color, float result[], ownermap_t *ownermap, bool debugl, char *extra_log);
 /* Raw dcnn output (doesn't fix blunders) */
 void dcnn_evaluate_raw(board_t *b, enum stone color, float result[], ownermap_t *ownermap, bool debugl, char *extra_log);
+/* Raw dcnn output for n positions at once (same board size) */
+void dcnn_evaluate_batch(board_t **boards, enum stone *colors, int n, float **results);
+/* Raw float and quantized outputs for same position, false if not quantizing */
+bool dcnn_quantize_compare(board_t *b, enum stone color, float rfloat[], float rquant[]);
 /* Get best moves */
 void get_dcnn_best_moves(board_t *b, float *r, best_moves_t *best);
 void print_dcnn_best_moves(best_moves_t *best);
@@ -58,12 +70,15 @@ coord2dcnn_idx(coord_t c)
 
 
 #define set_dcnn(n)		die("dcnn required but not compiled in, aborting.\n")
+#define set_dcnn_backend(n)	die("dcnn required but not compiled in, aborting.\n")
+#define dcnn_set_quantize(q)	die("dcnn required but not compiled in, aborting.\n")
 #define dcnn_default_board_size()  19
 #define disable_dcnn()		((void)0)
 #define require_dcnn()		die("dcnn required but not compiled in, aborting.\n")
 #define using_dcnn(b)		0
 #define dcnn_init(b)		((void)0)
 #define dcnn_set_threads(n)	((void)0)
+#define dcnn_evaluate_batch(boards, colors, n, results)  ((void)(boards), (void)(colors), assert(0))
 
 #define dcnn_blunder_init()	((void)0)
 #define disable_dcnn_blunder()	((void)0)
@@ -0,0 +1,263 @@
+#define DEBUG
+#include <assert.h>
+#include <pthread.h>
+
+#include "debug.h"
+#include "board.h"
+#include "dcnn/dcnn.h"
+#include "dcnn/dcnn_cache.h"
+
+/* LRU cache of raw dcnn outputs.
+ * Entries live in a fixed array, hash chains for lookup and a doubly-linked
+ * list for LRU order. Results are stored in canonical orientation when
+ * symmetry is enabled. Cache is tiny compared to a network evaluation so
+ * a single mutex is fine. */
+
+#define DCNN_CACHE_DEFAULT_SIZE 1024
+
+typedef struct {
+	hash_t key;
+	bool   used;
+	int    prev, next;		/* LRU list */
+	int    hnext;			/* Hash chain */
+	float  result[19 * 19];
+} dcnn_cache_entry_t;
+
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int  cache_size = DCNN_CACHE_DEFAULT_SIZE;
+static bool cache_symmetry = false;
+
+static dcnn_cache_entry_t *entries = NULL;
+static int *buckets = NULL;
+static int  buckets_mask = 0;
+static int  lru_head = -1, lru_tail = -1;
+
+static int hits = 0, misses = 0;
+
+void
+dcnn_cache_set_size(int n)
+{
+	assert(n >= 0);
+	pthread_mutex_lock(&cache_mutex);
+	free(entries);  entries = NULL;
+	free(buckets);  buckets = NULL;
+	cache_size = n;
+	pthread_mutex_unlock(&cache_mutex);
+}
+
+void
+dcnn_cache_set_symmetry(bool symmetry)
+{
+	dcnn_cache_clear();
+	cache_symmetry = symmetry;
+}
+
+/* Called with cache_mutex held */
+static void
+cache_reset(void)
+{
+	if (!entries) {
+		entries = calloc2(cache_size, dcnn_cache_entry_t);
+		int nbuckets = 1;
+		while (nbuckets < cache_size * 2)  nbuckets *= 2;
+		buckets = cmalloc(nbuckets * sizeof(int));
+		buckets_mask = nbuckets - 1;
+	}
+
+	for (int i = 0; i <= buckets_mask; i++)
+		buckets[i] = -1;
+	for (int i = 0; i < cache_size; i++) {
+		entries[i].used = false;
+		entries[i].prev = i - 1;
+		entries[i].next = (i + 1 < cache_size ? i + 1 : -1);
+	}
+	lru_head = 0;  lru_tail = cache_size - 1;
+}
+
+void
+dcnn_cache_clear(void)
+{
+	pthread_mutex_lock(&cache_mutex);
+	if (entries)  cache_reset();
+	pthread_mutex_unlock(&cache_mutex);
+}
+
+
+/**********************************************************************************/
+/* Keys and symmetries */
+
+/* Symmetry @sym (0-7) applied to board point (x, y) */
+static void
+sym_xy(int *x, int *y, int sym, int size)
+{
+	if (sym & 1)  *x = size - 1 - *x;
+	if (sym & 2)  *y = size - 1 - *y;
+	if (sym & 4) {  int t = *x;  *x = *y;  *y = t;  }
+}
+
+static int
+sym_coord_idx(coord_t c, int sym, int size)
+{
+	if (c < 0)  return -1;  /* pass, resign, none */
+	int x = coord_x(c) - 1,  y = coord_y(c) - 1;
+	sym_xy(&x, &y, sym, size);
+	return y * size + x;
+}
+
+static hash_t
+mix(hash_t h)
+{
+	h ^= h >> 33;  h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;  h *= 0xc4ceb9fe1a85ec53ULL;
+	return h ^ (h >> 33);
+}
+
+/* Position key as seen through symmetry @sym.
+ * Includes everything dcnn input planes depend on. */
+static hash_t
+cache_key(board_t *b, enum stone color, int sym)
+{
+	int size = board_rsize(b);
+	hash_t h = mix(size * 4 + color);
+
+	foreach_point(b) {
+		enum stone s = board_at(b, c);
+		if (s != S_BLACK && s != S_WHITE)  continue;
+		hash_t v = sym_coord_idx(c, sym, size) * 2 + (s == S_BLACK);
+#ifdef DCNN_DARKFOREST
+		if (darkforest_dcnn)  v += (hash_t)b->moveno[c] << 20;	/* history planes */
+#endif
+		h += mix(v + 1);
+	} foreach_point_end;
+
+	/* Ko and last moves: order matters */
+	coord_t last[] = { b->ko.coord, last_move(b).coord, last_move2(b).coord, last_move3(b).coord, last_move4(b).coord };
+	for (unsigned int i = 0; i < sizeof(last) / sizeof(*last); i++)
+		h = mix(h ^ (hash_t)(sym_coord_idx(last[i], sym, size) + 2) << (i * 10));
+	return h;
+}
+
+/* Find canonical symmetry and key for position. */
+static hash_t
+canonical_key(board_t *b, enum stone color, int *sym)
+{
+	*sym = 0;
+	hash_t key = cache_key(b, color, 0);
+	if (!cache_symmetry)  return key;
+
+	for (int s = 1; s < 8; s++) {
+		hash_t k = cache_key(b, color, s);
+		if (k < key) {  key = k;  *sym = s;  }
+	}
+	return key;
+}
+
+
+/**********************************************************************************/
+/* LRU */
+
+/* Called with cache_mutex held */
+static void
+lru_unlink(int i)
+{
+	dcnn_cache_entry_t *e = &entries[i];
+	if (e->prev >= 0)  entries[e->prev].next = e->next;  else  lru_head = e->next;
+	if (e->next >= 0)  entries[e->next].prev = e->prev;  else  lru_tail = e->prev;
+}
+
+static void
+lru_push_front(int i)
+{
+	dcnn_cache_entry_t *e = &entries[i];
+	e->prev = -1;  e->next = lru_head;
+	if (lru_head >= 0)  entries[lru_head].prev = i;
+	lru_head = i;
+	if (lru_tail < 0)  lru_tail = i;
+}
+
+static int
+cache_find(hash_t key)
+{
+	for (int i = buckets[key & buckets_mask]; i >= 0; i = entries[i].hnext)
+		if (entries[i].key == key)
+			return i;
+	return -1;
+}
+
+static void
+hash_unlink(int i)
+{
+	int *p = &buckets[entries[i].key & buckets_mask];
+	while (*p != i)  p = &entries[*p].hnext;
+	*p = entries[i].hnext;
+}
+
+
+/**********************************************************************************/
+
+bool
+dcnn_cache_get(board_t *b, enum stone color, float result[])
+{
+	if (!cache_size)  return false;
+
+	int sym;
+	hash_t key = canonical_key(b, color, &sym);
+	int size = board_rsize(b);
+
+	pthread_mutex_lock(&cache_mutex);
+	if (!entries)  cache_reset();
+
+	int i = cache_find(key);
+	if (i < 0) {
+		misses++;
+		pthread_mutex_unlock(&cache_mutex);
+		return false;
+	}
+
+	hits++;
+	lru_unlink(i);
+	lru_push_front(i);
+	for (int y = 0; y < size; y++)
+	for (int x = 0; x < size; x++) {
+		int sx = x, sy = y;
+		sym_xy(&sx, &sy, sym, size);
+		result[y * size + x] = entries[i].result[sy * size + sx];
+	}
+	pthread_mutex_unlock(&cache_mutex);
+
+	if (DEBUGL(3))  fprintf(stderr, "dcnn cache hit (%i hits, %i misses)\n", hits, misses);
+	return true;
+}
+
+void
+dcnn_cache_put(board_t *b, enum stone color, float result[])
+{
+	if (!cache_size)  return;
+
+	int sym;
+	hash_t key = canonical_key(b, color, &sym);
+	int size = board_rsize(b);
+
+	pthread_mutex_lock(&cache_mutex);
+	if (!entries)  cache_reset();
+
+	int i = cache_find(key);
+	if (i < 0) {  /* Recycle least recently used entry */
+		i = lru_tail;
+		if (entries[i].used)  hash_unlink(i);
+		entries[i].key = key;
+		entries[i].used = true;
+		entries[i].hnext = buckets[key & buckets_mask];
+		buckets[key & buckets_mask] = i;
+	}
+	lru_unlink(i);
+	lru_push_front(i);
+
+	for (int y = 0; y < size; y++)
+	for (int x = 0; x < size; x++) {
+		int sx = x, sy = y;
+		sym_xy(&sx, &sy, sym, size);
+		entries[i].result[sy * size + sx] = result[y * size + x];
+	}
+	pthread_mutex_unlock(&cache_mutex);
+}
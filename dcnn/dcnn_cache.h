@@ -0,0 +1,28 @@
+#ifndef PACHI_DCNN_CACHE_H
+#define PACHI_DCNN_CACHE_H
+
+#ifdef DCNN
+
+/* LRU cache of raw dcnn outputs, so positions that come up again
+ * (undo, pondering hits, analysis restarts ...) don't need another
+ * network evaluation. Keyed by position, color to play, ko and recent
+ * moves (dcnn history planes). Optionally positions are canonicalized
+ * over the 8 board symmetries. */
+
+/* Set cache size (number of positions, 0: disabled). */
+void dcnn_cache_set_size(int entries);
+void dcnn_cache_set_symmetry(bool symmetry);
+void dcnn_cache_clear(void);
+
+/* Lookup position, fill result[] and return true if found. */
+bool dcnn_cache_get(board_t *b, enum stone color, float result[]);
+void dcnn_cache_put(board_t *b, enum stone color, float result[]);
+
+#else
+
+#define dcnn_cache_set_size(entries)       ((void)0)
+#define dcnn_cache_set_symmetry(symmetry)  ((void)0)
+
+#endif
+
+#endif /* PACHI_DCNN_CACHE_H */
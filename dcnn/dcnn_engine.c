@@ -1,10 +1,10 @@
 #define DEBUG
 #include <assert.h>
+#include <math.h>
 
 #include "debug.h"
 #include "board.h"
 #include "engine.h"
-#include "caffe.h"
 #include "dcnn/dcnn.h"
 #include "pattern/mcowner.h"
 #include "dcnn/dcnn_engine.h"
@@ -40,6 +40,66 @@ dcnn_genmove(engine_t *e, board_t *b, time_info_t *ti, enum stone color, bool pa
 	return pass;
 }
 
+
+/* Quantized vs float network accuracy (t-predict) */
+typedef struct {
+	int    positions;
+	int    top1_agree;		/* Same best move */
+	int    float_hits, quant_hits;	/* Best move == game move */
+	double abs_diff;		/* Sum of mean abs diffs */
+	float  max_diff;
+} quantize_stats_t;
+
+static quantize_stats_t quantize_stats;
+
+static int
+best_idx(float *r, int n)
+{
+	int best = 0;
+	for (int i = 1; i < n; i++)
+		if (r[i] > r[best])  best = i;
+	return best;
+}
+
+static void
+dcnn_engine_collect_stats(engine_t *e, board_t *b, move_t *m, best_moves_t *best, int moves, int games)
+{
+	float rfloat[19 * 19], rquant[19 * 19];
+	if (!dcnn_quantize_compare(b, m->color, rfloat, rquant))  return;
+
+	quantize_stats_t *stats = &quantize_stats;
+	int n = board_rsize(b) * board_rsize(b);
+	int bf = best_idx(rfloat, n), bq = best_idx(rquant, n);
+	int played = (is_pass(m->coord) ? -1 : coord2dcnn_idx(m->coord));
+	double diff = 0;
+	for (int i = 0; i < n; i++) {
+		float d = fabsf(rfloat[i] - rquant[i]);
+		diff += d;
+		stats->max_diff = MAX(stats->max_diff, d);
+	}
+	stats->abs_diff += diff / n;
+	stats->top1_agree += (bf == bq);
+	stats->float_hits += (bf == played);
+	stats->quant_hits += (bq == played);
+	stats->positions++;
+}
+
+static void
+dcnn_engine_print_stats(engine_t *e, strbuf_t *buf, int moves, int games)
+{
+	quantize_stats_t *stats = &quantize_stats;
+	int n = stats->positions;
+	if (!n)  return;
+
+	sbprintf(buf, "Quantized dcnn vs float (%i positions):\n", n);
+	sbprintf(buf, "  same best move:   %5.1f%%\n", stats->top1_agree * 100.0 / n);
+	sbprintf(buf, "  guessed (float):  %5.1f%%\n", stats->float_hits * 100.0 / n);
+	sbprintf(buf, "  guessed (int8):   %5.1f%%\n", stats->quant_hits * 100.0 / n);
+	sbprintf(buf, "  mean abs diff:    %.6f\n", stats->abs_diff / n);
+	sbprintf(buf, "  max abs diff:     %.6f\n", stats->max_diff);
+	sbprintf(buf, " \n");
+}
+
 #define option_error engine_setoption_error
 
 static bool
@@ -66,6 +126,8 @@ dcnn_engine_init(engine_t *e, board_t *b)
 	e->genmove = dcnn_genmove;
 	e->best_moves = dcnn_best_moves;
 	e->setoption = dcnn_engine_setoption;
+	e->collect_stats = dcnn_engine_collect_stats;
+	e->print_stats = dcnn_engine_print_stats;
 
 	/* Process engine options. */
 	char *err;
@@ -75,7 +137,7 @@ dcnn_engine_init(engine_t *e, board_t *b)
 			die("%s", err);
 	
 	dcnn_init(b);
-	if (!caffe_ready()) {
+	if (!dcnn_ready()) {
 		fprintf(stderr, "Couldn't initialize dcnn, aborting.\n");
 		abort();
 	}
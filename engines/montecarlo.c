@@ -130,7 +130,7 @@ montecarlo_genmove(engine_t *e, board_t *b, time_info_t *ti, enum stone color, b
 		assert(!b->superko_violation);
 
 		board_t b2;
-		board_copy(&b2, b);
+		board_copy_playout(&b2, b);
 
 		/* Play one random move first. */
 		coord_t coord = board_play_random(&b2, color, NULL, NULL);
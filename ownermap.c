@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
@@ -17,6 +18,33 @@ ownermap_init(ownermap_t *ownermap)
 	memset(ownermap, 0, sizeof(*ownermap));
 }
 
+static pthread_mutex_t merge_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void
+ownermap_merge(board_t *b, ownermap_t *dst, ownermap_t *src)
+{
+	if (!src->playouts)  return;
+
+	pthread_mutex_lock(&merge_mutex);
+	int n = board_max_coords(b);
+	for (int c = 0; c < n; c++)
+		for (int i = 0; i < S_MAX; i++)
+			dst->map[c][i] += src->map[c][i];
+
+	/* Combine score variances (parallel algorithm, score_sq_dev
+	 * holds M2 / playouts), then averages. */
+	int na = dst->avg_score.playouts,  nb = src->avg_score.playouts;
+	floating_t delta = src->avg_score.value - dst->avg_score.value;
+	floating_t m2 = dst->score_sq_dev.value * na + src->score_sq_dev.value * nb +
+			delta * delta * na * nb / (na + nb);
+	dst->score_sq_dev.value = m2 / (na + nb);
+	dst->score_sq_dev.playouts = na + nb;
+	stats_merge(&dst->avg_score, &src->avg_score);
+
+	dst->playouts += src->playouts;
+	pthread_mutex_unlock(&merge_mutex);
+}
+
 static void
 printhook(board_t *board, coord_t c, strbuf_t *buf, void *data)
 {
@@ -50,12 +78,23 @@ void
 ownermap_fill(ownermap_t *ownermap, board_t *b, floating_t score)
 {
 	ownermap->playouts++;
+#ifdef BOARD_BITBOARD
+	/* Walk owner masks instead of classifying points one by one. */
+	bitboard_t black, white, dame;
+	board_fast_owners(b, true, &black, &white);
+	bb_or(&dame, &black, &white);
+	bb_andnot(&dame, &board_statics.onboard, &dame);
+	foreach_bb_coord(&black) {  ownermap->map[c][S_BLACK]++;  } foreach_bb_coord_end;
+	foreach_bb_coord(&white) {  ownermap->map[c][S_WHITE]++;  } foreach_bb_coord_end;
+	foreach_bb_coord(&dame)  {  ownermap->map[c][S_NONE]++;   } foreach_bb_coord_end;
+#else
 	foreach_point(b) {
 		enum stone color = board_at(b, c);
 		if (color == S_OFFBOARD)  continue;
 		if (color == S_NONE)      color = board_eye_color(b, c);
 		ownermap->map[c][color]++;
 	} foreach_point_end;
+#endif
 
 	/* Keep track of average score, deviation. */
 	floating_t prev_avg = ownermap->avg_score.value;
@@ -35,7 +35,8 @@ typedef struct {
 } group_judgement_t;
 
 /* Map of final owners of all intersections on the board.
- * This may be shared between multiple threads!
+ * This may be shared between multiple threads! (workers filling it after each
+ * playout use their own and merge it periodically, see ownermap_merge())
  * XXX  We assume sig_atomic_t is thread-atomic. This may not be true in pathological cases.
  * TODO We may want to switch to a dedicated struct for playout stats at some point. */
 typedef struct ownermap {
@@ -51,6 +52,10 @@ void ownermap_init(ownermap_t *ownermap);
 void board_print_ownermap(board_t *b, FILE *f, ownermap_t *ownermap);
 /* Fill ownermap at the end of playout */
 void ownermap_fill(ownermap_t *ownermap, board_t *b, floating_t score);
+/* Add thread-local ownermap @src to shared ownermap @dst.
+ * Workers fill their own ownermap and merge it once in a while,
+ * so they don't all write to the shared one after each playout. */
+void ownermap_merge(board_t *b, ownermap_t *dst, ownermap_t *src);
 
 /* Coord ownermap status: dame / black / white / unclear */
 enum point_judgement ownermap_judge_point(ownermap_t *ownermap, coord_t c, floating_t thres);
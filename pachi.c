@@ -22,6 +22,7 @@
 #include "fifo.h"
 #include "dcnn/dcnn.h"
 #include "dcnn/caffe.h"
+#include "dcnn/dcnn_cache.h"
 #include "pattern/pattern.h"
 #include "pattern/spatial.h"
 #include "pattern/prob.h"
@@ -240,7 +241,11 @@ usage(char *arg)
 		"      --dcnn=name                   choose which dcnn to load (default detlef) \n"
 		"      --dcnn=file                   \n"
 		"      --list-dcnns                  show supported networks \n"
+		"      --dcnn-backend=name           inference backend: caffe, cpu       (default: caffe if built) \n"
 		"      --nodcnn-blunder              don't filter dcnn blunders         (default: enabled) \n"
+		"      --dcnn-cache SIZE             cache dcnn output for SIZE positions (default: 1024) \n"
+		"      --dcnn-cache-symmetry         share cache entries between symmetric positions \n"
+		"      --dcnn-quantize               int8 inference (cpu backend, faster, less accurate) \n"
 		"      --verbose-caffe               enable caffe logging \n"		
 		" \n"
 #endif
@@ -302,6 +307,10 @@ usage(char *arg)
 #define OPT_MODERN_JOSEKI     281
 #define OPT_KATA_CONFIG	      282
 #define OPT_KATA_MODEL	      283
+#define OPT_DCNN_CACHE        284
+#define OPT_DCNN_CACHE_SYM    285
+#define OPT_DCNN_BACKEND      286
+#define OPT_DCNN_QUANTIZE     287
 
 
 static struct option longopts[] = {
@@ -310,6 +319,12 @@ static struct option longopts[] = {
 	{ "compile-flags",          no_argument,       0, OPT_COMPILE_FLAGS },
 	{ "debug-level",            required_argument, 0, 'd' },
 	{ "dcnn",                   optional_argument, 0, OPT_DCNN },
+#ifdef DCNN
+	{ "dcnn-backend",           required_argument, 0, OPT_DCNN_BACKEND },
+	{ "dcnn-cache",             required_argument, 0, OPT_DCNN_CACHE },
+	{ "dcnn-cache-symmetry",    no_argument,       0, OPT_DCNN_CACHE_SYM },
+	{ "dcnn-quantize",          no_argument,       0, OPT_DCNN_QUANTIZE },
+#endif
 	{ "engine",                 required_argument, 0, 'e' },
 #ifdef JOSEKIFIX
 	{ "external-joseki-engine", required_argument, 0, OPT_EXT_JOSEKI_ENGINE },
@@ -429,6 +444,18 @@ int main(int argc, char *argv[])
 				if (optarg)  set_dcnn(optarg);
 				require_dcnn();
 				break;
+			case OPT_DCNN_BACKEND:
+				set_dcnn_backend(optarg);
+				break;
+			case OPT_DCNN_CACHE:
+				dcnn_cache_set_size(atoi(optarg));
+				break;
+			case OPT_DCNN_CACHE_SYM:
+				dcnn_cache_set_symmetry(true);
+				break;
+			case OPT_DCNN_QUANTIZE:
+				dcnn_set_quantize(true);
+				break;
 			case 'e':
 				engine_id = engine_name_to_id(optarg);
 				if (engine_id == E_MAX)
@@ -1,5 +1,4 @@
 #include <assert.h>
-#include <pthread.h>
 #include <stdio.h>
 
 #define DEBUG
@@ -10,6 +9,8 @@
 #include "playout.h"
 #include "playout/moggy.h"
 #include "pattern/mcowner.h"
+#include "threadpool.h"
+#include "topology.h"
 
 
 /******************************************************************************************/
@@ -38,13 +39,21 @@ mcowner_worker_thread(void *ctx_)
 	mcowner_thread_ctx_t *ctx = (mcowner_thread_ctx_t*)ctx_;
 	uint64_t random_state;
 	fast_srandom(&random_state, ctx->seed);
+	topology_pin(TOPO_SEARCH, ctx->tid);
+
+	/* Own ownermap, merged at the end */
+	ownermap_t *ownermap = (ctx->ownermap ? calloc2(1, ownermap_t) : NULL);
 
 	/* Run */
 	while (thread_playouts < ctx->games) {
-		batch_playout(ctx->b, ctx->color, ctx->playout, ctx->ownermap, ctx->amafmap_needed, ctx->collect_data, ctx->data);
+		batch_playout(ctx->b, ctx->color, ctx->playout, ownermap, ctx->amafmap_needed, ctx->collect_data, ctx->data);
 		__sync_fetch_and_add(&thread_playouts, 1);
 	}
 
+	if (ownermap) {
+		ownermap_merge(ctx->b, ctx->ownermap, ownermap);
+		free(ownermap);
+	}
 	return NULL;
 }
 
@@ -57,8 +66,8 @@ mcowner_spawn_threads(int threads, int games, board_t *b, enum stone color,
 	
 	thread_playouts = 0;
 	
-	/* Spawn threads... */
-	pthread_t pthreads[threads];
+	/* Dispatch workers... */
+	threadpool_batch_t batch = THREADPOOL_BATCH_INIT;
 	mcowner_thread_ctx_t threads_ctx[threads];
 	for (int ti = 0; ti < threads; ti++) {
 		mcowner_thread_ctx_t *ctx = &threads_ctx[ti];
@@ -72,19 +81,11 @@ mcowner_spawn_threads(int threads, int games, board_t *b, enum stone color,
 		ctx->amafmap_needed = amafmap_needed;
 		ctx->collect_data = collect_data;
 		ctx->data = data;
-		
-		pthread_attr_t a;
-		pthread_attr_init(&a);
-		pthread_attr_setstacksize(&a, 1048576);
-		pthread_create(&pthreads[ti], &a, mcowner_worker_thread, ctx);
-		if (DEBUGL(4))  fprintf(stderr, "Spawned worker %d\n", ti);
+		threadpool_run(&batch, mcowner_worker_thread, ctx);
 	}
 
-	/* ...and collect them back: */
-	for (int ti = 0; ti < threads; ti++) {
-		pthread_join(pthreads[ti], NULL);
-		if (DEBUGL(4))  fprintf(stderr, "Joined worker %d\n", ti);
-	}
+	/* ...and wait for them. */
+	threadpool_wait(&batch);
 }
 
 
@@ -97,7 +98,7 @@ batch_playout(board_t *board, enum stone color, playout_t *playout,
 	      ownermap_t *ownermap, bool amafmap_needed,
 	      collect_data_t collect_data, void *data)
 {
-	board_t b2;  board_copy(&b2, board);
+	board_t b2;  board_copy_playout(&b2, board);
 	board_t *b = &b2;
 
 	/* amafmap: if needed each worker must have its own. */
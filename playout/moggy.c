@@ -957,11 +957,10 @@ eyefill_skip:
 static void
 playout_moggy_setboard(playout_policy_t *playout_policy, board_t *b)
 {
-	if (b->ps)
-		return;
-	moggy_state_t *ps = malloc2(moggy_state_t);
+	/* State may be reused across playouts (board_restore()) */
+	moggy_state_t *ps = (moggy_state_t*)b->ps;
+	if (!ps)  b->ps = ps = malloc2(moggy_state_t);
 	ps->last_selfatari[S_BLACK] = ps->last_selfatari[S_WHITE] = 0;
-	b->ps = ps;
 }
 
 playout_policy_t *
@@ -9,10 +9,23 @@
  * What this means in practice is that perhaps the value will get
  * slightly wrong, but not drastically corrupted. */
 
+#include <stdint.h>
+#include "random.h"
+
+/* With float values stats fit in one 64-bit word which is updated
+ * with a single compare-and-swap. */
+#ifndef DOUBLE_FLOATING
+#define STATS_CAS 1
+#endif
+
 typedef struct {
 	floating_t value; // BLACK wins/playouts
 	int playouts; // # of playouts
-} move_stats_t;
+}
+#ifdef STATS_CAS
+__attribute__((aligned(8)))
+#endif
+move_stats_t;
 
 #define move_stats(value, playouts)  { value, playouts }
 
@@ -29,6 +42,46 @@ static void stats_merge(move_stats_t *dest, move_stats_t *src);
 static void stats_reverse_parity(move_stats_t *s);
 
 
+#ifdef STATS_CAS
+
+/* Value and playouts are read and written together as one word:
+ * updates are really atomic (no lost results) and need no extra barriers. */
+
+typedef uint64_t __attribute__((may_alias)) stats_word_t;
+
+typedef union {
+	move_stats_t s;
+	stats_word_t w;
+} stats_packed_t;
+
+static inline void
+stats_add_result(move_stats_t *s, floating_t result, int playouts)
+{
+	stats_packed_t old, new;
+	do {
+		old.w = *(volatile stats_word_t*)s;
+		new.s.playouts = old.s.playouts + playouts;
+		new.s.value = old.s.value + (result - old.s.value) * playouts / new.s.playouts;
+	} while (!__sync_bool_compare_and_swap((stats_word_t*)s, old.w, new.w));
+}
+
+static inline void
+stats_rm_result(move_stats_t *s, floating_t result, int playouts)
+{
+	stats_packed_t old, new;
+	do {
+		old.w = *(volatile stats_word_t*)s;
+		new.s = old.s;
+		if (old.s.playouts > playouts) {
+			new.s.playouts = old.s.playouts - playouts;
+			new.s.value = old.s.value + (old.s.value - result) * playouts / new.s.playouts;
+		} else
+			new.s.playouts = 0;  /* Leave value as is */
+	} while (!__sync_bool_compare_and_swap((stats_word_t*)s, old.w, new.w));
+}
+
+#else /* !STATS_CAS */
+
 /* We actually do the atomicity in a pretty hackish way - we simply
  * rely on the fact that int,floating_t operations should be atomic with
  * reasonable compilers (gcc) on reasonable architectures (i386,
@@ -84,6 +137,8 @@ stats_rm_result(move_stats_t *s, floating_t result, int playouts)
 	}
 }
 
+#endif /* STATS_CAS */
+
 static inline void
 stats_merge(move_stats_t *dest, move_stats_t *src)
 {
@@ -100,4 +155,113 @@ stats_reverse_parity(move_stats_t *s)
 	s->value = 1 - s->value;
 }
 
+/* Tree node statistics: fixed point win count and playouts.
+ * Float running averages stop registering new results once playouts get
+ * large (24 bits of mantissa, problem already past ~1M playouts) and
+ * DOUBLE_FLOATING doubles memory. Instead keep the sum of results in fixed
+ * point and playouts packed in one 64-bit word, same size as move_stats_t:
+ * updates are a single atomic add and win / loss results stay exact up to
+ * NODE_STATS_HALVE_PLAYOUTS.
+ * Value is derived when needed, use node_stats_value() / node_stats_get().
+ * Results are clamped to 0..1 and rounded to 1/NODE_STATS_SCALE: rounding is
+ * stochastic so it's unbiased, results close to 0 or 1 (val_scale,
+ * maximize_score) still average out right.
+ * Past NODE_STATS_HALVE_PLAYOUTS playouts and wins are halved (value stays
+ * the same, older results count less) so playouts never carry into wins. */
+
+#define NODE_STATS_PLAYOUTS_BITS 29
+#define NODE_STATS_SCALE_BITS    6
+#define NODE_STATS_SCALE         (1 << NODE_STATS_SCALE_BITS)
+#define NODE_STATS_MAX_PLAYOUTS  ((1 << NODE_STATS_PLAYOUTS_BITS) - 1)
+#define NODE_STATS_HALVE_PLAYOUTS  (1 << (NODE_STATS_PLAYOUTS_BITS - 1))
+
+/* Both bitfields must have the same type so they share one 64-bit unit
+ * with ms bitfields layout too (mingw default). */
+typedef union {
+	struct {
+		uint64_t playouts:NODE_STATS_PLAYOUTS_BITS;            // # of playouts
+		uint64_t wins:64 - NODE_STATS_PLAYOUTS_BITS;           // sum of BLACK results * NODE_STATS_SCALE
+	};
+	uint64_t w;
+} node_stats_t;
+
+_Static_assert(sizeof(node_stats_t) == 8, "node_stats_t must fit in one 64-bit word");
+
+/* Fixed point sum for @playouts results of @value */
+static inline uint64_t
+node_stats_wins(floating_t value, int playouts)
+{
+	if (value < 0)  value = 0;
+	if (value > 1)  value = 1;
+	return (uint64_t)((double)value * playouts * NODE_STATS_SCALE + 0.5);
+}
+
+/* Same with unbiased stochastic rounding */
+static inline uint64_t
+node_stats_wins_dither(floating_t value, int playouts)
+{
+	if (value < 0)  value = 0;
+	if (value > 1)  value = 1;
+	double w = (double)value * playouts * NODE_STATS_SCALE;
+	uint64_t i = (uint64_t)w;
+	if (w > i && fast_random(1 << 16) < (w - i) * (1 << 16))
+		i++;
+	return i;
+}
+
+/* Halve playouts and wins, if still needed. */
+static inline void
+node_stats_halve(node_stats_t *s)
+{
+	while (1) {
+		node_stats_t v = { .w = *(volatile uint64_t*)&s->w };
+		if (v.playouts < NODE_STATS_HALVE_PLAYOUTS)  return;
+		node_stats_t h = v;
+		h.playouts = v.playouts / 2;
+		h.wins = v.wins / 2;
+		if (__sync_bool_compare_and_swap(&s->w, v.w, h.w))  return;
+	}
+}
+
+/* Add a result to the stats.
+ * @playouts must stay small compared to NODE_STATS_HALVE_PLAYOUTS:
+ * concurrent adds all fit in the remaining headroom. */
+static inline void
+node_stats_add_result(node_stats_t *s, floating_t result, int playouts)
+{
+	if (unlikely(s->playouts >= NODE_STATS_HALVE_PLAYOUTS))
+		node_stats_halve(s);
+	uint64_t w = node_stats_wins_dither(result, playouts);
+	__sync_fetch_and_add(&s->w, (w << NODE_STATS_PLAYOUTS_BITS) + playouts);
+}
+
+/* BLACK wins/playouts (0 if no playouts) */
+static inline floating_t
+node_stats_value(node_stats_t *s)
+{
+	node_stats_t v = { .w = *(volatile uint64_t*)&s->w };
+	return (v.playouts ? (floating_t)v.wins / NODE_STATS_SCALE / v.playouts : 0);
+}
+
+/* Snapshot as move_stats_t */
+static inline move_stats_t
+node_stats_get(node_stats_t *s)
+{
+	node_stats_t v = { .w = *(volatile uint64_t*)&s->w };
+	move_stats_t r = move_stats((v.playouts ? (floating_t)v.wins / NODE_STATS_SCALE / v.playouts : 0),
+				    v.playouts);
+	return r;
+}
+
+/* Set stats from move_stats_t (not atomic) */
+static inline void
+node_stats_set(node_stats_t *s, move_stats_t *src)
+{
+	int playouts = src->playouts;
+	if (playouts < 0)  playouts = 0;
+	if (playouts > NODE_STATS_MAX_PLAYOUTS)  playouts = NODE_STATS_MAX_PLAYOUTS;
+	s->playouts = playouts;
+	s->wins = node_stats_wins(src->value, playouts);
+}
+
 #endif
@@ -0,0 +1,27 @@
+% Tree node stats
+boardsize 9
+. . . . . . . . .
+. . . . . . . . .
+. . . . . . . . .
+. . . . . . . . .
+. . . . . . . . .
+. . . . . . . . .
+. . . . . . . . .
+. . . . . . . . .
+. . . . . . . . .
+
+node_stats 0
+node_stats 1
+node_stats 0.5
+node_stats 0.3
+
+# val_scale=0.01 results: mustn't round to plain win / loss
+node_stats 0.995
+node_stats 0.005
+node_stats 0.99
+
+# Playouts limit: stats get halved, value stays the same
+node_stats 0    268400000
+node_stats 1    268400000
+node_stats 0.7  268400000
+node_stats 0.7  600000000
@@ -0,0 +1,13 @@
+% Position cache: key, merge, eviction, checksum
+boardsize 9
+. . . . . . . . .
+. . . . . . . . .
+. . . . . . . . .
+. . . . . . . . .
+. . . . . . . . .
+. . . . . . . . .
+. . . . . . . . .
+. . . . . . . . .
+. . . . . . . . .
+
+poscache
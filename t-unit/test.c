@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <unistd.h>
 
 #include "board.h"
 #include "debug.h"
@@ -24,7 +25,13 @@
 #include "playout/moggy.h"
 #include "engines/replay.h"
 #include "uct/internal.h"
+#include "uct/search.h"
+#include "uct/poscache.h"
+#include "uct/tree.h"
+#include "uct/treecache.h"
+#include "uct/uct.h"
 #include "dcnn/dcnn.h"
+#include "dcnn/dcnn_cache.h"
 
 
 /* Running tests over gtp ? */
@@ -1365,6 +1372,207 @@ is_selfatari_stress_test(board_t *b, char *arg)
 }
 
 
+/**************************************************************************************************/
+/* board_restore() stress test */
+
+typedef struct {
+	board_t *r;			/* Playout board, restored after each playout */
+	board_t *ref;			/* Reference board_copy() */
+	board_checkpoint_t *cp;
+	int checks;
+} board_restore_test_t;
+
+/* Compare fields playouts care about. Group info only for existing groups. */
+static int
+board_restore_cmp(board_t *b1, board_t *b2)
+{
+	int n = board_max_coords(b1);
+
+	if (b1->moves != b2->moves ||
+	    b1->captures[S_BLACK] != b2->captures[S_BLACK] ||
+	    b1->captures[S_WHITE] != b2->captures[S_WHITE] ||
+	    b1->passes[S_BLACK] != b2->passes[S_BLACK] ||
+	    b1->passes[S_WHITE] != b2->passes[S_WHITE]) {
+		fprintf(stderr, "differs in main vars\n");  return 1;  }
+	if (move_cmp(&last_move(b1), &last_move(b2)) ||
+	    move_cmp(&last_move2(b1), &last_move2(b2))) {
+		fprintf(stderr, "differs in last_move\n");  return 1;  }
+	if (move_cmp(&b1->ko, &b2->ko) ||
+	    move_cmp(&b1->last_ko, &b2->last_ko) ||
+	    b1->last_ko_age != b2->last_ko_age) {
+		fprintf(stderr, "differs in ko\n");  return 1;  }
+	if (b1->hash != b2->hash) {
+		fprintf(stderr, "differs in hash\n");  return 1;  }
+
+	if (memcmp(b1->b, b2->b, n * sizeof(b1->b[0]))) {
+		fprintf(stderr, "differs in b\n");  return 1;  }
+	if (memcmp(b1->n, b2->n, n * sizeof(b1->n[0]))) {
+		fprintf(stderr, "differs in n\n");  return 1;  }
+	if (memcmp(b1->g, b2->g, n * sizeof(b1->g[0]))) {
+		fprintf(stderr, "differs in g\n");  return 1;  }
+	if (memcmp(b1->p, b2->p, n * sizeof(b1->p[0]))) {
+		fprintf(stderr, "differs in p\n");  return 1;  }
+#ifdef BOARD_BITBOARD
+	if (memcmp(b1->bb, b2->bb, sizeof(b1->bb))) {
+		fprintf(stderr, "differs in bb\n");  return 1;  }
+#endif
+#ifdef BOARD_PAT3
+	if (memcmp(b1->pat3, b2->pat3, n * sizeof(b1->pat3[0]))) {
+		fprintf(stderr, "differs in pat3\n");  return 1;  }
+#endif
+	if (b1->flen != b2->flen ||
+	    memcmp(b1->f, b2->f, b1->flen * sizeof(b1->f[0]))) {
+		fprintf(stderr, "differs in f\n");  return 1;  }
+	foreach_free_point(b1) {
+		if (b1->fmap[c] != b2->fmap[c]) {
+			fprintf(stderr, "differs in fmap\n");  return 1;  }
+	} foreach_free_point_end;
+
+	for (coord_t c = 0; c < n; c++)
+		if (group_at(b1, c) == c &&
+		    memcmp(&b1->gi[c], &b2->gi[c], sizeof(b1->gi[c]))) {
+			fprintf(stderr, "differs in gi (%s)\n", coord2sstr(c));  return 1;  }
+
+	return 0;
+}
+
+/* Checkpoint current position, play a few random playouts on a playout
+ * board restoring it each time, and check it matches a fresh board_copy(). */
+static void
+board_restore_sanity_checks(board_t *b, void *data)
+{
+	board_restore_test_t *t = (board_restore_test_t*)data;
+	board_t *r = t->r;
+
+	board_checkpoint(t->cp, b);
+	board_copy_playout(r, b);
+	board_copy(t->ref, b);
+
+	for (int i = 0; i < 3; i++) {
+		enum stone color = board_to_play(b);
+		for (int moves = 0; moves < 40; moves++, color = stone_other(color))
+			board_play_random(r, color, NULL, NULL);
+
+		board_restore(r, t->cp);
+		t->checks++;
+
+		if (board_restore_cmp(r, t->ref)) {
+			board_print(b, stderr);
+			fprintf(stderr, "board_restore() mismatch after %i playouts\n", i + 1);
+			assert(0);
+		}
+	}
+
+	if (DEBUGL(2) && t->checks % 1024 == 0) {
+		fprintf(stderr, "Checking restores ...  %i   %i games\r", t->checks, stress_test.game);
+		fflush(stderr);
+	}
+}
+
+/* Play some games and double check board_restore() at every move. */
+static bool
+board_restore_stress_test(board_t *b, char *arg)
+{
+	args_end();
+	board_print_test(b);
+
+	board_restore_test_t t = { 0, };
+	t.r = malloc2(board_t);
+	t.ref = malloc2(board_t);
+	t.cp = malloc2(board_checkpoint_t);
+
+	stress_test_foreach_playout_move(20, b, board_restore_sanity_checks, &t, NULL);
+	if (DEBUGL(2))  fprintf(stderr, "\n");
+
+	free(t.r);  free(t.ref);  free(t.cp);
+	return true;
+}
+
+
+/**************************************************************************************************/
+/* Bitboards stress test */
+
+#ifdef BOARD_BITBOARD
+
+/* Brute force liberties of group g. */
+static int
+real_group_libs(board_t *b, group_t g, bitboard_t *libs)
+{
+	bb_clear(libs);
+	foreach_in_group(b, g) {
+		foreach_neighbor(b, c, {
+			if (board_at(b, c) == S_NONE)
+				bb_set(libs, c);
+		});
+	} foreach_in_group_end;
+	return bb_count(libs);
+}
+
+/* Double check stone bitboards, group liberties and playout scoring
+ * owners against board at every move. */
+static void
+bitboard_sanity_checks(board_t *b, void *data)
+{
+	int *checks = (int*)data;
+	enum stone colors[] = { S_BLACK, S_WHITE };
+	bitboard_t owners[2];
+	board_fast_owners(b, true, &owners[0], &owners[1]);
+
+	foreach_point(b) {
+		enum stone s = board_at(b, c);
+		for (int i = 0; i < 2; i++) {
+			enum stone color = colors[i];
+			if (bb_test(board_bb(b, color), c) != (s == color)) {
+				board_print(b, stderr);
+				fprintf(stderr, "%s bitboard at %s = %i   should be %i\n",
+					stone2str(color), coord2sstr(c),
+					bb_test(board_bb(b, color), c), s == color);
+				assert(0);
+			}
+
+			bool owner = (s == color || (s == S_NONE && board_is_eyelike(b, c, color)));
+			if (bb_test(&owners[i], c) != owner) {
+				board_print(b, stderr);
+				fprintf(stderr, "board_fast_owners(%s) at %s = %i   should be %i\n",
+					stone2str(color), coord2sstr(c), bb_test(&owners[i], c), owner);
+				assert(0);
+			}
+		}
+
+		group_t g = group_at(b, c);
+		if (g != c)
+			continue;
+
+		bitboard_t libs, real;
+		int nlibs = real_group_libs(b, g, &real);
+		group_libs_bb(b, g, &libs);
+		if (memcmp(&libs, &real, sizeof(libs)) ||
+		    (group_libs(b, g) <= GROUP_REFILL_LIBS && group_libs(b, g) != nlibs)) {
+			board_print(b, stderr);
+			fprintf(stderr, "group %s: group_libs() = %i  group_libs_bb() = %i   should be %i\n",
+				coord2sstr(g), group_libs(b, g), bb_count(&libs), nlibs);
+			assert(0);
+		}
+		(*checks)++;
+	} foreach_point_end;
+}
+
+/* Play some games and double check bitboards at every move. */
+static bool
+bitboard_stress_test(board_t *b, char *arg)
+{
+	args_end();
+	board_print_test(b);
+
+	int checks = 0;
+	stress_test_foreach_playout_move(50, b, bitboard_sanity_checks, &checks, NULL);
+	if (DEBUGL(2))  fprintf(stderr, "%i groups checked\n", checks);
+	return true;
+}
+
+#endif /* BOARD_BITBOARD */
+
+
 /**************************************************************************************************/
 
 /* Run playout showing board, candidate moves and playout logic behind
@@ -1519,6 +1727,376 @@ test_genmove(board_t *b, char *arg)
 	return rres;
 }
 
+/* Self-play a few moves with transpositions, check transposition table
+ * stays consistent with the tree across tree promotion and garbage
+ * collection (lookups must find children blocks of the new tree). */
+static bool
+test_tree_transpositions(board_t *board, char *arg)
+{
+	args_end();
+	board_print_test(board);
+	if (DEBUGL(1))  fprintf(stderr, "tree_transpositions ...\t");
+
+	board_t b2;
+	board_t *b = &b2;
+	board_copy(b, board);
+	engine_t *e = new_engine(E_UCT, "transpositions,threads=1", b);
+	uct_t *u = (uct_t*)e->data;
+	time_info_t ti = { 0, };
+	if (!time_parse(&ti, "=3000"))  die("shouldn't happen");
+
+	int bad = 0;
+	enum stone color = board_to_play(b);
+	for (int i = 0; i < 4; i++) {
+		coord_t c = e->genmove(e, b, &ti, color, false);
+		if (is_resign(c))  break;
+		move_t m = move(c, color);
+		check_play_move(b, &m);
+		color = stone_other(color);
+
+		uct_tree_gc_wait(u);
+		if (!u->t)  continue;
+		bad += tree_tt_check(u->t, b, 3);
+		tree_garbage_collect(u->t);
+		bad += tree_tt_check(u->t, b, 3);
+	}
+
+	engine_done(e);
+	board_done(b);
+
+	int rres = bad, eres = 0;
+	PRINT_RES_VAL("%i bad entries", bad);
+	return (rres == eres);
+}
+
+/* Check tree node stats fixed point arithmetic:
+ *   node_stats result              add result many times, value must stay close
+ *                                  (exact for 0 and 1): results near 0 / 1 like
+ *                                  val_scale / maximize_score ones mustn't round
+ *                                  to plain win / loss.
+ *   node_stats result playouts     same starting from @playouts playouts of @result,
+ *                                  value must survive halving near playouts limit. */
+static bool
+test_node_stats(board_t *b, char *arg)
+{
+	next_arg(arg);
+	floating_t result = atof(arg);
+	next_arg_opt(arg);
+	int start = (*arg ? atoi(arg) : 0);
+	args_end();
+
+	PRINT_TEST(b, "node_stats %.3f %i ...\t", result, start);
+
+	node_stats_t s = { .w = 0 };
+	move_stats_t init = move_stats(result, start);
+	node_stats_set(&s, &init);
+
+	int n = 100000;
+	for (int i = 0; i < n; i++)
+		node_stats_add_result(&s, result, 1);
+
+	floating_t value = node_stats_value(&s);
+	bool exact = (result == 0 || result == 1);
+	bool ok = (exact ? value == result : fabs(value - result) < 0.001);
+	if (s.playouts >= NODE_STATS_HALVE_PLAYOUTS)  ok = false;   /* No halving */
+	if (s.wins > (uint64_t)s.playouts * NODE_STATS_SCALE)  ok = false;   /* Carry into wins */
+	if (!start && s.playouts != n)  ok = false;
+
+	int rres = ok, eres = 1;
+	PRINT_RES_VAL("%.5f", value);
+	if (rres != eres && DEBUGL(0))
+		fprintf(stderr, "playouts: %i  wins: %llu\n", s.playouts, (unsigned long long)s.wins);
+	return (rres == eres);
+}
+
+/* Compare tbook node with original tree node. */
+static int
+tbook_cmp_node(tree_node_t *n1, tree_node_t *n2)
+{
+	int mask = ~(TREE_HINT_COPIED | TREE_HINT_DCNN_PENDING);
+	return (node_coord(n1) != node_coord(n2) ||
+		(n1->hints & mask) != (n2->hints & mask) ||
+		n1->u.w != n2->u.w || n1->amaf.w != n2->amaf.w ||
+		memcmp(&n1->prior, &n2->prior, sizeof(n1->prior)) ||
+		memcmp(&n1->winner_owner, &n2->winner_owner, sizeof(n1->winner_owner)) ||
+		memcmp(&n1->black_owner, &n2->black_owner, sizeof(n1->black_owner)));
+}
+
+/* Check loaded tbook subtree matches saved one: children of nodes
+ * with at least @thres playouts are saved, other nodes are leaves. */
+static int
+tbook_check(tree_node_t *node, tree_node_t *loaded, int thres)
+{
+	int bad = 0;
+	tree_node_t *children = node_children(node);
+	if (node->u.playouts < thres)  children = NULL;
+
+	tree_node_t *ni = children, *nj = node_children(loaded);
+	for (; ni && nj; ni = tree_node_sibling(ni), nj = tree_node_sibling(nj)) {
+		if (node_parent(nj) != loaded || tbook_cmp_node(ni, nj)) {
+			fprintf(stderr, "tbook node %s differs\n", coord2sstr(node_coord(ni)));
+			bad++;
+		}
+		bad += tbook_check(ni, nj, thres);
+	}
+	if (ni || nj) {
+		fprintf(stderr, "tbook children of %s differ\n", coord2sstr(node_coord(node)));
+		bad++;
+	}
+	return bad;
+}
+
+/* Generate a small tbook, load it back in a fresh tree and check we
+ * get the same tree (saved part of it). */
+static bool
+test_tbook(board_t *board, char *arg)
+{
+	args_end();
+	board_print_test(board);
+	if (DEBUGL(1))  fprintf(stderr, "tbook ...\t");
+
+	board_t b2;
+	board_t *b = &b2;
+	board_copy(b, board);
+	b->komi = -123.5;		/* Don't clobber real tbooks */
+	char *filename = tree_book_name(b);
+	if (!access(filename, F_OK))  die("%s: already exists\n", filename);
+
+	engine_t *e = new_engine(E_UCT, "threads=1", b);
+	uct_t *u = (uct_t*)e->data;
+	time_info_t ti = { 0, };
+	if (!time_parse(&ti, "=2000"))  die("shouldn't happen");
+	enum stone color = board_to_play(b);
+	uct_gentbook(e, b, &ti, color);
+	int thres = ti.games / 100;
+
+	tree_t *t = tree_init(color, u->tree_size, 0);
+	tree_load(t, b);
+	unlink(filename);
+
+	int bad = tbook_check(u->t->root, t->root, thres);
+	if (tbook_cmp_node(u->t->root, t->root)) {
+		fprintf(stderr, "tbook root differs\n");
+		bad++;
+	}
+
+	tree_done(t);
+	engine_done(e);
+	board_done(b);
+
+	int rres = bad, eres = 0;
+	PRINT_RES_VAL("%i bad nodes", bad);
+	return (rres == eres);
+}
+
+
+/* Tree with 3 moves for position @b, @color to play:
+ * @playouts, @playouts / 2, @playouts / 4 playouts. */
+static tree_t *
+poscache_test_tree(uct_t *u, board_t *b, enum stone color, int playouts)
+{
+	tree_t *t = tree_init(color, u->tree_size, 0);
+	uct_mcowner_playouts(u, b, color);	/* for priors */
+	tree_expand_node(t, t->root, b, color, u, 1);
+	move_stats_t root = move_stats(0.5, playouts * 2);
+	node_stats_set(&t->root->u, &root);
+
+	int n = 0;
+	for (tree_node_t *ni = node_children(t->root); ni; ni = tree_node_sibling(ni)) {
+		if (is_pass(node_coord(ni)) || (ni->hints & TREE_HINT_INVALID) || n == 3)
+			continue;
+		move_stats_t s = move_stats(0.6 - n * 0.1, playouts >> n);
+		node_stats_set(&ni->u, &s);
+		n++;
+	}
+	return t;
+}
+
+/* Check position cache entry for @b matches @t moves, with @playouts
+ * for best move (-1: expect a miss). */
+static int
+poscache_check(poscache_t *pc, board_t *b, enum stone color, tree_t *t, int playouts)
+{
+	poscache_moves_t m;
+	if (!poscache_lookup(pc, b, color, &m))
+		return (playouts < 0 ? 0 : 1);
+	if (playouts < 0)  return 1;
+
+	tree_node_t *best = NULL;
+	for (tree_node_t *ni = node_children(t->root); ni; ni = tree_node_sibling(ni))
+		if (!best || ni->u.playouts > best->u.playouts)
+			best = ni;
+	if (m.n != 3 || m.coord[0] != node_coord(best) || m.playouts[0] != playouts ||
+	    m.playouts[1] > m.playouts[0] || m.playouts[2] > m.playouts[1]) {
+		if (DEBUGL(2))  fprintf(stderr, "n: %i  best: %s %i\n", m.n, coord2sstr(m.coord[0]), m.playouts[0]);
+		return 1;
+	}
+	return 0;
+}
+
+/* Position cache: key, merging of stats stored several times (fresh and
+ * reused / snapshotted trees), eviction and checksums. One bucket cache. */
+static bool
+test_poscache(board_t *board, char *arg)
+{
+	args_end();
+	board_print_test(board);
+	if (DEBUGL(1))  fprintf(stderr, "poscache ...\t");
+
+	board_t b2;
+	board_t *b = &b2;
+	board_copy(b, board);
+	engine_t *e = new_engine(E_UCT, "threads=1", b);
+	uct_t *u = (uct_t*)e->data;
+	enum stone color = board_to_play(b);
+
+	char filename[] = "/tmp/pachi-poscache-XXXXXX";
+	int fd = mkstemp(filename);
+	if (fd < 0)  die("mkstemp failed\n");
+	close(fd);
+	poscache_t *pc = poscache_init(filename, 0);
+	if (!pc)  die("poscache_init failed\n");
+
+	int bad = 0;
+	tree_t *t = poscache_test_tree(u, b, color, 1000);
+	bad += poscache_check(pc, b, color, t, -1);
+	poscache_store(pc, b, color, t);
+	bad += poscache_check(pc, b, color, t, 1000);
+
+	/* Key: color to play, komi */
+	bad += poscache_check(pc, b, stone_other(color), t, -1);
+	b->komi += 1;
+	bad += poscache_check(pc, b, color, t, -1);
+	b->komi -= 1;
+
+	/* Same tree again: nothing new */
+	poscache_store(pc, b, color, t);
+	bad += poscache_check(pc, b, color, t, 1000);
+
+	/* Searched some more: only new playouts added */
+	tree_node_t *best = NULL;
+	for (tree_node_t *ni = node_children(t->root); ni; ni = tree_node_sibling(ni))
+		if (!best || ni->u.playouts > best->u.playouts)
+			best = ni;
+	node_stats_add_result(&best->u, 1.0, 200);
+	node_stats_add_result(&t->root->u, 1.0, 200);
+	poscache_store(pc, b, color, t);
+	bad += poscache_check(pc, b, color, t, 1200);
+
+	/* Snapshot (tree cache) knows what's been stored already */
+	tree_t *snapshot = tree_snapshot(t, u->tree_size, 0, 2);
+	poscache_store(pc, b, color, snapshot);
+	bad += poscache_check(pc, b, color, t, 1200);
+	tree_done(snapshot);
+
+	/* Fresh tree gets merged */
+	tree_t *t2 = poscache_test_tree(u, b, color, 1000);
+	poscache_store(pc, b, color, t2);
+	bad += poscache_check(pc, b, color, t, 2200);
+	tree_done(t2);
+
+	poscache_moves_t m;
+	if (poscache_lookup(pc, b, color, &m)) {
+		floating_t value = tree_node_get_value(t, 1, (0.6 * 2000 + 200) / 2200);
+		if (fabs(m.value[0] - value) > 0.01)  bad++;
+	}
+
+	/* Eviction: least recently stored goes first */
+	board_t bs[4];
+	char *stones[4] = { "c3", "g3", "c7", "g7" };
+	for (int i = 0; i < 4; i++) {
+		board_copy(&bs[i], b);
+		move_t mv = move(str2coord(stones[i]), S_BLACK);
+		check_play_move(&bs[i], &mv);
+		tree_t *ti = poscache_test_tree(u, &bs[i], color, 1000);
+		poscache_store(pc, &bs[i], color, ti);
+		bad += poscache_check(pc, &bs[i], color, ti, 1000);
+		tree_done(ti);
+	}
+	bad += poscache_check(pc, b, color, t, -1);
+	bad += !poscache_lookup(pc, &bs[0], color, &m);
+
+	/* Checksum: corrupt entries look like a miss */
+	FILE *f = fopen(filename, "r+b");
+	if (!f)  die("%s: couldn't open\n", filename);
+	for (int i = 1; i <= 4; i++) {
+		long offset = i * 256 + 20;	/* entry moves */
+		fseek(f, offset, SEEK_SET);
+		int c = fgetc(f);
+		fseek(f, offset, SEEK_SET);
+		fputc(c ^ 0xff, f);
+	}
+	fclose(f);
+	for (int i = 0; i < 4; i++) {
+		bad += poscache_lookup(pc, &bs[i], color, &m);
+		board_done(&bs[i]);
+	}
+
+	poscache_done(pc);
+	unlink(filename);
+	tree_done(t);
+	engine_done(e);
+	board_done(b);
+
+	int rres = bad, eres = 0;
+	PRINT_RES_VAL("%i errors", bad);
+	return (rres == eres);
+}
+
+/* Tree cache: genmove tree snapshot gets taken after the move (background
+ * gc), restoring it in a fresh tree must give the searched tree back
+ * (top of it). Also check tree_cache is disabled with transpositions. */
+static bool
+test_tree_cache(board_t *board, char *arg)
+{
+	args_end();
+	board_print_test(board);
+	if (DEBUGL(1))  fprintf(stderr, "tree_cache ...\t");
+
+	board_t b2;
+	board_t *b = &b2;
+	board_copy(b, board);
+	engine_t *e = new_engine(E_UCT, "tree_cache=64,threads=1", b);
+	uct_t *u = (uct_t*)e->data;
+	time_info_t ti = { 0, };
+	if (!time_parse(&ti, "=2000"))  die("shouldn't happen");
+	enum stone color = board_to_play(b);
+
+	int bad = 0;
+	coord_t c = e->genmove(e, b, &ti, color, false);
+	uct_tree_gc_wait(u);
+	if (u->treecache_t)  bad++;		/* Still pending */
+
+	tree_t *t = tree_init(color, u->tree_size, 0);
+	if (!treecache_restore(t, b, color) || t->root->u.playouts < 2000) {
+		fprintf(stderr, "cached tree not found\n");
+		bad++;
+	}
+
+	/* Searched tree got promoted, compare our move subtree. */
+	tree_node_t *n = tree_get_node(t->root, c);
+	if (!n || !u->t || node_coord(u->t->root) != c) {
+		fprintf(stderr, "move %s not in cached tree\n", coord2sstr(c));
+		bad++;
+	} else {
+		if (n->u.w != u->t->root->u.w || n->amaf.w != u->t->root->amaf.w)
+			bad++;
+		bad += tbook_check(u->t->root, n, 10);
+	}
+
+	tree_done(t);
+	engine_done(e);
+
+	e = new_engine(E_UCT, "tree_cache=64,transpositions,threads=1", b);
+	u = (uct_t*)e->data;
+	if (u->tree_cache_size)  bad++;
+	engine_done(e);
+	board_done(b);
+
+	int rres = bad, eres = 0;
+	PRINT_RES_VAL("%i bad nodes", bad);
+	return (rres == eres);
+}
 
 #ifdef DCNN
 
@@ -1646,6 +2224,88 @@ test_first_line_blunder(board_t *b, char *arg)
 	return   (rres == eres);
 }
 
+/* Board symmetry @sym (0-7) applied to @c */
+static coord_t
+sym_coord(board_t *b, coord_t c, int sym)
+{
+	if (is_pass(c))  return c;
+	int size = board_rsize(b);
+	int x = coord_x(c) - 1,  y = coord_y(c) - 1;
+	if (sym & 4)  {  int t = x;  x = y;  y = t;  }
+	if (sym & 1)  x = size - 1 - x;
+	if (sym & 2)  y = size - 1 - y;
+	return coord_xy(x + 1, y + 1);
+}
+
+#define dcnn_idx(b, c)  ((coord_y(c) - 1) * board_rsize(b) + coord_x(c) - 1)
+
+/* Dcnn cache symmetry mapping: store fake dcnn output for a random position,
+ * look up the 8 symmetric positions (same moves played transformed), each
+ * must hit and get the output transformed the same way. A different
+ * position must miss. */
+static bool
+test_dcnn_cache_symmetry(board_t *board, char *arg)
+{
+	int games = 20, moves = 30;
+	args_end();
+	board_print_test(board);
+	if (DEBUGL(1))  fprintf(stderr, "dcnn_cache_symmetry ...\t");
+
+	dcnn_cache_set_size(16);
+	dcnn_cache_set_symmetry(true);
+
+	int bad = 0;
+	for (int game = 0; game < games; game++) {
+		dcnn_cache_clear();
+
+		/* Random position */
+		board_t b;  board_copy(&b, board);
+		move_t history[moves];  int n = 0;
+		for (int tries = 0; n < moves && tries < 1000; tries++) {
+			enum stone color = board_to_play(&b);
+			coord_t c = b.f[fast_random(b.flen)];
+			if (board_is_one_point_eye(&b, c, color) || !board_is_valid_play(&b, color, c))
+				continue;
+			move_t m = move(c, color);
+			if (board_play(&b, &m) >= 0)
+				history[n++] = m;
+		}
+		enum stone color = board_to_play(&b);
+
+		float r[19 * 19];
+		foreach_point(&b) {
+			if (board_at(&b, c) != S_OFFBOARD)  r[dcnn_idx(&b, c)] = c;
+		} foreach_point_end;
+		dcnn_cache_put(&b, color, r);
+
+		for (int sym = 0; sym < 8; sym++) {
+			board_t b2;  board_copy(&b2, board);
+			for (int i = 0; i < n; i++) {
+				move_t m = move(sym_coord(&b2, history[i].coord, sym), history[i].color);
+				check_play_move(&b2, &m);
+			}
+
+			float r2[19 * 19];
+			if (!dcnn_cache_get(&b2, color, r2)) {  bad++;  board_done(&b2);  continue;  }
+			foreach_point(&b) {
+				if (board_at(&b, c) == S_OFFBOARD)  continue;
+				if (r2[dcnn_idx(&b2, sym_coord(&b2, c, sym))] != r[dcnn_idx(&b, c)])
+					bad++;
+			} foreach_point_end;
+
+			/* Other color to play: different position. */
+			if (dcnn_cache_get(&b2, stone_other(color), r2))
+				bad++;
+			board_done(&b2);
+		}
+		board_done(&b);
+	}
+
+	int rres = bad, eres = 0;
+	PRINT_RES_VAL("%i mismatches", bad);
+	return (rres == eres);
+}
+
 #endif /* DCNN */
 
 bool board_undo_stress_test(board_t *orig, char *arg);
@@ -1677,15 +2337,25 @@ static t_unit_cmd commands[] = {
 	{ "moggy status",           test_moggy_status,          },
 	{ "bad_selfatari_stats",    test_bad_selfatari_stats    },
 	{ "is_selfatari_stress_test", is_selfatari_stress_test  },
+	{ "board_restore_stress_test", board_restore_stress_test },
+#ifdef BOARD_BITBOARD
+	{ "bitboard_stress_test",   bitboard_stress_test        },
+#endif
 	{ "moggy debug_game",       moggy_debug_game,           },
 	{ "false_eye_seki",         test_false_eye_seki,        },
 	{ "breaking_nakade_seki",   test_breaking_nakade_seki,  },
 	{ "pass_is_safe",           test_pass_is_safe,          },
 	{ "final_score",            test_final_score,           },
 	{ "genmove",		    test_genmove                },
+	{ "tree_transpositions",    test_tree_transpositions    },
+	{ "node_stats",             test_node_stats             },
+	{ "tbook",                  test_tbook                  },
+	{ "poscache",               test_poscache               },
+	{ "tree_cache",             test_tree_cache             },
 #ifdef DCNN
 	{ "dcnn_blunder",	    test_dcnn_blunder           },
 	{ "first_line_blunder",     test_first_line_blunder     },
+	{ "dcnn_cache_symmetry",    test_dcnn_cache_symmetry    },
 #endif
 #ifdef BOARD_TESTS
 	{ "board_undo_stress_test", board_undo_stress_test      },
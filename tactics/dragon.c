@@ -118,6 +118,13 @@ get_group_liberties(board_t *b, group_t g, mq_t *q)
 
 	/* Otherwise go and find all liberties */
 	mq_init(q);
+#ifdef BOARD_BITBOARD
+	bitboard_t libs;
+	group_libs_bb(b, g, &libs);
+	foreach_bb_coord(&libs) {
+		mq_add(q, c);
+	} foreach_bb_coord_end;
+#else
 	foreach_in_group(b, g) {
 		foreach_neighbor(b, c, {
 			if (board_at(b, c) != S_NONE || mq_has(q, c))
@@ -125,6 +132,7 @@ get_group_liberties(board_t *b, group_t g, mq_t *q)
 			mq_add(q, c);
 		});
 	} foreach_in_group_end;
+#endif
 }
 
 /* Check if g and g2 are virtually connected through lib.
@@ -284,7 +292,7 @@ foreach_connected_group(board_t *b, enum stone color, coord_t to,
 }
 
 typedef struct {
-	mq_t *visited;
+	bitboard_t visited;
 	coord_handler_t f;
 	void *data;
 } foreach_lib_data_t;
@@ -301,9 +309,9 @@ foreach_lib_handler(board_t *b, enum stone color, group_t g, void *data)
 	mq_t q;  get_group_liberties(b, g, &q);
 	for (int i = 0; i < q.moves; i++) {
 		coord_t lib = q.move[i];
-		if (mq_has(d->visited, lib))
+		if (bb_test(&d->visited, lib))
 			continue;
-		mq_add(d->visited, lib);
+		bb_set(&d->visited, lib);
 		if (d->f(b, color, lib, d->data) == -1)
 			return -1;
 	}
@@ -323,8 +331,8 @@ foreach_lib_in_connected_groups(board_t *b, enum stone color, coord_t to,
 #endif
 	/* Use foreach_connected_group() instead of foreach_in_connected_group():
 	 * may avoid iterating through group stones if pseudo-liberties are valid. */
-	mq_t visited;  mq_init(&visited);
-	foreach_lib_data_t d = { &visited, f, data };
+	foreach_lib_data_t d = { .f = f, .data = data };
+	bb_clear(&d.visited);
 	foreach_connected_group(b, color, to, foreach_lib_handler, &d);
 }
 
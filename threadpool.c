@@ -0,0 +1,114 @@
+#define DEBUG
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "debug.h"
+#include "util.h"
+#include "threadpool.h"
+
+/* Persistent worker thread pool, see threadpool.h
+ *
+ * Single task queue protected by pool_mutex. Invariant: idle >= queued,
+ * a new worker is spawned whenever a submission would break it. So tasks
+ * never wait on each other even if some of them block (thread_manager
+ * waiting for search workers for example). */
+
+typedef struct task {
+	threadpool_fn_t fn;
+	void *arg;
+	threadpool_batch_t *batch;
+	struct task *next;
+} task_t;
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  work_cond = PTHREAD_COND_INITIALIZER;	/* New task queued. */
+static pthread_cond_t  done_cond = PTHREAD_COND_INITIALIZER;	/* Some batch completed. */
+
+static task_t *queue_head = NULL, *queue_tail = NULL;
+static task_t *free_tasks = NULL;
+static int queued = 0;		/* Tasks waiting for a worker. */
+static int idle = 0;		/* Workers waiting for a task. */
+static int workers = 0;		/* Workers created so far. */
+
+static void *
+worker_loop(void *arg)
+{
+	pthread_mutex_lock(&pool_mutex);
+	while (1) {
+		while (!queue_head)
+			pthread_cond_wait(&work_cond, &pool_mutex);
+
+		task_t *task = queue_head;
+		queue_head = task->next;
+		if (!queue_head)  queue_tail = NULL;
+		queued--;  idle--;
+		pthread_mutex_unlock(&pool_mutex);
+
+		task->fn(task->arg);
+
+		pthread_mutex_lock(&pool_mutex);
+		if (!--task->batch->pending)
+			pthread_cond_broadcast(&done_cond);
+		task->next = free_tasks;  free_tasks = task;
+		idle++;
+	}
+	return NULL;
+}
+
+/* Called with pool_mutex held. */
+static void
+spawn_worker(void)
+{
+	pthread_t thread;
+	pthread_attr_t a;
+	pthread_attr_init(&a);
+	pthread_attr_setstacksize(&a, 1048576);
+	pthread_attr_setdetachstate(&a, PTHREAD_CREATE_DETACHED);
+	int r = pthread_create(&thread, &a, worker_loop, (void*)(intptr_t)workers);
+	if (r)  fail("pthread_create");
+	pthread_attr_destroy(&a);
+	workers++;  idle++;
+	if (DEBUGL(4))  fprintf(stderr, "threadpool: spawned worker %i\n", workers - 1);
+}
+
+void
+threadpool_run(threadpool_batch_t *batch, threadpool_fn_t fn, void *arg)
+{
+	pthread_mutex_lock(&pool_mutex);
+
+	task_t *task = free_tasks;
+	if (task)  free_tasks = task->next;
+	else       task = malloc2(task_t);
+	task->fn = fn;  task->arg = arg;  task->batch = batch;  task->next = NULL;
+
+	if (queue_tail)  queue_tail->next = task;
+	else             queue_head = task;
+	queue_tail = task;
+	queued++;  batch->pending++;
+
+	if (idle < queued)
+		spawn_worker();
+	pthread_cond_signal(&work_cond);
+	pthread_mutex_unlock(&pool_mutex);
+}
+
+void
+threadpool_wait(threadpool_batch_t *batch)
+{
+	pthread_mutex_lock(&pool_mutex);
+	while (batch->pending)
+		pthread_cond_wait(&done_cond, &pool_mutex);
+	pthread_mutex_unlock(&pool_mutex);
+}
+
+int
+threadpool_size(void)
+{
+	pthread_mutex_lock(&pool_mutex);
+	int n = workers;
+	pthread_mutex_unlock(&pool_mutex);
+	return n;
+}
@@ -0,0 +1,37 @@
+#ifndef PACHI_THREADPOOL_H
+#define PACHI_THREADPOOL_H
+
+#include <stdbool.h>
+
+/* Persistent worker thread pool.
+ * Workers are created on demand and stay around for the life of the
+ * process, so searches and playout batches don't pay for thread creation
+ * (and cold caches) every time. Work is dispatched in batches:
+ *
+ *     threadpool_batch_t batch = THREADPOOL_BATCH_INIT;
+ *     for (...)  threadpool_run(&batch, fn, arg);
+ *     threadpool_wait(&batch);
+ *
+ * Tasks are free to block or dispatch batches of their own: the pool grows
+ * so that every queued task always has an idle worker waiting for it. */
+
+typedef void *(*threadpool_fn_t)(void *arg);
+
+typedef struct {
+	int pending;		/* Tasks not finished yet. */
+} threadpool_batch_t;
+
+#define THREADPOOL_BATCH_INIT  { 0 }
+
+/* Queue task for execution by some pool worker. */
+void threadpool_run(threadpool_batch_t *batch, threadpool_fn_t fn, void *arg);
+
+/* Wait for all tasks in batch to complete. */
+void threadpool_wait(threadpool_batch_t *batch);
+
+/* Workers can run any kind of task, see topology.h for pinning. */
+
+/* Number of workers created so far. */
+int  threadpool_size(void);
+
+#endif
@@ -0,0 +1,267 @@
+#define DEBUG
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include "debug.h"
+#include "util.h"
+#include "topology.h"
+
+/* Cpu sets are lists of cpus in pinning order: successive search
+ * workers land on different physical cores before using smt siblings. */
+
+#define MAX_CPUS 1024
+
+typedef struct {
+	int n;
+	int cpu[MAX_CPUS];
+} cpu_list_t;
+
+static cpu_list_t role_cpus[TOPO_ROLES];
+static bool pinning = false;
+
+/* Current pin of each thread, avoids redundant syscalls. */
+#define PIN_NONE	(-2)
+#define pin_key(role, index)	((int)(role) * (MAX_CPUS + 1) + (index) + 1)
+static __thread int thread_pin = PIN_NONE;
+static int setup_gen = 0;
+static __thread int thread_gen = 0;
+
+#ifdef __linux__
+
+typedef struct {
+	int cpu;
+	int package, core;
+	int smt;		/* thread index within its core */
+} cpu_info_t;
+
+static int
+read_sys_int(int cpu, const char *name)
+{
+	char path[256];
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%i/topology/%s", cpu, name);
+	FILE *f = fopen(path, "r");
+	int v = -1;
+	if (f) {  if (fscanf(f, "%d", &v) != 1)  v = -1;  fclose(f);  }
+	return v;
+}
+
+/* Parse cpu list like "0-3,8,10-11" (@sep separated), false if invalid. */
+static bool
+parse_cpu_list(const char *str, char sep, cpu_list_t *l)
+{
+	l->n = 0;
+	const char *s = str;
+	while (*s && *s != '\n') {
+		char *end;
+		long a = strtol(s, &end, 10), b = a;
+		if (end == s || a < 0)  return false;
+		s = end;
+		if (*s == '-') {
+			s++;
+			b = strtol(s, &end, 10);
+			if (end == s || b < a)  return false;
+			s = end;
+		}
+		for (long i = a; i <= b; i++) {
+			if (i >= MAX_CPUS || l->n == MAX_CPUS)  return false;
+			l->cpu[l->n++] = (int)i;
+		}
+		if (*s == sep)  s++;
+		else if (*s && *s != '\n')  return false;
+	}
+	return (l->n > 0);
+}
+
+static int
+cpu_info_cmp(const void *a, const void *b)
+{
+	const cpu_info_t *x = (const cpu_info_t*)a, *y = (const cpu_info_t*)b;
+	if (x->smt != y->smt)          return x->smt - y->smt;
+	if (x->package != y->package)  return x->package - y->package;
+	if (x->core != y->core)        return x->core - y->core;
+	return x->cpu - y->cpu;
+}
+
+/* Read online cpus layout, sorted in pinning order. Returns number of cpus. */
+static int
+read_topology(cpu_info_t *cpus)
+{
+	cpu_list_t online;
+	char buf[4096] = "";
+	FILE *f = fopen("/sys/devices/system/cpu/online", "r");
+	if (f) {  if (!fgets(buf, sizeof(buf), f))  buf[0] = 0;  fclose(f);  }
+	if (!parse_cpu_list(buf, ',', &online)) {
+		online.n = MIN(get_nprocessors(), MAX_CPUS);
+		for (int i = 0; i < online.n; i++)
+			online.cpu[i] = i;
+	}
+
+	for (int i = 0; i < online.n; i++) {
+		cpu_info_t *c = &cpus[i];
+		c->cpu = online.cpu[i];
+		c->package = read_sys_int(c->cpu, "physical_package_id");
+		c->core = read_sys_int(c->cpu, "core_id");
+		if (c->core < 0)  c->core = c->cpu;  /* Unknown, one core per cpu */
+		c->smt = 0;
+		for (int j = 0; j < i; j++)
+			if (cpus[j].package == c->package && cpus[j].core == c->core)
+				c->smt++;
+	}
+	qsort(cpus, online.n, sizeof(*cpus), cpu_info_cmp);
+	return online.n;
+}
+
+static void
+cpu_list_add(cpu_list_t *l, int cpu)
+{
+	assert(l->n < MAX_CPUS);
+	l->cpu[l->n++] = cpu;
+}
+
+/* cores / split modes */
+static void
+setup_cores(int dcnn_cores, bool nosmt)
+{
+	cpu_info_t cpus[MAX_CPUS];
+	int n = read_topology(cpus);
+
+	/* Physical cores are the smt 0 entries, in order. */
+	int cores = 0;
+	while (cores < n && cpus[cores].smt == 0)  cores++;
+	if (dcnn_cores < 0)  dcnn_cores = cores / 2;
+	dcnn_cores = MIN(dcnn_cores, cores - 1);
+
+	for (int i = 0; i < n; i++) {
+		cpu_info_t *c = &cpus[i];
+		if (nosmt && c->smt)  continue;
+		/* Last cores go to dcnn */
+		int core_index = 0;
+		while (cpus[core_index].package != c->package || cpus[core_index].core != c->core)
+			core_index++;
+		if (core_index >= cores - dcnn_cores)
+			cpu_list_add(&role_cpus[TOPO_DCNN], c->cpu);
+		else
+			cpu_list_add(&role_cpus[TOPO_SEARCH], c->cpu);
+	}
+	if (dcnn_cores)  /* Split: managers share search cores. */
+		role_cpus[TOPO_MANAGER] = role_cpus[TOPO_SEARCH];
+}
+
+static void
+set_affinity(cpu_list_t *l, int index)
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (index >= 0)
+		CPU_SET(l->cpu[index % l->n], &set);
+	else if (l->n)
+		for (int i = 0; i < l->n; i++)
+			CPU_SET(l->cpu[i], &set);
+	else  /* Not pinned, all cpus */
+		for (int i = 0; i < MIN(CPU_SETSIZE, MAX_CPUS); i++)
+			CPU_SET(i, &set);
+
+	int r = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (r && DEBUGL(2))  fprintf(stderr, "topology: couldn't set thread affinity\n");
+}
+
+#else  /* !__linux__ */
+
+#define set_affinity(l, index)	((void)0)
+
+#endif /* __linux__ */
+
+bool
+topology_setup(const char *spec)
+{
+	memset(role_cpus, 0, sizeof(role_cpus));
+	pinning = false;
+	__sync_fetch_and_add(&setup_gen, 1);
+	if (!spec || !*spec)  return true;
+
+#ifndef __linux__
+	die("thread pinning only supported on linux\n");
+	return false;
+#else
+	char *buf = strdup(spec);
+	bool cores = false, nosmt = false, ok = true;
+	int dcnn_cores = 0;
+
+	for (char *tok = strtok(buf, ":"); tok && ok; tok = strtok(NULL, ":")) {
+		char *val = strchr(tok, '=');
+		if (val)  *val++ = 0;
+
+		if      (!strcasecmp(tok, "cores"))      cores = true;
+		else if (!strcasecmp(tok, "nosmt"))      nosmt = true;
+		else if (!strcasecmp(tok, "split")) {
+			cores = true;
+			dcnn_cores = (val ? atoi(val) : -1);
+			ok = (!val || dcnn_cores > 0);
+		}
+		else if (!strcasecmp(tok, "search") && val)   ok = parse_cpu_list(val, '+', &role_cpus[TOPO_SEARCH]);
+		else if (!strcasecmp(tok, "dcnn") && val)     ok = parse_cpu_list(val, '+', &role_cpus[TOPO_DCNN]);
+		else if (!strcasecmp(tok, "manager") && val)  ok = parse_cpu_list(val, '+', &role_cpus[TOPO_MANAGER]);
+		else    ok = false;
+	}
+	free(buf);
+
+	if (ok && cores)
+		setup_cores(dcnn_cores, nosmt);
+	if (!ok)
+		memset(role_cpus, 0, sizeof(role_cpus));
+	pinning = ok;
+	return ok;
+#endif
+}
+
+void
+topology_pin(enum topology_role role, int index)
+{
+	assert(role < TOPO_ROLES);
+	cpu_list_t *l = &role_cpus[role];
+	if (!l->n)  index = -1;
+	int key = (l->n ? pin_key(role, (index >= 0 ? index % l->n : -1)) : PIN_NONE);
+
+	/* Setup changed, forget current pin. */
+	if (thread_gen != setup_gen) {
+		thread_gen = setup_gen;
+		if (thread_pin != PIN_NONE)  thread_pin = -1;
+	}
+	if (key == thread_pin || (!pinning && thread_pin == PIN_NONE))
+		return;
+
+	set_affinity(l, index);
+	thread_pin = key;
+}
+
+int
+topology_cpus(enum topology_role role)
+{
+	return role_cpus[role].n;
+}
+
+void
+topology_log(void)
+{
+	static int logged_gen = -1;
+	if (!DEBUGL(2) || !pinning || logged_gen == setup_gen)  return;
+	logged_gen = setup_gen;
+
+	const char *names[TOPO_ROLES] = { "search", "dcnn", "manager" };
+	fprintf(stderr, "Thread pinning:");
+	for (int r = 0; r < TOPO_ROLES; r++) {
+		cpu_list_t *l = &role_cpus[r];
+		fprintf(stderr, " %s ", names[r]);
+		if (!l->n)  {  fprintf(stderr, "-");  continue;  }
+		for (int i = 0; i < l->n && i < 16; i++)
+			fprintf(stderr, "%s%i", (i ? "," : ""), l->cpu[i]);
+		if (l->n > 16)  fprintf(stderr, ",... (%i cpus)", l->n);
+	}
+	fprintf(stderr, "\n");
+}
@@ -0,0 +1,45 @@
+#ifndef PACHI_TOPOLOGY_H
+#define PACHI_TOPOLOGY_H
+
+#include <stdbool.h>
+
+/* Cpu topology and thread pinning (linux only).
+ * Cpu layout (packages, physical cores, smt siblings) is read from
+ * /sys/devices/system/cpu. Each thread role gets a set of cpus, threads
+ * pin themselves when they start a task of that role (pool workers can
+ * run any kind of task).
+ *
+ * Topology spec, ':' separated:
+ *   cores          search workers spread over physical cores first,
+ *                  then smt siblings. Other threads float.
+ *   split[=N]      N physical cores (default half) with their siblings for
+ *                  dcnn evaluation, other cores for search workers and
+ *                  manager threads.
+ *   nosmt          cores / split: don't use smt siblings.
+ *   search=CPUS    explicit cpu sets, CPUS is a '+' separated list of
+ *   dcnn=CPUS      cpus / ranges, for example "search=0-7+16-23".
+ *   manager=CPUS   (manager = thread manager, logger, tree gc) */
+
+enum topology_role {
+	TOPO_SEARCH,		/* uct search workers, mcowner playouts */
+	TOPO_DCNN,		/* dcnn evaluation threads */
+	TOPO_MANAGER,		/* thread manager, logger, tree gc */
+	TOPO_ROLES
+};
+
+/* Setup pinning from @spec, NULL or "" turns it off.
+ * Returns false if spec is invalid. */
+bool topology_setup(const char *spec);
+
+/* Pin calling thread for @role: search worker @index gets its own cpu,
+ * use -1 for other roles (thread floats over role's cpus).
+ * Threads of roles without cpu set float over all cpus. */
+void topology_pin(enum topology_role role, int index);
+
+/* Number of cpus assigned to @role, 0 if not pinned. */
+int  topology_cpus(enum topology_role role);
+
+/* Startup log */
+void topology_log(void);
+
+#endif
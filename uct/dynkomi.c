@@ -90,7 +90,7 @@ linear_permove(uct_dynkomi_t *d, board_t *b, tree_t *tree)
         if (tree->root->u.playouts < GJ_MINGAMES)
 		return extra_komi;
 
-	floating_t my_value = tree_node_get_value(tree, 1, tree->root->u.value);
+	floating_t my_value = tree_node_get_value(tree, 1, node_stats_value(&tree->root->u));
 	/*  We normalize komi as in komi_by_value(), > 0 when winning. */
 	extra_komi = komi_by_color(extra_komi, color);
 	if (extra_komi < 0 && DEBUGL(3))
@@ -11,11 +11,13 @@
 #include "mq.h"
 #include "engine.h"
 #include "pattern/pattern.h"
+#include "uct/tree.h"
 
 typedef struct uct_prior uct_prior_t;
 typedef struct uct_dynkomi uct_dynkomi_t;
 typedef struct uct_pluginset uct_pluginset_t;
 typedef struct uct_policy uct_policy_t;
+typedef struct poscache poscache_t;
 typedef struct tree tree_t;
 typedef struct tree_node tree_node_t;
 
@@ -54,12 +56,26 @@ typedef struct uct {
 	double dumpthres;
 	int force_seed;
 	bool no_tbook;
+	char *poscache_file;		/* Persistent position cache (see uct/poscache.h) */
+	size_t poscache_size;
+	poscache_t *poscache;
 
 	/* Memory management */
 	bool auto_alloc;
 	size_t tree_size;
 	size_t max_tree_size_opt;
 	size_t max_mem;
+	bool transpositions;
+	enum tree_hugepages tree_hugepages;
+	int tree_numa;
+	bool tree_prefault;
+	size_t tree_cache_size;		/* Tree cache budget (see uct/treecache.h) */
+	/* Genmove search waiting for its tree cache snapshot (see uct_treecache_flush()) */
+	tree_t *treecache_t;		/* u->t or discarded tree */
+	tree_node_t *treecache_root;	/* searched position */
+	move_stats_t *treecache_poscache_stored;
+	board_t *treecache_b;
+	enum stone treecache_color;
 	
 	int mercymin;
 	int significant_threshold;
@@ -78,6 +94,7 @@ typedef struct uct {
 	int     dcnn_pondering_mcts;       /* Genmove next move guesses */
 	coord_t dcnn_pondering_mcts_c[20];
 	int     dcnn_pondering_mcts_n;
+	int     leaf_dcnn;                 /* Async dcnn eval of nodes with that many playouts */
 	
 	int fuseki_end;
 	int yose_start;
@@ -0,0 +1,163 @@
+#define DEBUG
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "board.h"
+#include "debug.h"
+#include "threadpool.h"
+#include "topology.h"
+#include "dcnn/dcnn.h"
+#include "uct/internal.h"
+#include "uct/tree.h"
+#include "uct/leaf_dcnn.h"
+
+/* Queue is a ring of preallocated entries (boards are big), protected by
+ * queue_mutex. Evaluator takes up to DCNN_BATCH_MAX entries at a time,
+ * workers never wait: if queue is full node is just tried again later. */
+
+#define LEAF_QUEUE_SIZE 64
+
+typedef struct {
+	tree_node_t *node;
+	board_t b;
+	enum stone color;
+	int parity;
+} leaf_entry_t;
+
+static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  queue_cond = PTHREAD_COND_INITIALIZER;
+static leaf_entry_t *queue = NULL;
+static int  queue_head = 0, queue_len = 0;
+static volatile bool running = false;	/* Evaluator started, accepting nodes */
+static bool stop = false;
+static int  evaluated = 0;
+
+static threadpool_batch_t evaluator_batch = THREADPOOL_BATCH_INIT;
+static uct_t  *eval_u = NULL;
+static tree_t *eval_t = NULL;
+
+static void
+leaf_done(uct_t *u, tree_node_t *n)
+{
+	if (u->virtual_loss)
+		__sync_fetch_and_sub(&n->descents, u->virtual_loss);
+	__sync_fetch_and_and(&n->hints, ~TREE_HINT_DCNN_PENDING);
+}
+
+bool
+leaf_dcnn_queue(uct_t *u, tree_t *t, tree_node_t *n, board_t *b, enum stone color, int parity)
+{
+	/* No evaluator (dcnn not in use for this search) */
+	if (!running)  return false;
+
+	/* Only one thread queues a node. */
+	if (__sync_fetch_and_or(&n->hints, TREE_HINT_DCNN_PENDING) & TREE_HINT_DCNN_PENDING)
+		return true;
+
+	pthread_mutex_lock(&queue_mutex);
+	if (!running || queue_len == LEAF_QUEUE_SIZE) {
+		pthread_mutex_unlock(&queue_mutex);
+		__sync_fetch_and_and(&n->hints, ~TREE_HINT_DCNN_PENDING);
+		return false;
+	}
+
+	leaf_entry_t *e = &queue[(queue_head + queue_len++) % LEAF_QUEUE_SIZE];
+	e->node = n;  e->color = color;  e->parity = parity;
+	board_copy(&e->b, b);
+	if (u->virtual_loss)  /* Until it's evaluated. */
+		__sync_fetch_and_add(&n->descents, u->virtual_loss);
+
+	pthread_cond_signal(&queue_cond);
+	pthread_mutex_unlock(&queue_mutex);
+	return true;
+}
+
+/* Entries stay in queue while being evaluated (workers can't
+ * overwrite them), they're removed once priors are written. */
+static void *
+evaluator_thread(void *arg)
+{
+	uct_t *u = eval_u;
+	tree_t *t = eval_t;
+	topology_pin(TOPO_DCNN, -1);
+
+	pthread_mutex_lock(&queue_mutex);
+	while (1) {
+		while (!queue_len && !stop)
+			pthread_cond_wait(&queue_cond, &queue_mutex);
+		if (stop)  break;
+
+		int n = MIN(queue_len, DCNN_BATCH_MAX);
+		leaf_entry_t *entries[n];
+		for (int i = 0; i < n; i++)
+			entries[i] = &queue[(queue_head + i) % LEAF_QUEUE_SIZE];
+		pthread_mutex_unlock(&queue_mutex);
+
+		board_t *boards[n];
+		enum stone colors[n];
+		float results[n][19 * 19];
+		float *rr[n];
+		for (int i = 0; i < n; i++) {
+			boards[i] = &entries[i]->b;  colors[i] = entries[i]->color;  rr[i] = results[i];
+		}
+		dcnn_evaluate_batch(boards, colors, n, rr);
+
+		for (int i = 0; i < n; i++) {
+			leaf_entry_t *e = entries[i];
+			tree_node_dcnn_priors(t, e->node, &e->b, e->color, u, e->parity, rr[i]);
+			leaf_done(u, e->node);
+			board_done(&e->b);
+		}
+
+		pthread_mutex_lock(&queue_mutex);
+		queue_head = (queue_head + n) % LEAF_QUEUE_SIZE;
+		queue_len -= n;
+		evaluated += n;
+	}
+	pthread_mutex_unlock(&queue_mutex);
+	return NULL;
+}
+
+void
+leaf_dcnn_start(uct_t *u, tree_t *t)
+{
+	if (!queue)  queue = calloc2(LEAF_QUEUE_SIZE, leaf_entry_t);
+	assert(!queue_len);
+	eval_u = u;  eval_t = t;
+	stop = false;
+	evaluated = 0;
+	threadpool_run(&evaluator_batch, evaluator_thread, NULL);
+	pthread_mutex_lock(&queue_mutex);
+	running = true;
+	pthread_mutex_unlock(&queue_mutex);
+}
+
+void
+leaf_dcnn_stop(uct_t *u)
+{
+	pthread_mutex_lock(&queue_mutex);
+	running = false;
+	stop = true;
+	pthread_cond_broadcast(&queue_cond);
+	pthread_mutex_unlock(&queue_mutex);
+	threadpool_wait(&evaluator_batch);
+
+	/* Drop positions not evaluated yet. */
+	for (; queue_len; queue_len--, queue_head = (queue_head + 1) % LEAF_QUEUE_SIZE) {
+		leaf_entry_t *e = &queue[queue_head];
+		leaf_done(u, e->node);
+		board_done(&e->b);
+	}
+
+	if (UDEBUGL(2) && evaluated)
+		fprintf(stderr, "leaf dcnn: %i nodes evaluated\n", evaluated);
+}
+
+int
+leaf_dcnn_evaluated(void)
+{
+	return evaluated;
+}
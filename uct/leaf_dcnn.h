@@ -0,0 +1,30 @@
+#ifndef PACHI_UCT_LEAF_DCNN_H
+#define PACHI_UCT_LEAF_DCNN_H
+
+/* Asynchronous dcnn evaluation of tree nodes.
+ * Workers passing through an expanded node with enough playouts and no
+ * dcnn priors queue its position and keep going (pending node gets
+ * virtual loss so others tend to search elsewhere meanwhile). A
+ * dedicated evaluator thread runs the network on queued positions in
+ * batches and writes dcnn priors back into the children. */
+
+#include "board.h"
+
+typedef struct uct uct_t;
+typedef struct tree tree_t;
+typedef struct tree_node tree_node_t;
+
+/* Start / stop evaluator thread (search start / end).
+ * After leaf_dcnn_stop() no pending node is left. */
+void leaf_dcnn_start(uct_t *u, tree_t *t);
+void leaf_dcnn_stop(uct_t *u);
+
+/* Queue node @n for evaluation, @b is position after node's move,
+ * @color to play. Returns false if queue is full or evaluator isn't
+ * running. */
+bool leaf_dcnn_queue(uct_t *u, tree_t *t, tree_node_t *n, board_t *b, enum stone color, int parity);
+
+/* Number of nodes evaluated since start */
+int  leaf_dcnn_evaluated(void);
+
+#endif
@@ -1,13 +1,20 @@
 #ifndef PACHI_UCT_POLICY_H
 #define PACHI_UCT_POLICY_H
 
+/* Nodes visited during tree descent, root first.
+ * With transpositions a node can have several parents, so walking
+ * back up the tree must use this instead of node->parent. */
+typedef struct {
+	int len;
+	tree_node_t *nodes[MAX_GAMELEN];
+} tree_path_t;
 
 typedef tree_node_t* (*uctp_choose)(uct_policy_t *p, tree_node_t *node, board_t *b, enum stone color, coord_t exclude);
 typedef floating_t   (*uctp_evaluate)(uct_policy_t *p, tree_t *tree, tree_node_t *node, int parity);
 typedef tree_node_t* (*uctp_descend)(uct_policy_t *p, tree_t *tree, tree_node_t *node, int parity, bool allow_pass);
 typedef tree_node_t* (*uctp_winner)(uct_policy_t *p, tree_t *tree, tree_node_t *node);
 typedef void         (*uctp_prior)(uct_policy_t *p, tree_t *tree, tree_node_t *node, board_t *b, enum stone color, int parity);
-typedef void         (*uctp_update)(uct_policy_t *p, tree_t *tree, tree_node_t *node, enum stone node_color, enum stone player_color, amafmap_t *amaf, board_t *final_board, floating_t result);
+typedef void         (*uctp_update)(uct_policy_t *p, tree_t *tree, tree_path_t *path, enum stone node_color, enum stone player_color, amafmap_t *amaf, board_t *final_board, floating_t result);
 typedef void         (*uctp_done)(uct_policy_t *p);
 
 typedef struct uct_policy {
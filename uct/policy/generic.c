@@ -18,9 +18,9 @@
 tree_node_t *
 uctp_generic_choose(uct_policy_t *p, tree_node_t *node, board_t *b, enum stone color, coord_t exclude)
 {
-	tree_node_t *nbest = node->children;
+	tree_node_t *nbest = node_children(node);
 	if (!nbest) return NULL;
-	tree_node_t *nbest2 = nbest->sibling;
+	tree_node_t *nbest2 = tree_node_sibling(nbest);
 
 #ifdef EXTRA_CHECKS
 	assert(!quick_board(b));
@@ -28,7 +28,7 @@ uctp_generic_choose(uct_policy_t *p, tree_node_t *node, board_t *b, enum stone c
 #endif	
 	/* This function is called while the tree is updated by other threads.
 	 * We rely on node->children being set only after the node has been fully expanded. */
-	for (tree_node_t *ni = nbest2; ni; ni = ni->sibling) {
+	for (tree_node_t *ni = nbest2; ni; ni = tree_node_sibling(ni)) {
 #ifdef EXTRA_CHECKS
 		assert(sane_node_coord(b, ni));
 #endif
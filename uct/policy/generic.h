@@ -28,12 +28,12 @@ tree_node_t *uctp_generic_winner(uct_policy_t *p, tree_t *tree, tree_node_t *nod
 #define uctd_try_node_children(tree, node, allow_pass, parity, tenuki_d, ni, urgency)				\
 	/* Information abound best children. */									\
 	/* XXX: We assume board <=25x25. */									\
-	tree_node_t *dbest[BOARD_MAX_MOVES + 1] = { node->children };						\
+	tree_node_t *dbest[BOARD_MAX_MOVES + 1] = { node_children(node) };						\
 	int dbests = 1;												\
 	floating_t best_urgency = -9999;									\
 														\
 	/* Descent children iterator. */									\
-	for (tree_node_t *dci = node->children; dci; dci = dci->sibling) {					\
+	for (tree_node_t *dci = node_children(node); dci; dci = tree_node_sibling(dci)) {			\
 		floating_t urgency;										\
 		/* Do not consider passing early. */								\
 		if (unlikely((!allow_pass && is_pass(node_coord(dci))) || (dci->hints & TREE_HINT_INVALID)))	\
@@ -49,7 +49,7 @@ ucb1_descend(uct_policy_t *p, tree_t *tree, tree_node_t *node, int parity, bool
 	floating_t xpl = 0;
 	if (b->explore_p > 0) {
 		int prior_playouts = 0;		/* Total prior playouts added. */
-		for (tree_node_t *ni = node->children; ni; ni = ni->sibling)	/* xxx recomputed each time */
+		for (tree_node_t *ni = node_children(node); ni; ni = tree_node_sibling(ni))	/* xxx recomputed each time */
 			prior_playouts += ni->prior.playouts;
 		xpl = log(node->u.playouts + prior_playouts);
 	}
@@ -59,8 +59,8 @@ ucb1_descend(uct_policy_t *p, tree_t *tree, tree_node_t *node, int parity, bool
 		int uct_playouts = ni->u.playouts + ni->prior.playouts + ni->descents;
 
 		if (uct_playouts) {
-			urgency = (ni->u.playouts     * tree_node_get_value(tree, parity, ni->u.value) +
-				   ni->prior.playouts * tree_node_get_value(tree, parity, ni->prior.value) +
+			urgency = (ni->u.playouts     * tree_node_get_value(tree, parity, node_stats_value(&ni->u)) +
+				   ni->prior.playouts * tree_node_get_value(tree, parity, node_prior(ni).value) +
 				   (parity > 0 ? 0 : ni->descents)) / uct_playouts;
 			if (b->explore_p > 0)
 				urgency += b->explore_p * sqrt(xpl / uct_playouts);
@@ -73,7 +73,7 @@ ucb1_descend(uct_policy_t *p, tree_t *tree, tree_node_t *node, int parity, bool
 }
 
 static void
-ucb1_update(uct_policy_t *p, tree_t *tree, tree_node_t *node,
+ucb1_update(uct_policy_t *p, tree_t *tree, tree_path_t *path,
 	    enum stone node_color, enum stone player_color,
 	    amafmap_t *map, board_t *final_board, floating_t result)
 {
@@ -82,8 +82,9 @@ ucb1_update(uct_policy_t *p, tree_t *tree, tree_node_t *node,
 	 * they had to all occur in all branches, only in
 	 * different order. */
 
-	for (; node; node = node->parent) {
-		stats_add_result(&node->u, result, 1);
+	for (int i = path->len - 1; i >= 0; i--) {
+		tree_node_t *node = path->nodes[i];
+		node_stats_add_result(&node->u, result, 1);
 	}
 }
 
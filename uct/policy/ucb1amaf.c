@@ -112,11 +112,12 @@ ucb1rave_evaluate(uct_policy_t *p, tree_t *tree, tree_node_t *node, int parity)
 {
 	ucb1_policy_amaf_t *b = (ucb1_policy_amaf_t*)p->data;
 
-	move_stats_t n = node->u, r = node->amaf;
+	move_stats_t n = node_stats_get(&node->u), r = node_stats_get(&node->amaf);
+	move_stats_t prior = node_prior(node);
 	if (p->uct->amaf_prior) {
-		stats_merge(&r, &node->prior);
+		stats_merge(&r, &prior);
 	} else {
-		stats_merge(&n, &node->prior);
+		stats_merge(&n, &prior);
 	}
 
 	if (p->uct->virtual_loss && node->descents >= b->vloss_min_descents) {
@@ -159,21 +160,21 @@ ucb1rave_evaluate(uct_policy_t *p, tree_t *tree, tree_node_t *node, int parity)
 					+ (floating_t) n.playouts * r.playouts / b->equiv_rave);
 			} else {
 				/* XXX: This can be cached in descend; but we don't use this by default. */
-				beta = sqrt(b->equiv_rave / (3 * node->parent->u.playouts + b->equiv_rave));
+				beta = sqrt(b->equiv_rave / (3 * node_parent(node)->u.playouts + b->equiv_rave));
 			}
 
 			value = beta * r.value + (1.f - beta) * n.value;
 			URAVE_DEBUG fprintf(stderr, "\t%s value = %f * %f + (1 - %f) * %f (prior %f)\n",
-			        coord2sstr(node_coord(node)), beta, r.value, beta, n.value, node->prior.value);
+			        coord2sstr(node_coord(node)), beta, r.value, beta, n.value, prior.value);
 		} else {
 			value = n.value;
 			URAVE_DEBUG fprintf(stderr, "\t%s value = %f (prior %f)\n",
-			        coord2sstr(node_coord(node)), n.value, node->prior.value);
+			        coord2sstr(node_coord(node)), n.value, prior.value);
 		}
 	} else if (r.playouts) {
 		value = r.value;
 		URAVE_DEBUG fprintf(stderr, "\t%s value = rave %f (prior %f)\n",
-			coord2sstr(node_coord(node)), r.value, node->prior.value);
+			coord2sstr(node_coord(node)), r.value, prior.value);
 	}
 
 	return tree_node_get_value(tree, parity, value);
@@ -218,7 +219,7 @@ ucb1rave_descend(uct_policy_t *p, tree_t *tree, tree_node_t *node, int parity, b
 }
 
 void
-ucb1amaf_update(uct_policy_t *p, tree_t *tree, tree_node_t *node,
+ucb1amaf_update(uct_policy_t *p, tree_t *tree, tree_path_t *path,
 		enum stone node_color, enum stone player_color,
 		amafmap_t *map, board_t *final_board, floating_t result)
 {
@@ -226,8 +227,8 @@ ucb1amaf_update(uct_policy_t *p, tree_t *tree, tree_node_t *node,
 	enum stone winner_color = result > 0.5 ? S_BLACK : S_WHITE;
 
 #if 0
-	for (tree_node_t *ni = node; ni; ni = ni->parent)
-		fprintf(stderr, "%s ", coord2sstr(node_coord(ni)));
+	for (int i = path->len - 1; i >= 0; i--)
+		fprintf(stderr, "%s ", coord2sstr(node_coord(path->nodes[i])));
 	fprintf(stderr, "[color %d] update result %d (color %d)\n",
 			node_color, result, player_color);
 #endif
@@ -242,17 +243,18 @@ ucb1amaf_update(uct_policy_t *p, tree_t *tree, tree_node_t *node,
 	/* Start of amaf range considered (start of playout range initially).
 	 * Index of current tree node move is (start - 1). */
 	int start = map->game_baselen;
-	while (node) {
+	for (int i = path->len - 1; i >= 0; i--) {
+		tree_node_t *node = path->nodes[i];
 		if (!is_pass(node_coord(node))) {
-			stats_add_result(&node->winner_owner, rave_board_local_value(b->crit_lvalue, final_board, node_coord(node), winner_color), 1);
-			stats_add_result(&node->black_owner, rave_board_local_value(b->crit_lvalue, final_board, node_coord(node), S_BLACK), 1);
+			tree_node_add_owner(node, rave_board_local_value(b->crit_lvalue, final_board, node_coord(node), winner_color),
+					    rave_board_local_value(b->crit_lvalue, final_board, node_coord(node), S_BLACK));
 		}
-		stats_add_result(&node->u, result, 1);
+		node_stats_add_result(&node->u, result, 1);
 
 		int max_threat_dist = (b->threat_rave <= 0 ? amaf_ko_length(map, start) : -1);
 
 		assert(map->game_baselen >= 0);
-		for (tree_node_t *ni = node->children; ni; ni = ni->sibling) {
+		for (tree_node_t *ni = node_children(node); ni; ni = tree_node_sibling(ni)) {
 			if (is_pass(node_coord(ni))) continue;
 
 			/* Use the child move only if it was first played by the same color. */
@@ -282,15 +284,14 @@ ucb1amaf_update(uct_policy_t *p, tree_t *tree, tree_node_t *node,
 				weight += b->distance_rave * (map->gamelen - first) / (map->gamelen - start + 1);
 			}
 			if (weight)
-				stats_add_result(&ni->amaf, res, weight);
+				node_stats_add_result(&ni->amaf, res, weight);
 		}
-		if (node->parent) {
+		if (i > 0) {  /* not root */
 			int tree_move = start - 1;
 			assert(tree_move >= 0 && map->game[tree_move] == node_coord(node) && first_move[node_coord(node)] > tree_move);
 			first_move[node_coord(node)] = tree_move;
 			start--;
 		}
-		node = node->parent;
 	}
 }
 
@@ -0,0 +1,334 @@
+#define DEBUG
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "board.h"
+#include "debug.h"
+#include "engine.h"
+#include "stats.h"
+#include "uct/tree.h"
+#include "uct/poscache.h"
+
+/* File layout: header, then buckets of POSCACHE_WAYS entries.
+ * Writers (store, init) hold an flock() on the file, so several Pachi
+ * instances can share it. Readers don't lock: entries carry a checksum,
+ * torn reads just look like a miss. */
+
+#define POSCACHE_MAGIC		"PACHIPC"
+#define POSCACHE_VERSION	1
+#define POSCACHE_WAYS		4
+
+/* Don't save shallow searches. */
+#define POSCACHE_MIN_ROOT_PLAYOUTS	500
+#define POSCACHE_MIN_PLAYOUTS		10
+/* Halve stats beyond that, so old results fade out. */
+#define POSCACHE_MAX_PLAYOUTS		1000000
+
+typedef struct {
+	float    value;
+	uint32_t playouts;
+	int16_t  coord;
+	uint16_t reserved;
+} poscache_move_t;
+
+typedef struct {
+	hash_t   key;		/* 0 = empty slot */
+	uint32_t stamp;		/* clock at last store, oldest gets evicted */
+	uint16_t n;
+	uint16_t check;		/* checksum of key and moves */
+	poscache_move_t moves[POSCACHE_MOVES];
+} poscache_entry_t;		/* 256 bytes */
+
+typedef struct {
+	char     magic[8];
+	uint32_t version;
+	uint32_t entry_size;
+	uint32_t buckets;
+	uint32_t clock;
+	char     reserved[sizeof(poscache_entry_t) - 24];
+} poscache_header_t;
+
+struct poscache {
+	int fd;
+	size_t size;
+	poscache_header_t *h;
+	poscache_entry_t *entries;
+	uint32_t buckets;	/* power of 2 */
+	int stores, hits;
+};
+
+
+#ifndef _WIN32
+
+static hash_t
+poscache_key(board_t *b, enum stone color)
+{
+	hash_t key = b->hash ^ ((hash_t)board_rsize(b) * 0x9e3779b97f4a7c15ULL);
+	hash_t setup = ((hash_t)(int)(b->komi * 2) << 16) | (b->handicap << 8) | b->rules;
+	key ^= setup * 0xbf58476d1ce4e5b9ULL;
+	if (color == S_WHITE)
+		key = ~key;
+	if (!is_pass(b->ko.coord))
+		key ^= hash_at(b->ko.coord, b->ko.color) * 3;
+	/* Territory scoring, prisoners count. */
+	if (b->rules == RULES_JAPANESE)
+		key ^= (hash_t)(b->captures[S_BLACK] - b->captures[S_WHITE]) * 0x94d049bb133111ebULL;
+	return (key ? key : 1);
+}
+
+static uint16_t
+poscache_checksum(poscache_entry_t *e)
+{
+	uint32_t *p = (uint32_t*)e->moves;
+	uint32_t sum = (uint32_t)e->key ^ (uint32_t)(e->key >> 32) ^ e->n;
+	for (size_t i = 0; i < sizeof(e->moves) / (sizeof(uint32_t)); i++)
+		sum = (sum ^ p[i]) * 16777619;
+	return (uint16_t)(sum ^ (sum >> 16));
+}
+
+#define poscache_bucket(pc, key)	(&(pc)->entries[((key) & ((pc)->buckets - 1)) * POSCACHE_WAYS])
+
+static bool
+poscache_header_ok(poscache_header_t *h, uint32_t buckets)
+{
+	return (!memcmp(h->magic, POSCACHE_MAGIC, sizeof(h->magic)) &&
+		h->version == POSCACHE_VERSION &&
+		h->entry_size == sizeof(poscache_entry_t) &&
+		h->buckets == buckets);
+}
+
+poscache_t *
+poscache_init(const char *filename, size_t size)
+{
+	uint32_t buckets = 1;
+	size_t bucket_size = POSCACHE_WAYS * sizeof(poscache_entry_t);
+	while (buckets < (1U << 31) && (size_t)buckets * 2 * bucket_size <= size)
+		buckets *= 2;
+	size = sizeof(poscache_header_t) + buckets * bucket_size;
+
+	int fd = open(filename, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) {  perror(filename);  return NULL;  }
+	flock(fd, LOCK_EX);
+
+	/* New file, different size or format ? Start afresh. */
+	poscache_header_t h;
+	struct stat st;
+	if (fstat(fd, &st)) {
+		perror(filename);
+		flock(fd, LOCK_UN);  close(fd);
+		return NULL;
+	}
+	bool ok = ((size_t)st.st_size == size &&
+		   pread(fd, &h, sizeof(h), 0) == sizeof(h) && poscache_header_ok(&h, buckets));
+	if (!ok) {
+		if (st.st_size && DEBUGL(1))
+			fprintf(stderr, "%s: incompatible position cache, reinitializing.\n", filename);
+		memset(&h, 0, sizeof(h));
+		memcpy(h.magic, POSCACHE_MAGIC, sizeof(h.magic));
+		h.version = POSCACHE_VERSION;
+		h.entry_size = sizeof(poscache_entry_t);
+		h.buckets = buckets;
+		if (ftruncate(fd, 0) || ftruncate(fd, size) ||
+		    pwrite(fd, &h, sizeof(h), 0) != sizeof(h)) {
+			perror(filename);
+			flock(fd, LOCK_UN);  close(fd);
+			return NULL;
+		}
+	}
+
+	void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	flock(fd, LOCK_UN);
+	if (p == MAP_FAILED) {  perror("mmap");  close(fd);  return NULL;  }
+
+	poscache_t *pc = calloc2(1, poscache_t);
+	pc->fd = fd;
+	pc->size = size;
+	pc->h = (poscache_header_t*)p;
+	pc->entries = (poscache_entry_t*)((char*)p + sizeof(poscache_header_t));
+	pc->buckets = buckets;
+	if (DEBUGL(2))
+		fprintf(stderr, "Position cache %s: %i entries (%i Mb)\n", filename,
+			buckets * POSCACHE_WAYS, (int)(size / (1024 * 1024)));
+	return pc;
+}
+
+void
+poscache_done(poscache_t *pc)
+{
+	if (DEBUGL(3))
+		fprintf(stderr, "position cache: %i stores, %i hits\n", pc->stores, pc->hits);
+	munmap(pc->h, pc->size);
+	close(pc->fd);
+	free(pc);
+}
+
+/* Copy out entry for @key, false if not found / being written. */
+static bool
+poscache_get(poscache_t *pc, hash_t key, poscache_entry_t *out, poscache_entry_t **slot)
+{
+	poscache_entry_t *bucket = poscache_bucket(pc, key);
+	for (int i = 0; i < POSCACHE_WAYS; i++) {
+		poscache_entry_t *e = &bucket[i];
+		if (*(volatile hash_t*)&e->key != key)
+			continue;
+		__sync_synchronize();
+		memcpy(out, e, sizeof(*out));
+		if (out->key != key || out->n > POSCACHE_MOVES ||
+		    out->check != poscache_checksum(out))
+			return false;
+		*slot = e;
+		return true;
+	}
+	return false;
+}
+
+bool
+poscache_lookup(poscache_t *pc, board_t *b, enum stone color, poscache_moves_t *m)
+{
+	hash_t key = poscache_key(b, color);
+	poscache_entry_t e, *slot;
+	if (!poscache_get(pc, key, &e, &slot))
+		return false;
+
+	/* Hot path: no write to the shared mapping here, entries
+	 * get their lru stamp when stored. */
+	__sync_fetch_and_add(&pc->hits, 1);
+
+	m->n = e.n;
+	for (int i = 0; i < e.n; i++) {
+		m->coord[i] = e.moves[i].coord;
+		m->playouts[i] = e.moves[i].playouts;
+		m->value[i] = e.moves[i].value;
+	}
+	return true;
+}
+
+/* Add move stats to @best, keeping moves sorted by playouts. */
+static void
+poscache_moves_add(poscache_move_t *best, int *n, coord_t c, move_stats_t *s)
+{
+	for (int i = 0; i < *n; i++)
+		if (best[i].coord == c) {
+			move_stats_t old = move_stats(best[i].value, best[i].playouts);
+			stats_merge(&old, s);
+			best[i].value = old.value;
+			best[i].playouts = old.playouts;
+			/* Bubble up */
+			for (; i > 0 && best[i].playouts > best[i - 1].playouts; i--)
+				swap(best[i], best[i - 1]);
+			return;
+		}
+
+	int i = *n;
+	if (i == POSCACHE_MOVES) {
+		if (s->playouts <= (int)best[i - 1].playouts)
+			return;
+		i--;
+	} else
+		(*n)++;
+	for (; i > 0 && (int)best[i - 1].playouts < s->playouts; i--)
+		best[i] = best[i - 1];
+	poscache_move_t m = { s->value, (uint32_t)s->playouts, (int16_t)c, 0 };
+	best[i] = m;
+}
+
+/* Stats of playouts in @s not in @old. */
+static move_stats_t
+poscache_stats_delta(move_stats_t *s, move_stats_t *old)
+{
+	move_stats_t d = move_stats(0, 0);
+	if (s->playouts <= old->playouts)
+		return d;
+	d.playouts = s->playouts - old->playouts;
+	floating_t wins = s->value * s->playouts - old->value * old->playouts;
+	d.value = MAX(0, MIN(1, wins / d.playouts));
+	return d;
+}
+
+void
+poscache_store(poscache_t *pc, board_t *b, enum stone color, tree_t *t)
+{
+	if (t->root->u.playouts < POSCACHE_MIN_ROOT_PLAYOUTS)
+		return;
+
+	hash_t key = poscache_key(b, color);
+	poscache_entry_t e, *slot = NULL;
+	memset(&e, 0, sizeof(e));
+
+	flock(pc->fd, LOCK_EX);
+
+	/* Known position ? Merge with previous stats. */
+	int n = 0;
+	if (poscache_get(pc, key, &e, &slot))
+		n = e.n;
+	else {
+		memset(&e, 0, sizeof(e));
+		poscache_entry_t *bucket = poscache_bucket(pc, key);
+		slot = &bucket[0];
+		for (int i = 0; i < POSCACHE_WAYS && slot->key; i++)
+			if (!bucket[i].key || bucket[i].stamp < slot->stamp)
+				slot = &bucket[i];
+	}
+
+	/* Tree may have been stored already (reused / restored tree):
+	 * only add playouts since then. */
+	if (!t->poscache_stored)
+		t->poscache_stored = calloc2(BOARD_MAX_COORDS + 1, move_stats_t);
+	for (tree_node_t *ni = node_children(t->root); ni; ni = tree_node_sibling(ni)) {
+		if (ni->hints & TREE_HINT_INVALID)
+			continue;
+		move_stats_t *stored = &t->poscache_stored[node_coord(ni) + 1];
+		move_stats_t s = move_stats(node_stats_value(&ni->u), ni->u.playouts);
+		move_stats_t d = poscache_stats_delta(&s, stored);
+		if (d.playouts < POSCACHE_MIN_PLAYOUTS)
+			continue;
+		d.value = tree_node_get_value(t, 1, d.value);
+		poscache_moves_add(e.moves, &n, node_coord(ni), &d);
+		*stored = s;
+	}
+	if (!n) {  flock(pc->fd, LOCK_UN);  return;  }
+
+	while (e.moves[0].playouts > POSCACHE_MAX_PLAYOUTS)
+		for (int i = 0; i < n; i++)
+			e.moves[i].playouts /= 2;
+
+	e.key = key;
+	e.n = n;
+	e.stamp = __sync_add_and_fetch(&pc->h->clock, 1);
+	e.check = poscache_checksum(&e);
+
+	/* Readers skip slot while it's being written. */
+	slot->key = 0;
+	__sync_synchronize();
+	memcpy(((char*)slot) + sizeof(slot->key), ((char*)&e) + sizeof(e.key), sizeof(e) - sizeof(e.key));
+	__sync_synchronize();
+	slot->key = key;
+
+	flock(pc->fd, LOCK_UN);
+	pc->stores++;
+}
+
+#else  /* _WIN32 */
+
+poscache_t *
+poscache_init(const char *filename, size_t size)
+{
+	warning("position cache not supported on windows.\n");
+	return NULL;
+}
+
+void poscache_done(poscache_t *pc)  {  }
+void poscache_store(poscache_t *pc, board_t *b, enum stone color, tree_t *t)  {  }
+bool poscache_lookup(poscache_t *pc, board_t *b, enum stone color, poscache_moves_t *m)  {  return false;  }
+
+#endif /* _WIN32 */
@@ -0,0 +1,44 @@
+#ifndef PACHI_UCT_POSCACHE_H
+#define PACHI_UCT_POSCACHE_H
+
+/* Persistent position cache.
+ * On-disk store of search results across games: after each search, root
+ * children stats are saved under the position's key (board hash, size,
+ * komi, rules, ko and color to play). When a known position comes up
+ * again, in this game or a future one, its stats seed children priors on
+ * expansion (see uct_prior()).
+ * The store is a fixed size hash table mmap()ed from file, so its size is
+ * bounded: slots are grouped in small buckets and the least recently stored
+ * slot of a bucket is evicted when a new position comes in.
+ * Several Pachi instances can share the same file. */
+
+#include "board.h"
+
+typedef struct tree tree_t;
+typedef struct poscache poscache_t;
+
+/* Moves saved per position */
+#define POSCACHE_MOVES	20
+
+typedef struct {
+	int n;
+	coord_t coord[POSCACHE_MOVES];
+	int playouts[POSCACHE_MOVES];
+	float value[POSCACHE_MOVES];	/* winrate for color to play */
+} poscache_moves_t;
+
+/* Open / create cache file @filename of @size bytes.
+ * Returns NULL on error. */
+poscache_t *poscache_init(const char *filename, size_t size);
+void poscache_done(poscache_t *pc);
+
+/* Save root children stats of search tree @t for position @b, @color to play.
+ * Stats are merged with previous ones for this position, if any.
+ * Playouts already stored from @t (tree reused / restored) aren't added again. */
+void poscache_store(poscache_t *pc, board_t *b, enum stone color, tree_t *t);
+
+/* Get saved moves for position @b, @color to play.
+ * Returns false if position isn't known. Thread safe. */
+bool poscache_lookup(poscache_t *pc, board_t *b, enum stone color, poscache_moves_t *m);
+
+#endif
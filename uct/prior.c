@@ -17,6 +17,7 @@
 #include "uct/tree.h"
 #include "uct/plugins.h"
 #include "uct/internal.h"
+#include "uct/poscache.h"
 
 #define PRIOR_BEST_N 20
 
@@ -24,10 +25,10 @@ void
 get_node_prior_best_moves(tree_node_t *parent, best_moves_t *best)
 {
 	float max = 0.0;
-	for (tree_node_t *n = parent->children; n; n = n->sibling)
+	for (tree_node_t *n = node_children(parent); n; n = tree_node_sibling(n))
 		max = MAX(max, n->prior.playouts);
 
-	for (tree_node_t *n = parent->children; n; n = n->sibling)
+	for (tree_node_t *n = node_children(parent); n; n = tree_node_sibling(n))
 		best_moves_add(best, node_coord(n), (float)n->prior.playouts / max);
 }
 
@@ -100,7 +101,7 @@ uct_prior_dcnn(uct_t *u, tree_node_t *node, prior_map_t *map)
 #ifdef DCNN
 	board_t *b = map->b;
 	float   r[19 * 19];
-	bool    debugl = (UDEBUGL(2) && !node->parent);
+	bool    debugl = (UDEBUGL(2) && !node_parent(node));
 
 	int high = u->prior->dcnn_eqex_high;
 	int low  = u->prior->dcnn_eqex_low;
@@ -115,7 +116,12 @@ uct_prior_dcnn(uct_t *u, tree_node_t *node, prior_map_t *map)
 
 	strbuf(buf, 128);
 	strbuf_printf(buf, "(dcnn prior = %i)", dcnn_eqex);
-	dcnn_evaluate(map->b, map->to_play, r, &u->ownermap, debugl, buf->str);
+	if (map->dcnn) {  /* Already evaluated, just fix blunders. */
+		memcpy(r, map->dcnn, board_size2 * sizeof(float));
+		dcnn_fix_blunders(map->b, map->to_play, r, &u->ownermap, debugl);
+	}
+	else
+		dcnn_evaluate(map->b, map->to_play, r, &u->ownermap, debugl, buf->str);
 	
 	for (int i = 0; i < map->consider->moves; i++) {
 		coord_t c = map->consider->move[i];
@@ -146,7 +152,7 @@ uct_prior_joseki(uct_t *u, tree_node_t *node, prior_map_t *map)
 	for (int i = 0; i < matches; i++)
 		add_prior_value(map, coords[i], 1.0, ratings[i] * u->prior->joseki_eqex);
 
-	if (DEBUGL(2) && !node->parent && matches) {
+	if (DEBUGL(2) && !node_parent(node) && matches) {
 		coord_t best_c[20];		
 		float best_r[20];
 		best_moves_setup(best, best_c, best_r, 20);
@@ -168,7 +174,7 @@ uct_prior_pattern(uct_t *u, tree_node_t *node, prior_map_t *map)
 	pattern_rate_moves(b, map->to_play, probs, NULL, &ct, NULL);
 
 	/* Show patterns best moves for root node if not using dcnn. */
-	if (DEBUGL(2) && !node->parent && !using_dcnn(b)) {
+	if (DEBUGL(2) && !node_parent(node) && !using_dcnn(b)) {
 		coord_t best_c[20];		
 		float best_r[20];
 		best_moves_setup(best, best_c, best_r, 20);
@@ -190,6 +196,22 @@ uct_prior_pattern(uct_t *u, tree_node_t *node, prior_map_t *map)
 	}
 }
 
+static void
+uct_prior_poscache(uct_t *u, tree_node_t *node, prior_map_t *map)
+{
+	/* Q_{poscache}: known position, use results of previous searches. */
+	poscache_moves_t m;
+	if (!poscache_lookup(u->poscache, map->b, map->to_play, &m))
+		return;
+
+	for (int i = 0; i < m.n; i++)
+		add_prior_value(map, m.coord[i], m.value[i], MIN(m.playouts[i], u->prior->poscache_eqex));
+
+	if (DEBUGL(2) && !node_parent(node))
+		fprintf(stderr, "poscache: known position, %i moves (best %s %i playouts)\n",
+			m.n, coord2sstr(m.coord[0]), m.playouts[0]);
+}
+
 void
 uct_prior(uct_t *u, tree_node_t *node, prior_map_t *map)
 {
@@ -198,7 +220,8 @@ uct_prior(uct_t *u, tree_node_t *node, prior_map_t *map)
 
 	if (u->prior->even_eqex)			uct_prior_even(u, node, map);
 
-	if (!u->tree_ready) {  /* Root node: use dcnn for priors, don't mix pattern priors */
+	/* Root node / leaf dcnn evaluation: use dcnn for priors, don't mix pattern priors */
+	if (!u->tree_ready || map->dcnn) {
 		if      (u->prior->dcnn_eqex_high)	uct_prior_dcnn(u, node, map);
 		else if (u->prior->pattern_eqex)	uct_prior_pattern(u, node, map);
 	}
@@ -206,13 +229,14 @@ uct_prior(uct_t *u, tree_node_t *node, prior_map_t *map)
 		if (u->prior->pattern_eqex)		uct_prior_pattern(u, node, map);
 
 	if (u->prior->joseki_eqex)			uct_prior_joseki(u, node, map);
+	if (u->poscache && u->prior->poscache_eqex)	uct_prior_poscache(u, node, map);
 
 #ifdef PACHI_PLUGINS
 	if (u->prior->plugin_eqex)			plugin_prior(u->plugins, node, map, u->prior->plugin_eqex);
 #endif
 
 	/* Show final prior mix. */
-	if (DEBUGL(3) && !node->parent)                 print_prior_best_moves(map->b, map);
+	if (DEBUGL(3) && !node_parent(node))                 print_prior_best_moves(map->b, map);
 }
 
 uct_prior_t *
@@ -239,6 +263,10 @@ uct_prior_init(char *arg, board_t *b, uct_t *u)
 	p->dcnn_eqex_high  = -1300;
 	p->dcnn_eqex_low   = -900;
 
+	/* Position cache: weight of each move's saved stats is capped
+	 * to that many playouts. */
+	p->poscache_eqex   = -400;
+
 	/* Even number! */
 	p->eqex = (board_large(b) ? 20 : 14);
 
@@ -272,6 +300,9 @@ uct_prior_init(char *arg, board_t *b, uct_t *u)
 			} else if (!strcasecmp(optname, "plugin") && optval) {
 				/* Unlike others, this is just a *recommendation*. */
 				p->plugin_eqex = atoi(optval);
+			} else if (!strcasecmp(optname, "poscache") && optval) {
+				/* Position cache prior eqex (max per move). */
+				p->poscache_eqex = atoi(optval);
 			} else if (!strcasecmp(optname, "prune_ladders")) {
 				p->prune_ladders = !optval || atoi(optval);
 #ifdef DCNN
@@ -297,6 +328,7 @@ uct_prior_init(char *arg, board_t *b, uct_t *u)
 	if (p->plugin_eqex < 0)    p->plugin_eqex    = -p->plugin_eqex * p->eqex / 20;
 	if (p->dcnn_eqex_high < 0) p->dcnn_eqex_high = -p->dcnn_eqex_high * p->eqex / 20;
 	if (p->dcnn_eqex_low < 0)  p->dcnn_eqex_low  = -p->dcnn_eqex_low * p->eqex / 20;
+	if (p->poscache_eqex < 0)  p->poscache_eqex  = -p->poscache_eqex * p->eqex / 20;
 
 	if (!using_joseki(b))   p->joseki_eqex = 0;
 	if (!using_dcnn(b))     p->dcnn_eqex_high = 0;
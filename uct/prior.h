@@ -19,6 +19,7 @@ typedef struct uct_prior {
 	int even_eqex, plugin_eqex;
 	int joseki_eqex, pattern_eqex;
 	int dcnn_eqex_high, dcnn_eqex_low;
+	int poscache_eqex;
 	bool prune_ladders;
 	bool boost_pass;
 } uct_prior_t;
@@ -34,6 +35,9 @@ typedef struct prior_map {
 	/* [board_size2(b)] array, whether to compute
 	 * prior for the given value. */
 	mq_t *consider;
+	/* Raw dcnn output for this position if already
+	 * evaluated (batched evaluation), or NULL. */
+	float *dcnn;
 } prior_map_t;
 
 /* @value is the value, @playouts is its weight. */
@@ -21,23 +21,17 @@
 #include "uct/internal.h"
 #include "uct/search.h"
 #include "uct/tree.h"
+#include "uct/treecache.h"
 #include "uct/uct.h"
 #include "uct/walk.h"
 #include "uct/prior.h"
 #include "uct/dynkomi.h"
 #include "uct/policy.h"
 #include "dcnn/dcnn.h"
+#include "uct/leaf_dcnn.h"
 #include "pachi.h"
-
-static int
-checked_pthread_join(pthread_t thread, void **retval)
-{
-	int r = pthread_join(thread, retval);
-	if (r)  fail("pthread_join");
-	return r;
-}
-
-#define pthread_join  checked_pthread_join
+#include "threadpool.h"
+#include "topology.h"
 
 /* Default time settings for the UCT engine. In distributed mode, slaves are
  * unlimited by default and all control is done on the master, either in time
@@ -70,7 +64,7 @@ default_ti_init(void)
  *   |         starts and stops the search managed by thread_manager
  *   |
  * thread_manager
- *   |         spawns and collects worker threads
+ *   |         dispatches and collects worker threads
  *   |
  * worker0
  * worker1
@@ -88,10 +82,16 @@ default_ti_init(void)
  * | worker_thread()
  * V uct_playouts() 
  *
- * If we are pondering there is also logger_thread() which checks progress */
+ * thread_manager, workers and logger_thread() all run on the persistent
+ * thread pool (threadpool.c), no threads are created on a regular search.
+ *
+ * If we are pondering there is also logger_thread() which checks progress
+ * When not pondering, tree garbage collection happens in gc_thread() after
+ * genmove (see uct_tree_gc_start()). */
 
 volatile sig_atomic_t uct_halt = 0;	/* Set in thread manager in case the workers should stop. */
-static pthread_t thread_manager_id;	/* ID of the thread manager. */
+static threadpool_batch_t thread_manager_batch;	/* The thread manager task. */
+static uct_thread_ctx_t thread_manager_ctx;
 bool thread_manager_running;
 
 static pthread_mutex_t finish_mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -114,6 +114,7 @@ worker_thread(void *ctx_)
 	uint64_t random_state;
 	fast_srandom(&random_state, ctx->seed);
 	int restarted = search_restarted(u);
+	topology_pin(TOPO_SEARCH, ctx->tid);
 
 	/* Compute initial ownermap */
 	double time_start = time_now();
@@ -199,35 +200,43 @@ thread_manager(void *ctx_)
 	tree_t *t = mctx->t;
 	uint64_t random_state;
 	fast_srandom(&random_state, mctx->seed);
+	topology_pin(TOPO_MANAGER, -1);
 
 	int played_games = 0;
-	pthread_t threads[u->threads + 1];
+	threadpool_batch_t workers = THREADPOOL_BATCH_INIT;
+	threadpool_batch_t logger = THREADPOOL_BATCH_INIT;
+	uct_thread_ctx_t *ctxs[u->threads];
 	int joined = 0;
 
 	uct_halt = 0;
 	u->tree_ready = false;
 
-	/* Garbage collect the tree by preference when pondering. */
+	/* Garbage collect the tree by preference when pondering,
+	 * after last genmove tree cache snapshot. */
+	if (pondering(u))
+		uct_treecache_flush(u);
 	if (pondering(u) && search_want_gc(u) && t->nodes && tree_gc_needed(u->t))
 		tree_garbage_collect(t);
 	clear_search_want_gc(u);
 
 	/* Logging thread for pondering */
 	if (pondering(u))
-		pthread_create(&threads[u->threads], NULL, logger_thread, mctx);
+		threadpool_run(&logger, logger_thread, mctx);
+
+	/* Dcnn evaluator for tree nodes */
+	bool leaf_dcnn = (u->leaf_dcnn && using_dcnn(mctx->b));
+	if (leaf_dcnn)
+		leaf_dcnn_start(u, t);
 	
-	/* Spawn threads... */
+	/* Dispatch workers... */
 	for (int ti = 0; ti < u->threads; ti++) {
-		uct_thread_ctx_t *ctx = calloc2(1, uct_thread_ctx_t);
+		uct_thread_ctx_t *ctx = ctxs[ti] = calloc2(1, uct_thread_ctx_t);
 		ctx->u = u; ctx->b = mctx->b; ctx->color = mctx->color;
 		mctx->t = ctx->t = t;
 		ctx->tid = ti; ctx->seed = fast_random(65536) + ti;
 		ctx->ti = mctx->ti;
 		ctx->s = mctx->s;
-		pthread_attr_t a;
-		pthread_attr_init(&a);
-		pthread_attr_setstacksize(&a, 1048576);
-		pthread_create(&threads[ti], &a, worker_thread, ctx);
+		threadpool_run(&workers, worker_thread, ctx);
 		if (UDEBUGL(4))
 			fprintf(stderr, "Spawned worker %d\n", ti);
 	}
@@ -248,21 +257,25 @@ thread_manager(void *ctx_)
 			continue;
 		}
 		/* ...and gather its remnants. */
-		uct_thread_ctx_t *ctx;
-		pthread_join(threads[finish_thread], (void **) &ctx);
-		played_games += ctx->games;
+		played_games += ctxs[finish_thread]->games;
 		joined++;
-		free(ctx);
 		if (UDEBUGL(4))
 			fprintf(stderr, "Joined worker %d\n", finish_thread);
 		pthread_mutex_unlock(&finish_serializer);
 	}
 
-	if (pondering(u))
-		pthread_join(threads[u->threads], NULL);
-	
+	threadpool_wait(&logger);
 	pthread_mutex_unlock(&finish_mutex);
 
+	/* Before anyone touches the tree. */
+	if (leaf_dcnn)
+		leaf_dcnn_stop(u);
+
+	/* Workers may still be returning from worker_thread(). */
+	threadpool_wait(&workers);
+	for (int ti = 0; ti < u->threads; ti++)
+		free(ctxs[ti]);
+
 	mctx->games = played_games;
 	return mctx;
 }
@@ -302,6 +315,7 @@ logger_thread(void *ctx_)
 	enum stone color = ctx->color;
 	uct_search_state_t *s = ctx->s;
 	time_info_t *ti = ctx->ti;
+	topology_pin(TOPO_MANAGER, -1);
 
 	while (!uct_halt) {
 		time_sleep(TREE_BUSYWAIT_INTERVAL);
@@ -324,23 +338,40 @@ logger_thread(void *ctx_)
 	return NULL;
 }
 
-/* Expand next move node (dcnn pondering) */
+/* Expand next move nodes (dcnn pondering).
+ * Positions get dcnn evaluated in one batch. */
 static void
-uct_expand_next_move(uct_t *u, tree_t *t, board_t *board, enum stone color, coord_t c)
+uct_expand_next_moves(uct_t *u, tree_t *t, board_t *board, enum stone color, coord_t *moves, int n)
 {
-	tree_node_t *n = tree_get_node(t->root, c);
+	board_t *boards = calloc2(n, board_t);
+	board_t *bb[n];
+	tree_node_t *nodes[n];
+	enum stone colors[n];
+	float results[n][19 * 19];
+	float *rr[n];
+	int k = 0;
 	
-	board_t b;
-	board_copy(&b, board);
-
-	move_t m = move(c, color);
-	int res = board_play(&b, &m);
-	if (res < 0) goto done;
+	for (int i = 0; i < n; i++) {
+		tree_node_t *node = tree_get_node(t->root, moves[i]);
+		if (node->is_expanded)  continue;
+
+		board_t *b = &boards[k];
+		board_copy(b, board);
+		move_t m = move(moves[i], color);
+		if (board_play(b, &m) < 0) {  board_done(b);  continue;  }
 		
-	if (!__sync_lock_test_and_set(&n->is_expanded, 1))
-		tree_expand_node(t, n, &b, stone_other(color), u, -1);
+		bb[k] = b;  nodes[k] = node;  colors[k] = stone_other(color);  rr[k] = results[k];
+		k++;
+	}
+
+	if (k)  dcnn_evaluate_batch(bb, colors, k, rr);
 
- done:  board_done(&b);
+	for (int i = 0; i < k; i++) {
+		if (!__sync_lock_test_and_set(&nodes[i]->is_expanded, 1))
+			tree_expand_node_dcnn(t, nodes[i], bb[i], colors[i], u, -1, rr[i]);
+		board_done(bb[i]);
+	}
+	free(boards);
 }
 
 /* For pondering with dcnn we need dcnn values for next move as well before
@@ -381,8 +412,8 @@ uct_expand_next_best_moves(uct_t *u, tree_t *t, board_t *b, enum stone color)
 		fflush(stderr);
 	}
 
-	for (int i = 0; i < q.moves && !uct_halt; i++) { /* Don't hang if genmove comes in. */
-		uct_expand_next_move(u, t, b, color, q.move[i]);
+	for (int i = 0; i < q.moves && !uct_halt; i += DCNN_BATCH_MAX) { /* Don't hang if genmove comes in. */
+		uct_expand_next_moves(u, t, b, color, &q.move[i], MIN(DCNN_BATCH_MAX, q.moves - i));
 		if (DEBUGL(2)) {  fprintf(stderr, ".");  fflush(stderr);  }
 	}
 	if (DEBUGL(2)) fprintf(stderr, "\n");
@@ -405,6 +436,7 @@ uct_search_start(uct_t *u, board_t *b, enum stone color,
 		 tree_t *t, time_info_t *ti,
 		 uct_search_state_t *s, int flags)
 {
+	uct_tree_gc_wait(u);
 	u->search_flags = flags;
 	
 	/* Set up search state. */
@@ -424,12 +456,11 @@ uct_search_start(uct_t *u, board_t *b, enum stone color,
 	 * spawn the searching threads. */
 	assert(u->threads > 0);
 	assert(!thread_manager_running);
-	static uct_thread_ctx_t mctx;
-	mctx = (uct_thread_ctx_t) { 0, u, b, color, t, fast_random(65536), 0, ti, s };
-	s->ctx = &mctx;
+	thread_manager_ctx = (uct_thread_ctx_t) { 0, u, b, color, t, fast_random(65536), 0, ti, s };
+	s->ctx = &thread_manager_ctx;
 	pthread_mutex_lock(&finish_serializer);
 	pthread_mutex_lock(&finish_mutex);
-	pthread_create(&thread_manager_id, NULL, thread_manager, s->ctx);
+	threadpool_run(&thread_manager_batch, thread_manager, s->ctx);
 	thread_manager_running = true;
 }
 
@@ -447,8 +478,8 @@ uct_search_stop(void)
 	pthread_mutex_unlock(&finish_mutex);
 
 	/* Collect the thread manager. */
-	uct_thread_ctx_t *pctx;
-	pthread_join(thread_manager_id, (void **) &pctx);
+	threadpool_wait(&thread_manager_batch);
+	uct_thread_ctx_t *pctx = &thread_manager_ctx;
 	
 	uct_t *u = pctx->u;
 	uct_search_state_t *s = pctx->s;
@@ -464,6 +495,107 @@ fullmem_warning(uct_t *u, char *msg)
 	if (UDEBUGL(2))  fprintf(stderr, "%s", msg);
 }
 
+
+/*** Background tree garbage collection */
+
+static threadpool_batch_t gc_batch;
+static bool gc_thread_running = false;
+
+static void *
+gc_thread(void *u_)
+{
+	uct_t *u = (uct_t*)u_;
+	topology_pin(TOPO_MANAGER, -1);
+	uct_treecache_flush(u);
+	if (u->t && tree_gc_needed(u->t))
+		tree_garbage_collect(u->t);
+	return NULL;
+}
+
+/* Garbage collect tree in the background if needed, so that it doesn't
+ * happen on the critical path (genmove / next move promotion).
+ * Pending tree cache snapshot gets taken there as well.
+ * Tree must not be touched until uct_tree_gc_wait(). When pondering this
+ * is done by thread_manager() instead (UCT_SEARCH_WANT_GC). */
+void
+uct_tree_gc_start(uct_t *u)
+{
+	assert(!gc_thread_running && !thread_manager_running);
+	if (!u->treecache_t && (!u->t || !tree_gc_needed(u->t)))
+		return;
+
+	gc_thread_running = true;
+	threadpool_run(&gc_batch, gc_thread, u);
+}
+
+/* Wait for background garbage collection to finish. */
+void
+uct_tree_gc_wait(uct_t *u)
+{
+	if (!gc_thread_running)
+		return;
+
+	double time_start = time_now();
+	threadpool_wait(&gc_batch);
+	gc_thread_running = false;
+	if (UDEBUGL(3))  fprintf(stderr, "waited %.2fs for tree gc\n", time_now() - time_start);
+}
+
+
+/*** Tree cache snapshots */
+
+/* Genmove tree cache snapshot is deferred until after the move is sent:
+ * tree gets promoted meanwhile but searched root stays there until tree
+ * gets garbage collected or discarded, so remember it along with tree
+ * poscache state (dropped on promotion). If tree is discarded it's kept
+ * around until then (see reset_state()). */
+void
+uct_treecache_pending(uct_t *u, board_t *b, enum stone color)
+{
+	uct_treecache_flush(u);
+	u->treecache_t = u->t;
+	u->treecache_root = u->t->root;
+	u->treecache_poscache_stored = u->t->poscache_stored;
+	u->t->poscache_stored = NULL;
+	u->treecache_b = malloc2(board_t);
+	board_copy(u->treecache_b, b);
+	u->treecache_color = color;
+}
+
+/* Take pending tree cache snapshot, if any.
+ * Called from gc_thread() / thread_manager() after genmove, or before
+ * tree nodes get moved around (tree gc, realloc, restore). */
+void
+uct_treecache_flush(uct_t *u)
+{
+	tree_t *t = u->treecache_t;
+	if (!t)  return;
+
+	tree_node_t *root = t->root;
+	enum stone root_color = t->root_color;
+	move_stats_t *poscache_stored = t->poscache_stored;
+	t->root = u->treecache_root;
+	t->root_color = stone_other(u->treecache_color);
+	t->poscache_stored = u->treecache_poscache_stored;
+
+	treecache_save(t, u->treecache_b, u->treecache_color);
+
+	if (t != u->t) {
+		free(poscache_stored);
+		tree_done(t);
+	} else if (root != u->treecache_root) {  /* Promoted */
+		free(t->poscache_stored);
+		t->root = root;
+		t->root_color = root_color;
+		t->poscache_stored = poscache_stored;
+	}
+	free(u->treecache_b);
+	u->treecache_t = NULL;
+	u->treecache_root = NULL;
+	u->treecache_poscache_stored = NULL;
+	u->treecache_b = NULL;
+}
+
 /* Stop search, realloc tree and resume search */
 int
 uct_search_realloc_tree(uct_t *u, board_t *b, enum stone color, time_info_t *ti, uct_search_state_t *s)
@@ -637,7 +769,7 @@ uct_search_stop_early(uct_t *u, tree_t *t, board_t *b,
 	/* Early break in won situation. */
 	if (best->u.playouts >= PLAYOUT_EARLY_BREAK_MIN
 	    && (ti->dim != TD_WALLTIME || elapsed > TIME_EARLY_BREAK_MIN)
-	    && tree_node_get_value(t, 1, best->u.value) >= u->sure_win_threshold) {
+	    && tree_node_get_value(t, 1, node_stats_value(&best->u)) >= u->sure_win_threshold) {
 		return true;
 	}
 
@@ -658,7 +790,7 @@ uct_search_keep_looking(uct_t *u, board_t *b, enum stone color,
 
 	/* Do not waste time if we are winning. Spend up to worst time if
 	 * we are unsure, but only desired time if we are sure of winning. */
-	floating_t beta = 2 * (tree_node_get_value(t, 1, best->u.value) - 0.5);
+	floating_t beta = 2 * (tree_node_get_value(t, 1, node_stats_value(&best->u)) - 0.5);
 	if (ti->dim == TD_WALLTIME && beta > 0) {
 		double good_enough = stop->desired.time * beta + stop->worst.time * (1 - beta);
 		double elapsed = time_now() - ti->timer_start;
@@ -691,10 +823,10 @@ uct_search_keep_looking(uct_t *u, board_t *b, enum stone color,
 		tree_node_t *bestr = u->policy->choose(u->policy, best, &b2, stone_other(color), resign);
 
 		if (bestr && bestr->u.playouts
-		    && fabs((double)best->u.value - bestr->u.value) > u->bestr_ratio) {
+		    && fabs((double)node_stats_value(&best->u) - node_stats_value(&bestr->u)) > u->bestr_ratio) {
 			if (UDEBUGL(3))
 				fprintf(stderr, "Bestr delta %f > threshold %f\n",
-					fabs((double)best->u.value - bestr->u.value),
+					fabs((double)node_stats_value(&best->u) - node_stats_value(&bestr->u)),
 					u->bestr_ratio);
 			return true;
 		}
@@ -710,9 +842,9 @@ uct_search_keep_looking(uct_t *u, board_t *b, enum stone color,
 		if (UDEBUGL(3))
 			fprintf(stderr, "[%d] best %3s [%d] %f != winner %3s [%d] %f\n", i,
 				coord2sstr(node_coord(best)),
-				best->u.playouts, tree_node_get_value(t, 1, best->u.value),
+				best->u.playouts, tree_node_get_value(t, 1, node_stats_value(&best->u)),
 				coord2sstr(node_coord(winner)),
-				winner->u.playouts, tree_node_get_value(t, 1, winner->u.value));
+				winner->u.playouts, tree_node_get_value(t, 1, node_stats_value(&winner->u)));
 		return true;
 	}
 
@@ -827,7 +959,7 @@ uct_search_result(uct_t *u, board_t *b, enum stone color,
 		return NULL;
 	}
 	*best_coord = node_coord(best);
-	floating_t winrate = tree_node_get_value(u->t, 1, best->u.value);
+	floating_t winrate = tree_node_get_value(u->t, 1, node_stats_value(&best->u));
 
 	if (UDEBUGL(3))
 		fprintf(stderr, "*** WINNER is %s with score %.1f%% (%d/%d games, %d new), extra komi %.1f\n",
@@ -72,6 +72,10 @@ int uct_search_games(uct_search_state_t *s);
 void uct_search_start(uct_t *u, board_t *b, enum stone color, tree_t *t, time_info_t *ti, uct_search_state_t *s, int flags);
 uct_thread_ctx_t *uct_search_stop(void);
 
+void uct_tree_gc_start(uct_t *u);
+void uct_tree_gc_wait(uct_t *u);
+void uct_treecache_pending(uct_t *u, board_t *b, enum stone color);
+void uct_treecache_flush(uct_t *u);
 int uct_search_realloc_tree(uct_t *u, board_t *b, enum stone color, time_info_t *ti, uct_search_state_t *s);
 
 void uct_search_progress(uct_t *u, board_t *b, enum stone color, tree_t *t, time_info_t *ti, uct_search_state_t *s, int playouts);
@@ -127,8 +127,8 @@ tree_find_node(tree_t *t, incr_stats_t *is, tree_node_t *prev)
 	if (parent) {
 		/* Search for the node in parent's children. */
 		coord_t leaf = leaf_coord(path);
-		node = (prev && prev->parent == parent ? prev->sibling : parent->children);
-		while (node && node_coord(node) != leaf) node = node->sibling;
+		node = (prev && node_parent(prev) == parent ? tree_node_sibling(prev) : node_children(parent));
+		while (node && node_coord(node) != leaf) node = tree_node_sibling(node);
 
 		if (DEBUG_MODE) parent_leaf += !parent->is_expanded;
 	} else {
@@ -229,10 +229,10 @@ receive_stats(uct_t *u, int size)
 		if (!node) continue;
 
 		/* node_total += others_incr */
-		stats_add_result(&node->u, is.incr.value, is.incr.playouts);
+		node_stats_add_result(&node->u, is.incr.value, is.incr.playouts);
 
 		/* last_total += others_incr */
-		stats_add_result(&node->pu, is.incr.value, is.incr.playouts);
+		node_stats_add_result(&node->pu, is.incr.value, is.incr.playouts);
 
 		prev = node;
 	}
@@ -268,7 +268,7 @@ append_stats(stats_candidate_t *stats_queue, tree_node_t *node, int stats_count,
 {
 	/* The children field is set only after all children are created
 	 * so we can traverse the the tree while it is updated. */
-	for (tree_node_t *ni = node->children; ni; ni = ni->sibling) {
+	for (tree_node_t *ni = node_children(node); ni; ni = tree_node_sibling(ni)) {
 
 		if (is_pass(node_coord(ni))) continue;
 		if (ni->hints & TREE_HINT_INVALID) continue;
@@ -335,8 +335,8 @@ select_best_stats(stats_candidate_t *stats_queue, int stats_count,
 		if (delta < 0 || (delta == 0 && --min_count < 0)) continue;
 
 		tree_node_t *node = stats_queue[count].node;
-		os->incr = node->u;
-		stats_rm_result(&os->incr, node->pu.value, node->pu.playouts);
+		os->incr = node_stats_get(&node->u);
+		stats_rm_result(&os->incr, node_stats_value(&node->pu), node->pu.playouts);
 
 		/* With virtual loss os->incr.playouts might be <= 0; we only
 		 * send positive increments to other slaves so a virtual loss
@@ -440,7 +440,7 @@ report_stats(uct_t *u, board_t *b, coord_t force,
 
 	/* We rely on the fact that root->children is set only
 	 * after all children are created. */
-	for (tree_node_t *ni = root->children; ni; ni = ni->sibling) {
+	for (tree_node_t *ni = node_children(root); ni; ni = tree_node_sibling(ni)) {
 
 		if (is_pass(node_coord(ni))) continue;
 		assert(node_coord(ni) > 0 && node_coord(ni) < board_max_coords(b));
@@ -455,7 +455,7 @@ report_stats(uct_t *u, board_t *b, coord_t force,
 		char buf[4];
 		/* We return the values as stored in the tree, so from black's view. */
 		r += snprintf(r, end - r, "\n%s %d %.16f", coord2bstr(buf, node_coord(ni)),
-			      ni->u.playouts, ni->u.value);
+			      ni->u.playouts, node_stats_value(&ni->u));
 	}
 	/* Give a large but not infinite weight to pass, resign or book move, to avoid
 	 * forcing resign if other slaves don't like it. */
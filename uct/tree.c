@@ -1,10 +1,18 @@
 #include <assert.h>
 #include <math.h>
+#include <pthread.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 #define DEBUG
 #include "board.h"
@@ -17,6 +25,7 @@
 #include "tactics/ladder.h"
 #include "tactics/selfatari.h"
 #include "timeinfo.h"
+#include "threadpool.h"
 #include "uct/prior.h"
 #include "uct/internal.h"
 #include "uct/tree.h"
@@ -26,6 +35,8 @@
 #include "uct/slave.h"
 #endif
 
+static void tree_tt_done(tree_t *t);
+
 
 /* Allocate tree node(s). The returned nodes are initialized with zeroes.
  * Returns NULL if not enough memory.
@@ -48,15 +59,86 @@ tree_alloc_node(tree_t *t, int count)
 	return n;
 }
 
+/* Per-thread node allocation:
+ * Each search thread claims large chunks of the tree buffer and allocates
+ * nodes from there, so threads don't all contend on t->nodes_size for every
+ * expansion. t->nodes_size counts claimed chunks, so tree_gc_needed() and
+ * memory full checks stay conservative. Chunk tails left over when a
+ * thread moves to a new chunk are reclaimed by the next tree gc.
+ * Chunks are tied to the tree's allocation generation, which changes
+ * whenever tree memory is reset (tree_init(), gc, copy ...) */
+#define TREE_CHUNK_SIZE		(128 * 1024)
+/* Multiple of node size so all nodes are at multiples of node size
+ * within tree buffer (compact tree node links). */
+#define tree_chunk_size(t)	(MIN(TREE_CHUNK_SIZE, (t)->max_tree_size / 256) / sizeof(tree_node_t) * sizeof(tree_node_t))
+
+static volatile unsigned int tree_alloc_generations = 0;
+
+static void
+tree_alloc_reset(tree_t *t)
+{
+	t->nodes_size = 0;
+	t->alloc_gen = __sync_add_and_fetch(&tree_alloc_generations, 1);
+}
+
+#ifndef NO_THREAD_LOCAL
+
+typedef struct {
+	unsigned int gen;
+	char *next;
+	char *end;
+} tree_chunk_t;
+
+static __thread tree_chunk_t tree_chunk = { 0, };
+
+/* Like tree_alloc_node() but allocate from thread's chunk. */
+static tree_node_t *
+tree_alloc_node_chunk(tree_t *t, int count)
+{
+	tree_chunk_t *c = &tree_chunk;
+	size_t nsize = count * sizeof(tree_node_t);
+
+	if (c->gen != t->alloc_gen || c->next + nsize > c->end) {
+		/* Need new chunk. Big allocation or tree almost full:
+		 * allocate directly, no need to waste space. */
+		size_t chunk_size = tree_chunk_size(t);
+		if (nsize * 2 > chunk_size ||
+		    t->nodes_size + chunk_size > t->max_tree_size)
+			return tree_alloc_node(t, count);
+
+		size_t old_size = __sync_fetch_and_add(&t->nodes_size, chunk_size);
+		if (old_size + chunk_size > t->max_tree_size)
+			return NULL;  /* Not reverting nodes_size, see tree_alloc_node() */
+		c->gen = t->alloc_gen;
+		c->next = (char*)t->nodes + old_size;
+		c->end = c->next + chunk_size;
+	}
+
+	tree_node_t *n = (tree_node_t *)c->next;
+	c->next += nsize;
+	memset(n, 0, nsize);
+	return n;
+}
+
+#else
+#define tree_alloc_node_chunk(t, count)  tree_alloc_node((t), (count))
+#endif
+
 /* Initialize a node at a given place in memory.
  * This function may be called by multiple threads in parallel. */
 static void
-tree_setup_node(tree_t *t, tree_node_t *n, coord_t coord, int depth)
+tree_setup_node(tree_t *t, tree_node_t *n, coord_t coord, tree_node_t *parent)
 {
 	n->coord = coord;
-	n->depth = depth;
-	if (depth > t->max_depth)
-		t->max_depth = depth;
+	node_set_parent(n, parent);
+#ifdef COMPACT_TREE
+	if (parent && !tree_node_odd(parent))
+		n->hints |= TREE_HINT_ODD;
+#else
+	n->depth = (parent ? parent->depth + 1 : 0);
+	if (n->depth > t->max_depth)
+		t->max_depth = n->depth;
+#endif
 
 #ifdef DEBUG_TREE
 	static volatile unsigned int hash = 0;
@@ -70,36 +152,280 @@ tree_setup_node(tree_t *t, tree_node_t *n, coord_t coord, int depth)
 /* Allocate and initialize a node. Returns NULL if tree memory is full.
  * This function may be called by multiple threads in parallel. */
 static tree_node_t *
-tree_init_node(tree_t *t, coord_t coord, int depth)
+tree_init_node(tree_t *t, coord_t coord)
 {
 	tree_node_t *n;
 	n = tree_alloc_node(t, 1);
 	if (!n) return NULL;
-	tree_setup_node(t, n, coord, depth);
+	tree_setup_node(t, n, coord, NULL);
 	return n;
 }
 
+
+/************************************************************************/
+/* Tree memory */
+
+/* Nodes buffers come from malloc() by default. With hugepages, numa
+ * placement or prefaulting they are mmap()ed instead (linux only):
+ * - hugepages cut TLB misses during descent (GBs of randomly accessed nodes)
+ * - numa interleave spreads the tree over all memory nodes instead of
+ *   the one first search thread happens to run on
+ * - prefaulting touches all pages at startup so first search doesn't
+ *   page fault its way through the buffer.
+ * Last freed mmap()ed buffer is kept around and reused by next tree_init()
+ * of the same size (prefaulted buffer, next game tree, gc temp trees). */
+
+#define TREE_MEM_ALIGN		(2 * 1024 * 1024)	/* huge page size */
+#define tree_mem_len(size)	(((size) + TREE_MEM_ALIGN - 1) / TREE_MEM_ALIGN * TREE_MEM_ALIGN)
+
+static enum tree_hugepages tree_hugepages = TREE_HUGEPAGES_NONE;
+static int  tree_numa = TREE_NUMA_DEFAULT;
+static bool tree_prefault = false;
+
+static pthread_mutex_t tree_mem_mutex = PTHREAD_MUTEX_INITIALIZER;
+static void  *tree_mem_cached = NULL;
+static size_t tree_mem_cached_size = 0;
+
+#define tree_mem_mmap()		(tree_hugepages || tree_numa != TREE_NUMA_DEFAULT || tree_prefault)
+
+void
+tree_mem_setup(enum tree_hugepages hugepages, int numa, bool prefault)
+{
+#ifndef __linux__
+	if (hugepages || numa != TREE_NUMA_DEFAULT || prefault)
+		die("tree memory options only supported on linux\n");
+#endif
+	tree_hugepages = hugepages;
+	tree_numa = numa;
+	tree_prefault = prefault;
+}
+
+#ifdef __linux__
+
+#define MPOL_PREFERRED_		1
+#define MPOL_INTERLEAVE_	3
+
+/* Bitmask of online numa nodes (0 if unknown) */
+static unsigned long
+numa_online_nodes(void)
+{
+	FILE *f = fopen("/sys/devices/system/node/online", "r");
+	if (!f)  return 0;
+
+	unsigned long mask = 0;
+	int a, b;
+	while (fscanf(f, "%d", &a) == 1) {
+		b = a;
+		int c = fgetc(f);
+		if (c == '-' && fscanf(f, "%d", &b) == 1)  c = fgetc(f);
+		for (int i = a; i <= b && i < (int)sizeof(mask) * 8; i++)
+			mask |= 1UL << i;
+		if (c != ',')  break;
+	}
+	fclose(f);
+	return mask;
+}
+
+static void
+tree_mem_numa(void *p, size_t len)
+{
+	unsigned long mask;
+	int mode;
+	if (tree_numa == TREE_NUMA_INTERLEAVE) {
+		mask = numa_online_nodes();
+		mode = MPOL_INTERLEAVE_;
+	} else {
+		mask = 1UL << tree_numa;
+		mode = MPOL_PREFERRED_;
+	}
+	if (!mask)  return;
+	if (syscall(SYS_mbind, p, len, mode, &mask, sizeof(mask) * 8, 0) && DEBUGL(2))
+		perror("mbind");
+}
+
+static void *
+tree_mem_map(size_t size)
+{
+	size_t len = tree_mem_len(size);
+	void *p = MAP_FAILED;
+
+	if (tree_hugepages == TREE_HUGEPAGES_HUGETLB) {
+		p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (p == MAP_FAILED && DEBUGL(2))
+			fprintf(stderr, "tree: couldn't get %i Mb of hugetlb pages, using transparent hugepages\n",
+				(int)(len / (1024 * 1024)));
+	}
+	if (p == MAP_FAILED) {
+		p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)  return NULL;
+		if (tree_hugepages)
+			madvise(p, len, MADV_HUGEPAGE);
+	}
+	if (tree_numa != TREE_NUMA_DEFAULT)
+		tree_mem_numa(p, len);
+	return p;
+}
+
+#else
+#define numa_online_nodes()	(0UL)
+#define tree_mem_map(size)	(NULL)
+#endif /* __linux__ */
+#ifdef _WIN32
+#define munmap(p, len)		((void)0)
+#endif
+
+/* Allocate nodes buffer, @mapped set if buffer was mmap()ed. */
+static void *
+tree_mem_alloc(size_t size, bool *mapped)
+{
+	*mapped = tree_mem_mmap();
+	if (!*mapped)
+		return malloc(size);
+
+	void *p = NULL;
+	pthread_mutex_lock(&tree_mem_mutex);
+	if (tree_mem_cached && tree_mem_cached_size == size) {
+		p = tree_mem_cached;
+		tree_mem_cached = NULL;
+	}
+	pthread_mutex_unlock(&tree_mem_mutex);
+
+	return (p ? p : tree_mem_map(size));
+}
+
+/* Keep mmap()ed buffer for reuse unless we already have one. */
+static void
+tree_mem_free(void *p, size_t size, bool mapped)
+{
+	if (!mapped) {  free(p);  return;  }
+
+	pthread_mutex_lock(&tree_mem_mutex);
+	if (!tree_mem_cached) {
+		tree_mem_cached = p;
+		tree_mem_cached_size = size;
+		p = NULL;
+	}
+	pthread_mutex_unlock(&tree_mem_mutex);
+
+	if (p)  munmap(p, tree_mem_len(size));
+}
+
+typedef struct {
+	char *start;
+	size_t len;
+} tree_prefault_t;
+
+static void *
+tree_prefault_thread(void *arg)
+{
+	tree_prefault_t *pf = (tree_prefault_t*)arg;
+	for (size_t i = 0; i < pf->len; i += 4096)
+		pf->start[i] = 0;
+	return NULL;
+}
+
+/* Allocate and prefault nodes buffer for next tree_init() of this size
+ * (if prefaulting is enabled), using @threads threads. */
+void
+tree_mem_prealloc(size_t size, int threads)
+{
+	if (!tree_prefault)  return;
+
+	double time_start = time_now();
+	bool mapped;
+	char *p = tree_mem_alloc(size, &mapped);
+	if (!p) {
+		if (DEBUGL(2))  fprintf(stderr, "tree: couldn't allocate %i Mb to prefault\n", (int)(size / (1024 * 1024)));
+		return;
+	}
+
+	threads = MAX(MIN(threads, 64), 1);
+	size_t slice = tree_mem_len(size / threads);
+	tree_prefault_t pf[threads];
+	threadpool_batch_t batch = THREADPOOL_BATCH_INIT;
+	for (int i = 0; i < threads; i++) {
+		size_t start = MIN(i * slice, size);
+		pf[i].start = p + start;
+		pf[i].len = MIN(start + slice, size) - start;
+		threadpool_run(&batch, tree_prefault_thread, &pf[i]);
+	}
+	threadpool_wait(&batch);
+
+	if (DEBUGL(2))  fprintf(stderr, "tree: prefaulted %i Mb in %.1fs\n",
+				(int)(size / (1024 * 1024)), time_now() - time_start);
+	tree_mem_free(p, size, mapped);
+}
+
+/* Startup log */
+void
+tree_mem_log(void)
+{
+	if (!DEBUGL(2) || !tree_mem_mmap())  return;
+
+	char *hugepages[] = { "off", "transparent", "hugetlb" };
+	fprintf(stderr, "Tree memory: mmap, hugepages %s", hugepages[tree_hugepages]);
+	if (tree_numa == TREE_NUMA_INTERLEAVE)
+		fprintf(stderr, ", numa interleave (nodes 0x%lx)", numa_online_nodes());
+	else if (tree_numa != TREE_NUMA_DEFAULT)
+		fprintf(stderr, ", numa node %i", tree_numa);
+	fprintf(stderr, "%s\n", (tree_prefault ? ", prefault" : ""));
+
+	if (tree_hugepages == TREE_HUGEPAGES_THP) {
+		char buf[128] = "";
+		FILE *f = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+		if (f) {  if (!fgets(buf, sizeof(buf), f)) buf[0] = 0;  fclose(f);  }
+		if (strstr(buf, "[never]"))
+			fprintf(stderr, "Warning: transparent hugepages disabled on this system\n");
+	}
+}
+
+
+static tree_t *tree_init_nodes(enum stone color, size_t max_tree_size, int hbits, void *nodes, bool mapped);
+
 /* Create a tree structure and pre-allocate all nodes.
  * Returns NULL if out of memory */
 tree_t *
 tree_init(enum stone color, size_t max_tree_size, int hbits)
 {
 	tree_node_t *nodes = NULL;
+	bool mapped;
 	assert (max_tree_size != 0);
 	
 	/* The nodes buffer doesn't need initialization. This is currently
 	 * done by tree_init_node to spread the load. Doing a memset for the
 	 * entire buffer here would be too slow for large trees (>10 GB). */
-	if (!(nodes = malloc(max_tree_size))) {
+	if (!(nodes = tree_mem_alloc(max_tree_size, &mapped))) {
 		if (DEBUGL(2))  fprintf(stderr, "Out of memory.\n");
 		return NULL;
 	}
-	
+	return tree_init_nodes(color, max_tree_size, hbits, nodes, mapped);
+}
+
+/* Like tree_init() but nodes buffer is always malloc()ed, for small
+ * trees which shouldn't take tree memory settings / mmap cache. */
+static tree_t *
+tree_init_malloc(enum stone color, size_t max_tree_size)
+{
+	void *nodes = malloc(max_tree_size);
+	return (nodes ? tree_init_nodes(color, max_tree_size, 0, nodes, false) : NULL);
+}
+
+static tree_t *
+tree_init_nodes(enum stone color, size_t max_tree_size, int hbits, void *nodes, bool mapped)
+{
+#ifdef COMPACT_TREE
+	if (max_tree_size / sizeof(tree_node_t) > INT32_MAX)
+		die("tree too big for compact tree nodes (max %lu Mb)\n",
+		    (unsigned long)(INT32_MAX / (1024 * 1024) * sizeof(tree_node_t)));
+#endif
+
 	tree_t *t = calloc2(1, tree_t);
 	t->max_tree_size = max_tree_size;
 	t->nodes = nodes;
+	t->nodes_mapped = mapped;
+	tree_alloc_reset(t);
 	/* The root PASS move is only virtual, we never play it. */
-	t->root = tree_init_node(t, pass, 0);
+	t->root = tree_init_node(t, pass);
 	t->root_color = stone_other(color); // to research black moves, root will be white
 
 #ifdef DISTRIBUTED
@@ -115,35 +441,218 @@ tree_done(tree_t *t)
 #ifdef DISTRIBUTED
 	if (t->htable) free(t->htable);
 #endif
+	tree_tt_done(t);
+	free(t->poscache_stored);
 	assert(t->nodes);
-	free(t->nodes);
+	tree_mem_free(t->nodes, t->max_tree_size, t->nodes_mapped);
 	free(t);
 }
 
 
+/************************************************************************/
+/* Transposition table */
+
+/* Open addressing hash table mapping positions to children blocks.
+ * Positions are keyed by board hash, color to play, ko and move number:
+ * Transpositions are only looked for at the same depth, so there
+ * can't be any cycle and node parity stays the same for all parents. */
+typedef struct {
+	hash_t key;
+	tree_node_t *children;
+} tree_tt_entry_t;
+
+typedef struct tree_tt {
+	int bits;
+	tree_tt_entry_t *entries;
+	int hits;		// stats
+} tree_tt_t;
+
+#define TREE_TT_PROBES 8
+
+/* About 1 entry for 16 nodes. */
+static tree_tt_t *
+tree_tt_alloc(size_t max_tree_size)
+{
+	tree_tt_t *tt = calloc2(1, tree_tt_t);
+	size_t n = max_tree_size / sizeof(tree_node_t) / 16;
+	for (tt->bits = 10; ((size_t)1 << tt->bits) < n; tt->bits++) ;
+	tt->entries = calloc2((size_t)1 << tt->bits, tree_tt_entry_t);
+	return tt;
+}
+
+static void
+tree_tt_done(tree_t *t)
+{
+	if (!t->tt)  return;
+	free(t->tt->entries);
+	free(t->tt);
+	t->tt = NULL;
+}
+
+/* Enable transpositions: children blocks get shared between nodes
+ * reaching the same position. */
+void
+tree_transpositions_init(tree_t *t)
+{
+	assert(!t->tt);
+	t->tt = tree_tt_alloc(t->max_tree_size);
+}
+
+static hash_t
+tree_tt_key(board_t *b, enum stone color)
+{
+	hash_t key = b->hash ^ ((hash_t)b->moves * 0x9e3779b97f4a7c15ULL);
+	if (color == S_WHITE)
+		key = ~key;
+	if (!is_pass(b->ko.coord))
+		key ^= hash_at(b->ko.coord, b->ko.color) * 3;
+	return (key ? key : 1);		/* 0 is empty slot */
+}
+
+#define tree_tt_entry(tt, key, i)	(&(tt)->entries[((key) + (i)) & (((hash_t)1 << (tt)->bits) - 1)])
+
+/* Find children block for given position, NULL if not found.
+ * This function may be called by multiple threads in parallel. */
+static tree_node_t *
+tree_tt_lookup(tree_tt_t *tt, hash_t key)
+{
+	for (int i = 0; i < TREE_TT_PROBES; i++) {
+		tree_tt_entry_t *e = tree_tt_entry(tt, key, i);
+		if (e->key == key)  return e->children;
+		if (!e->key)        return NULL;
+	}
+	return NULL;
+}
+
+/* Register children block for given position. Table full or another thread
+ * racing us for the same position is fine, block just won't be shared.
+ * This function may be called by multiple threads in parallel. */
+static void
+tree_tt_insert(tree_tt_t *tt, hash_t key, tree_node_t *children)
+{
+	for (int i = 0; i < TREE_TT_PROBES; i++) {
+		tree_tt_entry_t *e = tree_tt_entry(tt, key, i);
+		if (e->key == key)  return;
+		if (!e->key && __sync_bool_compare_and_swap(&e->key, 0, key)) {
+			e->children = children;
+			return;
+		}
+	}
+}
+
+/* Children block has been copied already by tree_copy() / tree_prune() ?
+ * Returns the copy. The forwarding pointer is stored in first child's
+ * parent field (src tree gets discarded afterwards). With compact tree
+ * it's the copy's index in @dst tree buffer. */
+#ifdef COMPACT_TREE
+#define tree_tt_forward(dst, children)  (((children)->hints & TREE_HINT_COPIED) ? (tree_node_t*)(dst)->nodes + (children)->parent : NULL)
+#else
+#define tree_tt_forward(dst, children)  (((children)->hints & TREE_HINT_COPIED) ? (children)->parent : NULL)
+#endif
+
+static void
+tree_tt_set_forward(tree_t *dst, tree_node_t *children, tree_node_t *copy)
+{
+	children->hints |= TREE_HINT_COPIED;
+#ifdef COMPACT_TREE
+	children->parent = copy - (tree_node_t*)dst->nodes;
+#else
+	children->parent = copy;
+#endif
+}
+
+/* Move transposition table from @src to @dst after nodes have been copied,
+ * dropping entries for blocks which didn't make it. */
+static void
+tree_tt_move(tree_t *dst, tree_t *src)
+{
+	tree_tt_t *tt = src->tt;
+	if (!tt)  return;
+	src->tt = NULL;
+
+	assert(!dst->tt);
+	dst->tt = tree_tt_alloc(dst->max_tree_size);
+	dst->tt->hits = tt->hits;
+
+	size_t n = (size_t)1 << tt->bits;
+	for (size_t i = 0; i < n; i++) {
+		tree_tt_entry_t *e = &tt->entries[i];
+		if (!e->key || !e->children)  continue;
+		tree_node_t *copy = tree_tt_forward(dst, e->children);
+		if (copy)  tree_tt_insert(dst->tt, e->key, copy);
+	}
+
+	free(tt->entries);
+	free(tt);
+}
+
+/* Check transpositions of @node subtree, @b is node position. */
+static int
+tree_tt_check_node(tree_t *t, tree_node_t *node, board_t *b, enum stone color, int depth)
+{
+	tree_node_t *children = node_children(node);
+	if (!children)  return 0;
+
+	tree_node_t *entry = tree_tt_lookup(t->tt, tree_tt_key(b, color));
+	int bad = (entry && entry != children);
+	if (!depth)  return bad;
+
+	for (tree_node_t *ni = children; ni; ni = tree_node_sibling(ni)) {
+		if (!node_children(ni))  continue;
+		board_t b2;  board_copy(&b2, b);
+		move_t m = move(node_coord(ni), color);
+		if (board_play(&b2, &m) < 0)  bad++;
+		else  bad += tree_tt_check_node(t, ni, &b2, stone_other(color), depth - 1);
+		board_done(&b2);
+	}
+	return bad;
+}
+
+/* Debugging: check transposition table is consistent with tree: entries
+ * point to children blocks in tree memory, and expanded nodes down to
+ * @depth use the block registered for their position.
+ * @b is root position. Returns number of inconsistencies. */
+int
+tree_tt_check(tree_t *t, board_t *b, int depth)
+{
+	if (!t->tt)  return 0;
+
+	int bad = 0;
+	char *start = (char*)t->nodes, *end = start + t->nodes_size;
+	size_t n = (size_t)1 << t->tt->bits;
+	for (size_t i = 0; i < n; i++) {
+		tree_tt_entry_t *e = &t->tt->entries[i];
+		if (e->key && e->children &&
+		    ((char*)e->children < start || (char*)e->children >= end))
+			bad++;
+	}
+	return bad + tree_tt_check_node(t, t->root, b, stone_other(t->root_color), depth);
+}
+
+
 static void
 tree_node_dump(tree_t *tree, tree_node_t *node, int treeparity, int l, int thres)
 {
 	for (int i = 0; i < l; i++) fputc(' ', stderr);
 	int children = 0;
-	for (tree_node_t *ni = node->children; ni; ni = ni->sibling)
+	for (tree_node_t *ni = node_children(node); ni; ni = tree_node_sibling(ni))
 		children++;
 	/* We use 1 as parity, since for all nodes we want to know the
 	 * win probability of _us_, not the node color. */
 #ifdef DEBUG_TREE
 	fprintf(stderr, "[%s] %.3f/%d [prior %.3f/%d amaf %.3f/%d crit %.3f vloss %d] h=%x c#=%d <%" PRIhash ">\n",
 		coord2sstr(node_coord(node)),
-		tree_node_get_value(tree, treeparity, node->u.value), node->u.playouts,
-		tree_node_get_value(tree, treeparity, node->prior.value), node->prior.playouts,
-		tree_node_get_value(tree, treeparity, node->amaf.value), node->amaf.playouts,
+		tree_node_get_value(tree, treeparity, node_stats_value(&node->u)), node->u.playouts,
+		tree_node_get_value(tree, treeparity, node_prior(node).value), node->prior.playouts,
+		tree_node_get_value(tree, treeparity, node_stats_value(&node->amaf)), node->amaf.playouts,
 		tree_node_criticality(node), node->descents,
 		node->hints, children, node->hash);
 #else
 	fprintf(stderr, "[%s] %.3f/%d [prior %.3f/%d amaf %.3f/%d crit %.3f vloss %d] h=%x c#=%d\n",
 		coord2sstr(node_coord(node)),
-		tree_node_get_value(tree, treeparity, node->u.value), node->u.playouts,
-		tree_node_get_value(tree, treeparity, node->prior.value), node->prior.playouts,
-		tree_node_get_value(tree, treeparity, node->amaf.value), node->amaf.playouts,
+		tree_node_get_value(tree, treeparity, node_stats_value(&node->u)), node->u.playouts,
+		tree_node_get_value(tree, treeparity, node_prior(node).value), node->prior.playouts,
+		tree_node_get_value(tree, treeparity, node_stats_value(&node->amaf)), node->amaf.playouts,
 		tree_node_criticality(node), node->descents,
 		node->hints, children);
 #endif
@@ -151,7 +660,7 @@ tree_node_dump(tree_t *tree, tree_node_t *node, int treeparity, int l, int thres
 	/* Print nodes sorted by #playouts. */
 
 	tree_node_t *nbox[1000]; int nboxl = 0;
-	for (tree_node_t *ni = node->children; ni; ni = ni->sibling)
+	for (tree_node_t *ni = node_children(node); ni; ni = tree_node_sibling(ni))
 		if (ni->u.playouts > thres)
 			nbox[nboxl++] = ni;
 
@@ -171,9 +680,16 @@ void
 tree_dump(tree_t *tree, double thres)
 {
 	int thres_abs = thres > 0 ? tree->root->u.playouts * thres : thres;
+#ifdef COMPACT_TREE
+	fprintf(stderr, "(UCT tree; root %s; extra komi %f)\n",
+	        stone2str(tree->root_color), tree->extra_komi);
+#else
 	fprintf(stderr, "(UCT tree; root %s; extra komi %f; max depth %d)\n",
 	        stone2str(tree->root_color), tree->extra_komi,
 		tree->max_depth - tree->root->depth);
+#endif
+	if (tree->tt)
+		fprintf(stderr, "(%d transpositions)\n", tree->tt->hits);
 	tree_node_dump(tree, tree->root, 1, 0, thres_abs);
 }
 
@@ -182,7 +698,7 @@ tree_actual_size_node(tree_t *t, tree_node_t *node, size_t *size)
 {
 	*size += sizeof(*node);
 
-	for (tree_node_t *ni = node->children;  ni;  ni = ni->sibling)
+	for (tree_node_t *ni = node_children(node);  ni;  ni = tree_node_sibling(ni))
 		tree_actual_size_node(t, ni, size);
 }
 
@@ -200,7 +716,7 @@ tree_actual_size(tree_t *t)
 }
 
 
-static char *
+char *
 tree_book_name(board_t *b)
 {
 	int size = board_rsize(b);
@@ -212,30 +728,56 @@ tree_book_name(board_t *b)
 	return buf;
 }
 
-static void
-tree_node_save(FILE *f, tree_node_t *node, int thres)
-{
-	bool save_children = node->u.playouts >= thres;
-
-	if (!save_children)
-		node->is_expanded = 0;
+/* Opening tbook format:
+ * Header followed by tree nodes in breadth-first order, so each children
+ * block is contiguous in the file just like in tree memory. Nodes are
+ * stored as is except for parent / children links which hold node
+ * indices (0 = none). Loading is a mmap(), a single copy into tree
+ * memory and one pass to turn indices back into links.
+ * Node layout depends on build options, books are tied to node size
+ * and layout flags. Old stream format books (raw node dumps) are rejected. */
 
-	fputc(1, f);
-	fwrite(((int *) node) + offsetof(tree_node_t, u),
-	       sizeof(tree_node_t) - offsetof(tree_node_t, u),
-	       1, f);
+#define TBOOK_MAGIC	"PACHITB"
+#define TBOOK_VERSION	1
 
-	if (save_children) {
-		for (tree_node_t *ni = node->children; ni; ni = ni->sibling)
-			tree_node_save(f, ni, thres);
-	} else {
-		if (node->children)
-			node->is_expanded = 1;
-	}
+#define TBOOK_COMPACT		1
+#define TBOOK_DISTRIBUTED	2
+#define TBOOK_DEBUG_TREE	4
 
-	fputc(0, f);
+typedef struct {
+	char     magic[8];
+	uint32_t version;
+	uint32_t node_size;
+	uint32_t flags;
+	uint32_t nodes;
+	uint32_t reserved[10];	/* nodes start at 64 bytes */
+} tbook_header_t;
+
+static uint32_t
+tbook_flags(void)
+{
+	uint32_t flags = 0;
+#ifdef COMPACT_TREE
+	flags |= TBOOK_COMPACT;
+#endif
+#ifdef DISTRIBUTED
+	flags |= TBOOK_DISTRIBUTED;
+#endif
+#ifdef DEBUG_TREE
+	flags |= TBOOK_DEBUG_TREE;
+#endif
+	return flags;
 }
 
+/* Node links <-> file node indices */
+#ifdef COMPACT_TREE
+#define tbook_link(i)		((int32_t)(i))
+#define tbook_index(link)	((uint32_t)(link))
+#else
+#define tbook_link(i)		((tree_node_t*)(uintptr_t)(i))
+#define tbook_index(link)	((uint32_t)(uintptr_t)(link))
+#endif
+
 void
 tree_save(tree_t *tree, board_t *b, int thres)
 {
@@ -245,43 +787,155 @@ tree_save(tree_t *tree, board_t *b, int thres)
 		perror("fopen");
 		return;
 	}
-	tree_node_save(f, tree->root, thres);
-	fputc(0, f);
-	fclose(f);
-}
 
+	tbook_header_t h = { TBOOK_MAGIC, TBOOK_VERSION, sizeof(tree_node_t), tbook_flags(), 0, { 0, } };
+	fwrite(&h, sizeof(h), 1, f);	/* Node count filled in at the end */
+
+	int size = 1024, n = 1;
+	tree_node_t **queue = cmalloc(size * sizeof(*queue));
+	uint32_t *parents = cmalloc(size * sizeof(*parents));
+	queue[0] = tree->root;  parents[0] = 0;
+	for (int i = 0; i < n; i++) {
+		tree_node_t *node = queue[i];
+		tree_node_t rec = *node;
+		bool save_children = (node->u.playouts >= thres && node_children(node));
+
+		rec.parent = tbook_link(parents[i]);
+		rec.children = tbook_link(save_children ? n : 0);
+		if (!save_children)
+			rec.is_expanded = 0;
+		rec.hints &= ~(TREE_HINT_COPIED | TREE_HINT_DCNN_PENDING);
+		rec.descents = 0;
+		fwrite(&rec, sizeof(rec), 1, f);
+
+		if (!save_children)  continue;
+		for (tree_node_t *ni = node_children(node); ni; ni = tree_node_sibling(ni)) {
+			if (n == size) {
+				size *= 2;
+				queue = crealloc(queue, size * sizeof(*queue));
+				parents = crealloc(parents, size * sizeof(*parents));
+			}
+			queue[n] = ni;  parents[n++] = i;
+		}
+	}
+	free(queue);
+	free(parents);
 
-void
-tree_node_load(FILE *f, tree_node_t *node, int *num)
-{
-	(*num)++;
+	h.nodes = n;
+	fseek(f, 0, SEEK_SET);
+	fwrite(&h, sizeof(h), 1, f);
+	fclose(f);
+}
 
-	checked_fread(((int *) node) + offsetof(tree_node_t, u),
-		      sizeof(tree_node_t) - offsetof(tree_node_t, u),
-		      1, f);
 
-	/* Keep values in sane scale, otherwise we start overflowing. */
+/* Keep values in sane scale, otherwise we start overflowing. */
 #define MAX_PLAYOUTS	10000000
+
+static void
+tree_node_load_stats(tree_node_t *node)
+{
 	if (node->u.playouts > MAX_PLAYOUTS) {
-		node->u.playouts = MAX_PLAYOUTS;
+		move_stats_t s = move_stats(node_stats_value(&node->u), MAX_PLAYOUTS);
+		node_stats_set(&node->u, &s);
 	}
 	if (node->amaf.playouts > MAX_PLAYOUTS) {
-		node->amaf.playouts = MAX_PLAYOUTS;
+		move_stats_t s = move_stats(node_stats_value(&node->amaf), MAX_PLAYOUTS);
+		node_stats_set(&node->amaf, &s);
 	}
 #ifdef DISTRIBUTED
 	memcpy(&node->pu, &node->u, sizeof(node->u));
 #endif
+}
+
+/* Map tbook nodes (read-only) */
+static void *
+tbook_map(FILE *f, size_t size)
+{
+#ifndef _WIN32
+	void *p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+	return (p == MAP_FAILED ? NULL : p);
+#else
+	void *p = cmalloc(size);
+	fseek(f, 0, SEEK_SET);
+	if (fread(p, 1, size, f) != size) {  free(p);  return NULL;  }
+	return p;
+#endif
+}
+
+static void
+tbook_unmap(void *p, size_t size)
+{
+#ifndef _WIN32
+	munmap(p, size);
+#else
+	free(p);
+#endif
+}
+
+/* Load flat format tbook. If tree memory is too small, load as many
+ * children blocks as fit (breadth-first), the rest is left unexpanded.
+ * Returns number of nodes loaded. */
+static int
+tree_load_flat(tree_t *tree, FILE *f, char *filename)
+{
+	tbook_header_t h;
+	fseek(f, 0, SEEK_END);
+	size_t file_size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	checked_fread(&h, sizeof(h), 1, f);
+	if (h.version != TBOOK_VERSION || h.node_size != sizeof(tree_node_t) || h.flags != tbook_flags()) {
+		fprintf(stderr, "%s: tbook built with a different version / build options, skipping.\n", filename);
+		return 0;
+	}
+	size_t size = sizeof(h) + (size_t)h.nodes * sizeof(tree_node_t);
+	if (!h.nodes || file_size < size) {
+		fprintf(stderr, "%s: truncated tbook, skipping.\n", filename);
+		return 0;
+	}
 
-	tree_node_t *ni = NULL, *ni_prev = NULL;
-	while (fgetc(f)) {
-		ni_prev = ni; ni = calloc2(1, tree_node_t);
-		if (!node->children)
-			node->children = ni;
-		else
-			ni_prev->sibling = ni;
-		ni->parent = node;
-		tree_node_load(f, ni, num);
+	char *map = tbook_map(f, size);
+	if (!map)  {  perror("mmap");  return 0;  }
+	tree_node_t *recs = (tree_node_t*)(map + sizeof(h));
+
+	/* Root content goes into existing root node, other nodes into a single block. */
+	size_t avail = (tree->max_tree_size - MIN(tree->nodes_size, tree->max_tree_size)) / sizeof(tree_node_t);
+	uint32_t k = MIN(h.nodes - 1, avail);
+	while (k && !(recs[k].hints & TREE_HINT_LAST))  k--;
+	tree_node_t *nodes = (k ? tree_alloc_node(tree, k) : NULL);
+	if (!nodes)  k = 0;
+	if (k < h.nodes - 1)
+		fprintf(stderr, "Tree memory full, tbook partially loaded.\n");
+
+	memcpy(((char *) tree->root) + offsetof(tree_node_t, u),
+	       ((char *) &recs[0]) + offsetof(tree_node_t, u),
+	       sizeof(tree_node_t) - offsetof(tree_node_t, u));
+	tree->root->hints &= ~TREE_HINT_LAST;
+	if (k)  memcpy(nodes, &recs[1], k * sizeof(tree_node_t));
+
+#define tbook_node(i)  ((i) ? &nodes[(i) - 1] : tree->root)
+	for (uint32_t i = 0; i <= k; i++) {
+		tree_node_t *node = tbook_node(i);
+		uint32_t children = tbook_index(recs[i].children);
+		if (i) {
+			uint32_t parent = tbook_index(recs[i].parent);
+			node_set_parent(node, (parent < i ? tbook_node(parent) : tree->root));
+		}
+		if (children > i && children <= k)
+			node_set_children(node, tbook_node(children));
+		else {
+			node_set_children(node, NULL);
+			node->is_expanded = 0;
+		}
+		tree_node_load_stats(node);
+#ifndef COMPACT_TREE
+		if (node->depth > tree->max_depth)
+			tree->max_depth = node->depth;
+#endif
 	}
+#undef tbook_node
+
+	tbook_unmap(map, size);
+	return k + 1;
 }
 
 void
@@ -294,9 +948,15 @@ tree_load(tree_t *tree, board_t *b)
 
 	fprintf(stderr, "Loading opening tbook %s...\n", filename);
 
-	int num = 0;
-	if (fgetc(f))
-		tree_node_load(f, tree->root, &num);
+	/* Old stream format books were raw node dumps, node layout
+	 * has changed since: can't use them. */
+	char magic[sizeof(TBOOK_MAGIC)] = { 0, };
+	if (fread(magic, sizeof(magic), 1, f) != 1 || memcmp(magic, TBOOK_MAGIC, sizeof(magic))) {
+		fprintf(stderr, "%s: old or unknown tbook format, skipping (regenerate it).\n", filename);
+		fclose(f);
+		return;
+	}
+	int num = tree_load_flat(tree, f, filename);
 	fprintf(stderr, "Loaded %d nodes.\n", num);
 
 	fclose(f);
@@ -306,19 +966,29 @@ tree_load(tree_t *tree, board_t *b)
 /************************************************************************/
 /* Tree garbage collection */
 
-static tree_node_t*
-tree_prune_dup_node(tree_t *dest, tree_t *src, tree_node_t *node,
-		    int threshold, int depth)
+static void
+tree_copy_poscache_stored(tree_t *dst, tree_t *src)
+{
+	free(dst->poscache_stored);
+	dst->poscache_stored = NULL;
+	if (!src->poscache_stored)  return;
+
+	size_t size = (BOARD_MAX_COORDS + 1) * sizeof(move_stats_t);
+	dst->poscache_stored = cmalloc(size);
+	memcpy(dst->poscache_stored, src->poscache_stored, size);
+}
+
+/* Copy node (without its children) to @n2. */
+static void
+tree_prune_dup_node(tree_t *dest, tree_node_t *n2, tree_node_t *node)
 {
-	tree_node_t *n2 = tree_alloc_node(dest, 1);
-	if (!n2)
-		return NULL;
 	*n2 = *node;
+#ifndef COMPACT_TREE
 	if (n2->depth > dest->max_depth)
 		dest->max_depth = n2->depth;
-	n2->children = NULL;
+#endif
+	node_set_children(n2, NULL);
 	n2->is_expanded = false;
-	return n2;
 }
 
 /* breadth-first tree pruning queue */
@@ -327,6 +997,7 @@ typedef struct {
 	unsigned int max_nodes;
 	tree_node_t **src_nodes;
 	tree_node_t **dst_nodes;
+	unsigned short *depths;		/* depth below root */
 } pruning_queue_t;
 
 static void
@@ -336,36 +1007,33 @@ pruning_queue_init(pruning_queue_t *q, unsigned int max_nodes)
 	q->max_nodes = max_nodes;
 	q->src_nodes  = cmalloc(max_nodes * sizeof(tree_node_t *));
 	q->dst_nodes  = cmalloc(max_nodes * sizeof(tree_node_t *));
+	q->depths     = cmalloc(max_nodes * sizeof(unsigned short));
 }
 
 static void
 pruning_queue_free(pruning_queue_t *q) {
 	free(q->src_nodes);  q->src_nodes = NULL;
 	free(q->dst_nodes);  q->dst_nodes = NULL;
+	free(q->depths);     q->depths = NULL;
 }
 
 static void
-pruning_queue_push(pruning_queue_t *q, tree_node_t *src, tree_node_t *dst)
+pruning_queue_push(pruning_queue_t *q, tree_node_t *src, tree_node_t *dst, int depth)
 {
 	if (q->n == q->max_nodes) {
 		if (DEBUGL(4)) fprintf(stderr, "pruning queue realloc: %i -> %i\n", q->max_nodes, q->max_nodes * 2);
 		q->max_nodes *= 2;
 		q->src_nodes = crealloc(q->src_nodes, q->max_nodes * sizeof(tree_node_t *));
 		q->dst_nodes = crealloc(q->dst_nodes, q->max_nodes * sizeof(tree_node_t *));
+		q->depths    = crealloc(q->depths,    q->max_nodes * sizeof(unsigned short));
 	}
 
 	q->src_nodes[q->n] = src;
 	q->dst_nodes[q->n] = dst;
+	q->depths[q->n] = depth;
 	q->n++;
 }
 
-static void
-pruning_queue_pop(pruning_queue_t *q)
-{
-	assert(q->n);
-	q->n--;
-}
-
 /* Prune children of given node.
  * Queue them since we're going breadth-first. */
 static void
@@ -375,13 +1043,14 @@ tree_prune_node(tree_t *dest, tree_t *src,
 {
 	tree_node_t *node = queue->src_nodes[node_index];
 	tree_node_t *n2	  = queue->dst_nodes[node_index];
+	int node_depth    = queue->depths[node_index];
 	assert(n2);
 	assert(node);
 
-	if (node->depth >= depth && node->u.playouts < threshold)
+	if (node_depth >= depth && node->u.playouts < threshold)
 		return;
 	
-	if (!node->children)
+	if (!node_children(node))
 		return;
 
 	/* Prune children:
@@ -391,32 +1060,38 @@ tree_prune_node(tree_t *dest, tree_t *src,
 	 * would degrade the playing strength. The only exception is
 	 * when dest becomes full, but this should never happen in practice
 	 * if threshold is chosen to limit the number of nodes traversed. */
-	int added = 0;	
-	tree_node_t **prev2 = &(n2->children);
-	tree_node_t *ni;
-	for (ni = node->children;  ni;  ni = ni->sibling, added++) {
-		tree_node_t *ni2 = tree_prune_dup_node(dest, src, ni, threshold, depth);
-		if (!ni2)  break;
-		*prev2 = ni2;
-		prev2 = &(ni2->sibling);
-		ni2->parent = n2;
-		
-		pruning_queue_push(queue, ni, ni2);
-	}
-	
-	if (!ni)
+	tree_node_t *copy = (src->tt ? tree_tt_forward(dest, node_children(node)) : NULL);
+	if (copy) {  /* Transposition, already copied */
+		node_set_children(n2, copy);
 		n2->is_expanded = true;
-	else {
-		n2->children = NULL;  // avoid partially expanded nodes
-		for (int i = 0; i < added; i++)  pruning_queue_pop(queue);
+		return;
+	}
+
+	int count = 0;
+	for (tree_node_t *ni = node_children(node);  ni;  ni = tree_node_sibling(ni))
+		count++;
+
+	tree_node_t *children = tree_alloc_node(dest, count);
+	if (!children)  return;  // avoid partially expanded nodes
+
+	tree_node_t *ni2 = children;
+	for (tree_node_t *ni = node_children(node);  ni;  ni = tree_node_sibling(ni), ni2++) {
+		tree_prune_dup_node(dest, ni2, ni);
+		node_set_parent(ni2, n2);
+		pruning_queue_push(queue, ni, ni2, node_depth + 1);
 	}
+
+	if (src->tt)  tree_tt_set_forward(dest, node_children(node), children);
+	node_set_children(n2, children);
+	n2->is_expanded = true;
 }
 
 /* Prune src tree into dest (nodes are copied).
- * Keep all nodes at or below depth with at least threshold playouts.
+ * Keep all nodes at or below depth (below root) with at least threshold playouts.
  * The relative order of children of a given node is preserved
  * (assumed by tree_get_node() in particular).
  * Process nodes breadth-first so that we don't drop toplevel nodes !
+ * With transpositions @src tree is clobbered and must be discarded afterwards.
  * Note: Only for fast_alloc. */
 static void
 tree_prune(tree_t *dest, tree_t *src, int threshold, int depth)
@@ -428,17 +1103,19 @@ tree_prune(tree_t *dest, tree_t *src, int threshold, int depth)
 	dest->untrustworthy_tree = src->untrustworthy_tree;
 	dest->extra_komi = src->extra_komi;
 	dest->avg_score = src->avg_score;
+	tree_copy_poscache_stored(dest, src);
 	/* DISTRIBUTED htable not copied, gets rebuilt as needed */
-	dest->nodes_size = 0;	/* we do not want the dummy pass node */
+	tree_alloc_reset(dest);	/* we do not want the dummy pass node */
 	dest->max_depth = 0;	/* gets recomputed */
  	dest->root_color = src->root_color;
-	dest->root = tree_prune_dup_node(dest, src, node, threshold, depth);
+	dest->root = tree_alloc_node(dest, 1);
 	assert(dest->root);
+	tree_prune_dup_node(dest, dest->root, node);
 
 	unsigned int pruning_queue_len = 32768;
 	pruning_queue_t queue;   pruning_queue_init(&queue, pruning_queue_len);
 	pruning_queue_t queue2;  pruning_queue_init(&queue2, pruning_queue_len);
-	pruning_queue_push(&queue, node, dest->root);
+	pruning_queue_push(&queue, node, dest->root, 0);
 
 	//int cur_depth = 1;
 	while(queue.n) {
@@ -452,6 +1129,8 @@ tree_prune(tree_t *dest, tree_t *src, int threshold, int depth)
 
 	pruning_queue_free(&queue);
 	pruning_queue_free(&queue2);
+
+	tree_tt_move(dest, src);
 }
 
 static void
@@ -502,11 +1181,6 @@ log_temp_tree_overflow(tree_t *t, tree_t *t2, int threshold, int max_depth)
 #define LARGE_TREE_PLAYOUTS 40000LL
 #define DEEP_PLAYOUTS_THRESHOLD 40
 
-/* Garbage collect the tree early if the top node has < 5K playouts,
- * to avoid having to do it later on a large subtree.
- * This guarantees garbage collection in < 1s. */
-#define SMALL_TREE_PLAYOUTS 5000
-
 /* Tree garbage collection
  * Main job:
  * - reclaim space used by unreachable nodes after move promotion
@@ -519,7 +1193,7 @@ void
 tree_garbage_collect(tree_t *t)
 {
 	tree_node_t *node = t->root;
-	assert(t->nodes && !node->parent && !node->sibling);
+	assert(t->nodes && !node_parent(node));
 	double time_start = time_now();
 	size_t orig_size = t->nodes_size;
 	size_t orig_content_size = (DEBUGL(3) ? tree_actual_size(t) : 0);
@@ -533,10 +1207,10 @@ tree_garbage_collect(tree_t *t)
 
 	/* Find the maximum depth at which we can copy all nodes. */
 	int max_nodes = 1;
-	for (tree_node_t *ni = node->children; ni; ni = ni->sibling)
+	for (tree_node_t *ni = node_children(node); ni; ni = tree_node_sibling(ni))
 		max_nodes++;
 	size_t nodes_size = max_nodes * sizeof(*node);
-	int max_depth = node->depth;
+	int max_depth = 0;
 	for (;  nodes_size < max_pruned_size && max_nodes > 1;  max_depth++) {
 		max_nodes--;
 		nodes_size += max_nodes * nodes_size;
@@ -573,10 +1247,13 @@ tree_garbage_collect(tree_t *t)
 				(float)orig_size / (1024*1024),
 				(float)orig_content_size / (1024*1024),
 				(float)t->nodes_size / (1024*1024));
-			fprintf(stderr, "pruned %lu nodes (%i%%), dest depth %d, wanted %d",
+			fprintf(stderr, "pruned %lu nodes (%i%%), wanted depth %d",
 				(unsigned long)((orig_size - t->nodes_size) / sizeof(tree_node_t)),
 				(int)((orig_size - t->nodes_size) * 100 / orig_size),
-				t2->max_depth, max_depth);
+				max_depth);
+#ifndef COMPACT_TREE
+			fprintf(stderr, ", dest depth %d", t2->max_depth - t2->root->depth);
+#endif
 		}
 		fprintf(stderr, "\n");
 	}
@@ -588,38 +1265,41 @@ tree_garbage_collect(tree_t *t)
 /*********************************************************************************/
 /* Tree copy */
 
-/* Copy subtree rooted at node in src to dest.
+/* Copy children of @node in src to @n2 in dest, recursively.
  * Same logic as tree_prune_node() but simpler since we can go
- * depth-first and both trees are same size.
- * Returns the copy of node in the destination tree. */
-static tree_node_t *
-tree_copy_node(tree_t *dest, tree_t *src, tree_node_t *node)
+ * depth-first and both trees are same size. */
+static void
+tree_copy_children(tree_t *dest, tree_t *src, tree_node_t *n2, tree_node_t *node)
 {
-	assert(dest->nodes && node);
-	tree_node_t *n2 = tree_alloc_node(dest, 1);
-	if (!n2)  die("tree_copy(): tree_alloc_node() failed. dest tree too small ?\n");
-	*n2 = *node;
-	n2->children = NULL;
+	node_set_children(n2, NULL);
 	n2->is_expanded = false;
+	if (!node_children(node))
+		return;
 
-	if (!node->children)
-		return n2;
+	tree_node_t *copy = (src->tt ? tree_tt_forward(dest, node_children(node)) : NULL);
+	if (copy) {  /* Transposition, already copied */
+		node_set_children(n2, copy);
+		n2->is_expanded = true;
+		return;
+	}
+
+	int count = 0;
+	for (tree_node_t *ni = node_children(node);  ni;  ni = tree_node_sibling(ni))
+		count++;
+
+	tree_node_t *children = tree_alloc_node(dest, count);
+	if (!children)  die("tree_copy(): tree_alloc_node() failed. dest tree too small ?\n");
+	tree_node_t *src_children = node_children(node);
+	memcpy(children, src_children, count * sizeof(*children));
+	if (src->tt)  tree_tt_set_forward(dest, src_children, children);
 
-	/* Copy children */
-	tree_node_t **prev2 = &(n2->children);
-	tree_node_t *ni;
-	for (ni = node->children;  ni;  ni = ni->sibling) {
-		tree_node_t *ni2 = tree_copy_node(dest, src, ni);
-		assert(ni2);
-		*prev2 = ni2;
-		prev2 = &(ni2->sibling);
-		ni2->parent = n2;
+	for (int i = 0; i < count; i++) {
+		node_set_parent(&children[i], n2);
+		tree_copy_children(dest, src, &children[i], &src_children[i]);
 	}
-	
-	if (!ni)  n2->is_expanded = true;
-	else      n2->children = NULL;     // avoid partially expanded nodes
-	
-	return n2;
+
+	node_set_children(n2, children);
+	n2->is_expanded = true;
 }
 
 /* Copy the whole tree (all reachable nodes)
@@ -627,6 +1307,7 @@ tree_copy_node(tree_t *dest, tree_t *src, tree_node_t *node)
  * Simpler / faster than tree_prune() as we can process nodes depth-first.
  * The relative order of children of a given node is preserved
  * (assumed by tree_get_node() in particular).
+ * With transpositions @src tree is clobbered and must be discarded afterwards.
  * Note: Only for fast_alloc. */
 void
 tree_copy(tree_t *dst, tree_t *src)
@@ -635,12 +1316,54 @@ tree_copy(tree_t *dst, tree_t *src)
 	dst->untrustworthy_tree = src->untrustworthy_tree;
 	dst->extra_komi = src->extra_komi;
 	dst->avg_score = src->avg_score;
+	tree_copy_poscache_stored(dst, src);
 	/* DISTRIBUTED htable not copied, gets rebuilt as needed */
-	dst->nodes_size = 0;		  /* we do not want the dummy pass node */
+	tree_alloc_reset(dst);		  /* we do not want the dummy pass node */
 	dst->max_depth = src->max_depth;  /* same depths */
 	dst->root_color = src->root_color;
-	dst->root = tree_copy_node(dst, src, src->root);
-	assert(dst->root);
+	dst->root = tree_alloc_node(dst, 1);
+	if (!dst->root)  die("tree_copy(): tree_alloc_node() failed. dest tree too small ?\n");
+	*dst->root = *src->root;
+	tree_copy_children(dst, src, dst->root, src->root);
+	tree_tt_move(dst, src);
+}
+
+
+/* Snapshot of top of tree @src, in a new tree of at most @max_size bytes
+ * (sized to content). Nodes at depth < @depth or with at least @threshold
+ * playouts get their children copied, top levels first. @src is left
+ * untouched. Returns NULL if @src uses transpositions (tree_prune()
+ * would clobber it) or out of memory. */
+tree_t *
+tree_snapshot(tree_t *src, size_t max_size, int threshold, int depth)
+{
+	if (src->tt)  return NULL;
+	max_size = MAX(MIN(max_size, src->nodes_size), sizeof(tree_node_t)) / sizeof(tree_node_t) * sizeof(tree_node_t);
+
+	tree_t *tmp = tree_init_malloc(stone_other(src->root_color), max_size);
+	if (!tmp)  return NULL;
+	tree_prune(tmp, src, threshold, depth);
+
+	tree_t *t = tree_init_malloc(stone_other(src->root_color), MIN(tmp->nodes_size, max_size));
+	if (t)  tree_copy(t, tmp);
+	tree_done(tmp);
+	return t;
+}
+
+/* Replace @t content with a copy of @snapshot (see tree_snapshot()).
+ * Returns false if it doesn't fit. */
+bool
+tree_restore(tree_t *t, tree_t *snapshot)
+{
+	if (snapshot->nodes_size > t->max_tree_size)
+		return false;
+
+	bool transpositions = (t->tt != NULL);
+	tree_tt_done(t);
+	tree_copy(t, snapshot);
+	if (transpositions)
+		tree_transpositions_init(t);
+	return true;
 }
 
 
@@ -678,7 +1401,7 @@ tree_replace(tree_t *tree, tree_t *content)
 tree_node_t *
 tree_get_node(tree_node_t *parent, coord_t c)
 {
-	for (tree_node_t *n = parent->children; n; n = n->sibling)
+	for (tree_node_t *n = node_children(parent); n; n = tree_node_sibling(n))
 		if (node_coord(n) == c)
 			return n;
 	return NULL;
@@ -724,12 +1447,33 @@ tree_expand_get_moves(mq_t *consider, board_t *b, enum stone color, uct_t *u)
 void
 tree_expand_node(tree_t *t, tree_node_t *node, board_t *b, enum stone color, uct_t *u, int parity)
 {
+	tree_expand_node_dcnn(t, node, b, color, u, parity, NULL);
+}
+
+/* Same as tree_expand_node() but with dcnn output for this position already
+ * available (batched evaluation, see uct_expand_next_best_moves()). */
+void
+tree_expand_node_dcnn(tree_t *t, tree_node_t *node, board_t *b, enum stone color, uct_t *u, int parity, float *dcnn)
+{
+	/* Transposition ? Share existing children.
+	 * Not for root / dcnn expansions (tree not ready), they need their own priors. */
+	hash_t tt_key = 0;
+	if (t->tt) {
+		tt_key = tree_tt_key(b, color);
+		tree_node_t *children = (u->tree_ready ? tree_tt_lookup(t->tt, tt_key) : NULL);
+		if (children) {
+			__sync_fetch_and_add(&t->tt->hits, 1);
+			node_set_children(node, children);
+			return;
+		}
+	}
+
 	/* Include pass in the prior map. */
 	move_stats_t map_prior[board_max_coords(b) + 1];      memset(map_prior, 0, sizeof(map_prior));
 	mq_t consider;  mq_init(&consider);
 	
 	/* Map of prior values to initialize the new nodes with. */
-	prior_map_t map = { b, color, tree_parity(t, parity), &map_prior[1], &consider };
+	prior_map_t map = { b, color, tree_parity(t, parity), &map_prior[1], &consider, dcnn };
 
 	/* Get considered moves */
 	tree_expand_get_moves(&consider, b, color, u);
@@ -739,48 +1483,65 @@ tree_expand_node(tree_t *t, tree_node_t *node, board_t *b, enum stone color, uct
 
 	/* Now, create the nodes (all at once)
 	 * We might temporarily run out of nodes but this should be rare. */
-	tree_node_t *first_child = tree_alloc_node(t, consider.moves + 1);  // + 1 for pass
+	tree_node_t *first_child = tree_alloc_node_chunk(t, consider.moves + 1);  // + 1 for pass
 	if (!first_child) {
 		node->is_expanded = false;
 		return;
 	}
 
 	/* Setup pass node */
-	tree_setup_node(t, first_child, pass, node->depth + 1);
-	first_child->parent = node;
-	first_child->prior = map.prior[pass];
+	tree_setup_node(t, first_child, pass, node);
+	node_set_prior(first_child, &map.prior[pass]);
 
 	/* Setup other children */
-	tree_node_t *prev = first_child;
 	tree_node_t *ni   = first_child + 1;
 	for (int i = 0; i < consider.moves; i++, ni++) {
 		coord_t c = consider.move[i];
 		assert(c != node_coord(node)); // I have spotted "C3 C3" in some sequence...
 
-		tree_setup_node(t, ni, c, node->depth + 1);
+		tree_setup_node(t, ni, c, node);
 		if (!board_playing_ko_threat(b) && is_selfatari(b, color, c))
 			ni->hints |= TREE_HINT_SELFATARI;
-		ni->parent = node;
-		ni->prior = map.prior[c];
-
-		prev->sibling = ni;
-		prev = ni;
+		node_set_prior(ni, &map.prior[c]);
 	}
+	first_child[consider.moves].hints |= TREE_HINT_LAST;
 	u->expanded_nodes++;
-	node->children = first_child; // must be done at the end to avoid race
+	node_set_children(node, first_child); // must be done at the end to avoid race
+
+	if (t->tt)
+		tree_tt_insert(t->tt, tt_key, first_child);
+}
+
+/* Replace priors of expanded node's children with priors using dcnn output
+ * for this position (asynchronous leaf evaluation, see uct/leaf_dcnn.c).
+ * Children stats are left alone. Thread safe. */
+void
+tree_node_dcnn_priors(tree_t *t, tree_node_t *node, board_t *b, enum stone color, uct_t *u, int parity, float *dcnn)
+{
+	assert(dcnn);
+	move_stats_t map_prior[board_max_coords(b) + 1];      memset(map_prior, 0, sizeof(map_prior));
+	mq_t consider;  mq_init(&consider);
+	prior_map_t map = { b, color, tree_parity(t, parity), &map_prior[1], &consider, dcnn };
+
+	tree_expand_get_moves(&consider, b, color, u);
+	uct_prior(u, node, &map);
+
+	for (tree_node_t *ni = node_children(node); ni; ni = tree_node_sibling(ni))
+		node_set_prior(ni, &map.prior[node_coord(ni)]);
+	__sync_fetch_and_or(&node->hints, TREE_HINT_DCNN);
 }
 
 #define set_reason(val)		do {  if (reason) *reason = val;       } while(0)
 #define promote_fail(val)	do {  set_reason(val);  return false;  } while(0)
 
 /* Promotes the given node as the root of the tree.
- * May trigger tree garbage collection:
- * The node may be moved and some of its subtree may be pruned.
+ * Cheap, doesn't garbage collect the tree: caller should arrange for
+ * tree_garbage_collect() to be called when tree_gc_needed().
  * Returns true on success, false otherwise (@reason tells why) */
 bool
 tree_promote_node(tree_t *t, tree_node_t *node, board_t *b, enum promote_reason *reason)
 {
-	assert(node->parent == t->root);
+	assert(node_parent(node) == t->root || t->tt);  /* transpositions: any parent */
 	set_reason(PROMOTE_REASON_NONE);
 
 	if (t->untrustworthy_tree)
@@ -789,30 +1550,26 @@ tree_promote_node(tree_t *t, tree_node_t *node, board_t *b, enum promote_reason
 	if (using_dcnn(b) && !(node->hints & TREE_HINT_DCNN))
 		promote_fail(PROMOTE_DCNN_MISSING);
 	
-	node->parent = NULL;
-	node->sibling = NULL;
+	node_set_parent(node, NULL);
 
 	t->root = node;
 	t->root_color = stone_other(t->root_color);
-	
-	/* Garbage collect if we run out of memory, or it is cheap to do so now: */
-	if (tree_gc_needed(t) ||
-	    (t->nodes_size >= t->max_tree_size / 10 && node->u.playouts < SMALL_TREE_PLAYOUTS))
-		tree_garbage_collect(t);
 
 	t->avg_score.value = 0;
 	t->avg_score.playouts = 0;
 
-	/* If the tree deepest node was under node, or if we called tree_garbage_collect,
-	 * tree->max_depth is correct. Otherwise we could traverse the tree
-         * to recompute max_depth but it's not worth it: it's just for debugging
-	 * and soon the tree will grow and max_depth will become correct again. */
+	free(t->poscache_stored);
+	t->poscache_stored = NULL;
+
+	/* If the tree deepest node was under node, tree->max_depth is correct.
+	 * Otherwise we could traverse the tree to recompute max_depth but it's
+	 * not worth it: it's just for debugging and soon the tree will grow and
+	 * max_depth will become correct again (or at next tree gc). */
 	return true;
 }
 
 /* Promote node for given move as the root of the tree.
- * May trigger tree garbage collection:
- * The node may be moved and some of its subtree may be pruned.
+ * Cheap, doesn't garbage collect the tree (see tree_promote_node()).
  * Returns true on success, false otherwise (@reason tells why) */
 bool
 tree_promote_move(tree_t *t, move_t *m, board_t *b, enum promote_reason *reason)
@@ -19,6 +19,7 @@
 #include "move.h"
 #include "stats.h"
 #include "tactics/util.h"
+#include "random.h"
 
 typedef struct uct uct_t;
 
@@ -31,47 +32,81 @@ typedef struct uct uct_t;
  *            | node |
  *            +------+
  *          / <- parent
- * +------+   v- sibling +------+
- * | node | ------------ | node |
- * +------+              +------+
- *    | <- children          |
- * +------+   +------+   +------+   +------+
- * | node | - | node |   | node | - | node |
- * +------+   +------+   +------+   +------+
+ *    | <- children
+ * +------+------+------+------+
+ * | node | node | node | node |    children block (last one has TREE_HINT_LAST)
+ * +------+------+------+------+
+ *    | <- children        | <- children
+ * +------+------+      +------+------+------+
+ * | node | node |      | node | node | node |
+ * +------+------+      +------+------+------+
  */
 
-/* TODO: Performance would benefit from a reorganization:
- * (i) Allocate all children of a node within a single block.
- * (ii) Keep all u stats together, and all amaf stats together.
- * Currently, rave_update is top source of cache misses, and
- * there is large memory overhead for having all nodes separate. */
+/* All children of a node are allocated within a single block, so walking
+ * them (descent, rave update) streams through memory instead of chasing
+ * sibling pointers all over the tree. Without sibling pointer a node is
+ * 64 bytes, one cache line (default build).
+ * TODO: Keeping all u stats together and all amaf stats together (SoA)
+ * would help rave_update further but needs policies to be rewritten. */
+
+/* Compact tree (make COMPACT_TREE=1): 40 bytes nodes instead of 64, so
+ * same max_tree_size holds 1.6x more nodes (long thinking times).
+ * - parent / children are 32-bit offsets relative to the node itself
+ * - prior is 16-bit value + 16-bit playouts
+ * - winner_owner / black_owner are 16-bit averages (over u playouts)
+ * - no depth, only its parity (TREE_HINT_ODD)
+ * Use node_parent(), node_children(), node_prior() etc to access these. */
 
 typedef struct tree_node {
 #if DEBUG_TREE
 	hash_t hash;
 #endif
-	struct tree_node *parent, *sibling, *children;
+#ifdef COMPACT_TREE
+	int32_t parent, children;
+#else
+	struct tree_node *parent, *children;
+#endif
 
 	/*** From here on, struct is saved/loaded from opening tbook */
 
-	move_stats_t u;
-	move_stats_t prior;
+	node_stats_t u;
+#ifndef COMPACT_TREE
+	node_stats_t prior;
+#endif
 	/* XXX: Should be way for policies to add their own stats */
-	move_stats_t amaf;
+	node_stats_t amaf;
 #ifdef DISTRIBUTED
 	/* Stats before starting playout; used for distributed engine. */
-	move_stats_t pu;
+	node_stats_t pu;
 #endif
+#ifdef COMPACT_TREE
+	struct {
+		uint16_t value;	     // value * 65535
+		uint16_t playouts;
+	} prior;
+	/* Criticality information, value * 65535.
+	 * Both in one word so updates are a single CAS. */
+	union {
+		struct {
+			uint16_t winner_owner; // owner == winner
+			uint16_t black_owner; // owner == black
+		};
+		uint32_t owners;
+	};
+#else
 	/* Criticality information; information about final board owner
 	 * of the tree coordinate corresponding to the node */
-	move_stats_t winner_owner; // owner == winner
-	move_stats_t black_owner; // owner == black
+	node_stats_t winner_owner; // owner == winner
+	node_stats_t black_owner; // owner == black
+#endif
 
 	/* coord is usually coord_t, but this is very space-sensitive. */
 #define node_coord(n) ((int) (n)->coord)
 	short coord;
 
+#ifndef COMPACT_TREE
 	unsigned short depth; // just for statistics
+#endif
 
 	/* Number of parallel descents going through this node at the moment.
 	* Used for virtual loss computation. */
@@ -80,6 +115,10 @@ typedef struct tree_node {
 #define TREE_HINT_INVALID   1  // don't go to this node, invalid move
 #define TREE_HINT_DCNN      2  // node has dcnn priors
 #define TREE_HINT_SELFATARI 4  // move is selfatari
+#define TREE_HINT_LAST      8  // last node of children block
+#define TREE_HINT_COPIED   16  // tree copy: children block already copied (transpositions)
+#define TREE_HINT_DCNN_PENDING 32  // queued for dcnn evaluation (leaf_dcnn)
+#define TREE_HINT_ODD      64  // odd depth (compact tree)
 	unsigned char hints;
 
 	/* In case multiple threads walk the tree, is_expanded is set
@@ -92,6 +131,7 @@ typedef struct tree_node {
 } tree_node_t;
 
 struct tree_hash;
+struct tree_tt;
 
 typedef struct tree {
 	tree_node_t *root;
@@ -121,12 +161,25 @@ typedef struct tree {
 	int hbits;
 #endif
 
+	/* Transposition table (optional): maps positions to children blocks,
+	 * so that transpositions share the same subtree. The tree becomes a
+	 * DAG then, nodes can have several parents (node->parent is just one
+	 * of them). */
+	struct tree_tt *tt;
+
+	/* Root children stats already saved in position cache, indexed by
+	 * coord + 1 (pass) (see poscache_store()). Follows tree content on copy / snapshot,
+	 * dropped when root changes. NULL if nothing saved yet. */
+	move_stats_t *poscache_stored;
+
 	// Statistics
 	int max_depth;
-	volatile size_t nodes_size; // byte size of all allocated nodes
+	volatile size_t nodes_size; // byte size of all allocated nodes (and thread chunks)
 	                            // beware failed allocs still bump nodes_size
+	unsigned int alloc_gen;     // allocation generation, see tree_alloc_node_chunk()
 	size_t max_tree_size; // maximum byte size for entire tree
 	void *nodes; // nodes buffer
+	bool nodes_mapped; // nodes buffer mmap()ed (see tree_mem_setup())
 } tree_t;
 
 /* Tree garbage collection:
@@ -137,17 +190,36 @@ typedef struct tree {
 					 (t)->max_tree_size * 20 / 100)
 #define tree_gc_threshold(t)		((t)->max_tree_size * 10 / 100)
 #define tree_gc_needed(t)		((t)->nodes_size >= tree_gc_threshold((t)))
+/* Tree almost full, can't wait for background gc before searching. */
+#define tree_gc_urgent(t)		((t)->nodes_size >= (t)->max_tree_size / 2)
+
+/* Tree memory: hugepages, numa placement, prefaulting (linux only) */
+enum tree_hugepages {
+	TREE_HUGEPAGES_NONE,
+	TREE_HUGEPAGES_THP,		/* madvise(MADV_HUGEPAGE) */
+	TREE_HUGEPAGES_HUGETLB,		/* MAP_HUGETLB, falls back to thp */
+};
+#define TREE_NUMA_DEFAULT	-1	/* first touch */
+#define TREE_NUMA_INTERLEAVE	-2	/* interleave over all nodes, or node number */
+void tree_mem_setup(enum tree_hugepages hugepages, int numa, bool prefault);
+void tree_mem_prealloc(size_t max_tree_size, int threads);
+void tree_mem_log(void);
 
 /* Warning: all functions below except tree_expand_node & tree_leaf_node are THREAD-UNSAFE! */
 tree_t *tree_init(enum stone color, size_t max_tree_size, int hbits);
 void tree_done(tree_t *tree);
+void tree_transpositions_init(tree_t *t);
+int  tree_tt_check(tree_t *t, board_t *b, int depth);
 void tree_dump(tree_t *tree, double thres);
 size_t tree_actual_size(tree_t *t);
+char *tree_book_name(board_t *b);
 void tree_save(tree_t *tree, board_t *b, int thres);
 void tree_load(tree_t *tree, board_t *b);
 void tree_copy(tree_t *dst, tree_t *src);
 void tree_replace(tree_t *tree, tree_t *content);
 int  tree_realloc(tree_t *t, size_t max_tree_size);
+tree_t *tree_snapshot(tree_t *src, size_t max_size, int threshold, int depth);
+bool tree_restore(tree_t *t, tree_t *snapshot);
 
 enum promote_reason {
 	PROMOTE_REASON_NONE,
@@ -161,12 +233,20 @@ tree_node_t *tree_get_node(tree_node_t *parent, coord_t c);
 void tree_garbage_collect(tree_t *tree);
 
 void tree_expand_node(tree_t *tree, tree_node_t *node, board_t *b, enum stone color, uct_t *u, int parity);
+void tree_expand_node_dcnn(tree_t *tree, tree_node_t *node, board_t *b, enum stone color, uct_t *u, int parity, float *dcnn);
+void tree_node_dcnn_priors(tree_t *tree, tree_node_t *node, board_t *b, enum stone color, uct_t *u, int parity, float *dcnn);
 
 static bool tree_leaf_node(tree_node_t *node);
 
 
+#ifdef COMPACT_TREE
+#define tree_node_odd(node)	(!!((node)->hints & TREE_HINT_ODD))
+#else
+#define tree_node_odd(node)	((node)->depth & 1)
+#endif
+
 #define tree_node_parity(tree, node) \
-	((((node)->depth ^ (tree)->root->depth) & 1) ? -1 : 1)
+	(((tree_node_odd(node) ^ tree_node_odd((tree)->root)) & 1) ? -1 : 1)
 
 /* Get black parity from parity within the tree. */
 #define tree_parity(tree, parity) \
@@ -183,12 +263,113 @@ static bool tree_leaf_node(tree_node_t *node);
 #endif
 
 
+/* Next child in parent's children block, NULL if last one. */
+#define tree_node_sibling(n)	(((n)->hints & TREE_HINT_LAST) ? NULL : (n) + 1)
+
+#ifdef COMPACT_TREE
+
+static inline tree_node_t *
+node_link(tree_node_t *n, int32_t offset)
+{
+	return (offset ? n + offset : NULL);
+}
+
+/* Nodes within a tree buffer are at multiples of node size, see tree_chunk_size() */
+static inline int32_t
+node_offset(tree_node_t *n, tree_node_t *to)
+{
+	return (to ? (int32_t)(to - n) : 0);
+}
+
+#define node_parent(n)		node_link((n), (n)->parent)
+#define node_children(n)	node_link((n), (n)->children)
+#define node_set_parent(n, p)	((n)->parent   = node_offset((n), (p)))
+#define node_set_children(n, c)	((n)->children = node_offset((n), (c)))
+
+static inline move_stats_t
+node_prior(tree_node_t *n)
+{
+	move_stats_t s = move_stats((floating_t)n->prior.value / 65535, n->prior.playouts);
+	return s;
+}
+
+static inline void
+node_set_prior(tree_node_t *n, move_stats_t *s)
+{
+	floating_t value = MIN(MAX(s->value, 0), 1);
+	n->prior.value = value * 65535 + 0.5;
+	n->prior.playouts = MIN(MAX(s->playouts, 0), 65535);
+}
+
+/* Quantized running average over u playouts, integer only. Rounding is
+ * randomized so small updates don't get lost once there are many playouts. */
+static inline int
+node_owner_step(int owner, int target, int playouts)
+{
+	int diff = target - owner;
+	int d = diff / playouts, rem = diff % playouts;
+	if (rem && (int)fast_random(playouts) < abs(rem))
+		d += (rem > 0 ? 1 : -1);
+	return owner + d;	/* Between owner and target */
+}
+
+/* Record final owner of node's coord (call before updating u stats) */
+static inline void
+tree_node_add_owner(tree_node_t *n, floating_t winner_owner, floating_t black_owner)
+{
+	int winner = winner_owner * 65535 + 0.5;
+	int black = black_owner * 65535 + 0.5;
+	union {  struct {  uint16_t winner, black;  };  uint32_t w;  } old, new;
+	do {
+		old.w = *(volatile uint32_t*)&n->owners;
+		int playouts = n->u.playouts + 1;
+		new.winner = node_owner_step(old.winner, winner, playouts);
+		new.black  = node_owner_step(old.black, black, playouts);
+	} while (!__sync_bool_compare_and_swap(&n->owners, old.w, new.w));
+}
+
+static inline floating_t
+tree_node_criticality(tree_node_t *node)
+{
+	move_stats_t u = node_stats_get(&node->u);
+	move_stats_t winner_owner = move_stats((floating_t)node->winner_owner / 65535, u.playouts);
+	move_stats_t black_owner = move_stats((floating_t)node->black_owner / 65535, u.playouts);
+	return point_criticality(&u, &winner_owner, &black_owner);
+}
+
+#else /* !COMPACT_TREE */
+
+#define node_parent(n)		((n)->parent)
+#define node_children(n)	((n)->children)
+#define node_set_parent(n, p)	((n)->parent = (p))
+#define node_set_children(n, c)	((n)->children = (c))
+
+#define node_prior(n)		(node_stats_get(&(n)->prior))
+#define node_set_prior(n, s)	(node_stats_set(&(n)->prior, (s)))
+
+/* Record final owner of node's coord */
+static inline void
+tree_node_add_owner(tree_node_t *n, floating_t winner_owner, floating_t black_owner)
+{
+	node_stats_add_result(&n->winner_owner, winner_owner, 1);
+	node_stats_add_result(&n->black_owner, black_owner, 1);
+}
+
+static inline floating_t
+tree_node_criticality(tree_node_t *node)
+{
+	move_stats_t u = node_stats_get(&node->u);
+	move_stats_t winner_owner = node_stats_get(&node->winner_owner);
+	move_stats_t black_owner = node_stats_get(&node->black_owner);
+	return point_criticality(&u, &winner_owner, &black_owner);
+}
+
+#endif /* COMPACT_TREE */
+
 static inline bool
 tree_leaf_node(tree_node_t *node)
 {
 	return !(node->children);
 }
 
-#define tree_node_criticality(node)	(point_criticality(&(node)->u, &(node)->winner_owner, &(node)->black_owner))
-
 #endif
@@ -0,0 +1,132 @@
+#define DEBUG
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "board.h"
+#include "debug.h"
+#include "uct/tree.h"
+#include "uct/treecache.h"
+
+/* Only accessed with search stopped: main thread, or gc_thread() /
+ * thread_manager() for genmove snapshots (see uct_treecache_flush()). */
+
+#define TREECACHE_ENTRIES	64
+
+/* Snapshots: each gets at most 1/4 of budget. Copy root children and
+ * their children, deeper nodes only if they have enough playouts. */
+#define TREECACHE_MIN_PLAYOUTS	100
+#define TREECACHE_DEPTH		2
+#define TREECACHE_THRESHOLD	10
+
+typedef struct {
+	hash_t key;		/* 0 = empty */
+	tree_t *t;
+	unsigned int stamp;
+} treecache_entry_t;
+
+static treecache_entry_t entries[TREECACHE_ENTRIES];
+static size_t budget = 0, used = 0;
+static unsigned int lru_clock = 0;
+
+/* Same position: board, color to play, ko, komi, also move number and
+ * last move so restored tree root is consistent with board. */
+static hash_t
+treecache_key(board_t *b, enum stone color)
+{
+	hash_t key = b->hash ^ ((hash_t)b->moves * 0x9e3779b97f4a7c15ULL);
+	key ^= ((hash_t)(int)(b->komi * 2) << 16 | board_rsize(b)) * 0xbf58476d1ce4e5b9ULL;
+	key ^= (hash_t)(last_move(b).coord + 1) * 0x94d049bb133111ebULL;
+	if (color == S_WHITE)
+		key = ~key;
+	if (!is_pass(b->ko.coord))
+		key ^= hash_at(b->ko.coord, b->ko.color) * 3;
+	return (key ? key : 1);
+}
+
+static void
+treecache_evict(treecache_entry_t *e)
+{
+	used -= e->t->max_tree_size;
+	tree_done(e->t);
+	memset(e, 0, sizeof(*e));
+}
+
+static treecache_entry_t *treecache_find(hash_t key);
+
+/* Evict least recently used entries until @size fits
+ * and there's a free slot. */
+static void
+treecache_make_room(size_t size)
+{
+	while (used && (used + size > budget || !treecache_find(0))) {
+		treecache_entry_t *lru = NULL;
+		for (int i = 0; i < TREECACHE_ENTRIES; i++)
+			if (entries[i].key && (!lru || entries[i].stamp < lru->stamp))
+				lru = &entries[i];
+		treecache_evict(lru);
+	}
+}
+
+static treecache_entry_t *
+treecache_find(hash_t key)
+{
+	for (int i = 0; i < TREECACHE_ENTRIES; i++)
+		if (entries[i].key == key)
+			return &entries[i];
+	return NULL;
+}
+
+void
+treecache_init(size_t size)
+{
+	budget = size;
+	treecache_make_room(0);
+}
+
+void
+treecache_save(tree_t *t, board_t *b, enum stone color)
+{
+	if (!budget || t->untrustworthy_tree || t->root->u.playouts < TREECACHE_MIN_PLAYOUTS)
+		return;
+	assert(t->root_color == stone_other(color));
+
+	hash_t key = treecache_key(b, color);
+	treecache_entry_t *e = treecache_find(key);
+	if (e)  treecache_evict(e);
+
+	tree_t *snapshot = tree_snapshot(t, budget / 4, TREECACHE_THRESHOLD, TREECACHE_DEPTH);
+	if (!snapshot)  return;
+
+	treecache_make_room(snapshot->max_tree_size);
+	e = treecache_find(0);  assert(e);
+	e->key = key;
+	e->t = snapshot;
+	e->stamp = ++lru_clock;
+	used += snapshot->max_tree_size;
+
+	if (DEBUGL(3))
+		fprintf(stderr, "tree cache: saved %i playouts tree (%.1f Mb), %.1f / %.1f Mb used\n",
+			snapshot->root->u.playouts, (float)snapshot->max_tree_size / (1024 * 1024),
+			(float)used / (1024 * 1024), (float)budget / (1024 * 1024));
+}
+
+bool
+treecache_restore(tree_t *t, board_t *b, enum stone color)
+{
+	if (!budget)  return false;
+
+	treecache_entry_t *e = treecache_find(treecache_key(b, color));
+	if (!e || e->t->root->u.playouts <= t->root->u.playouts)
+		return false;
+	assert(e->t->root_color == stone_other(color));
+
+	e->stamp = ++lru_clock;
+	if (!tree_restore(t, e->t))
+		return false;
+
+	if (DEBUGL(2))
+		fprintf(stderr, "tree cache: resuming from cached tree (%i playouts)\n", t->root->u.playouts);
+	return true;
+}
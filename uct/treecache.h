@@ -0,0 +1,26 @@
+#ifndef PACHI_UCT_TREECACHE_H
+#define PACHI_UCT_TREECACHE_H
+
+/* Search tree cache.
+ * Keeps snapshots of recently searched trees (top levels) keyed by
+ * position, within a memory budget. When a frontend steps back and forth
+ * through a game (undo, loadsgf, analysis ...) the engine gets reset and
+ * its tree thrown away; going back to a known position resumes from the
+ * cached tree instead of starting from scratch.
+ * Cache outlives engine resets, it's only cleared when disabled. */
+
+#include "board.h"
+
+typedef struct tree tree_t;
+
+/* Set memory budget (bytes), 0 disables cache. */
+void treecache_init(size_t budget);
+
+/* Save snapshot of search tree @t for position @b, @color to play. */
+void treecache_save(tree_t *t, board_t *b, enum stone color);
+
+/* Replace @t content with cached tree for position @b, @color to play
+ * if it has more playouts. Returns true if tree was restored. */
+bool treecache_restore(tree_t *t, board_t *b, enum stone color);
+
+#endif
@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <ctype.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -21,6 +22,7 @@
 #include "playout/light.h"
 #include "tactics/util.h"
 #include "timeinfo.h"
+#include "topology.h"
 #include "uct/prior.h"
 #include "uct/plugins.h"
 #include "uct/internal.h"
@@ -30,6 +32,8 @@
 #include "uct/policy.h"
 #include "uct/uct.h"
 #include "uct/walk.h"
+#include "uct/poscache.h"
+#include "uct/treecache.h"
 #include "dcnn/dcnn.h"
 #include "josekifix/joseki_override.h"
 
@@ -57,6 +61,8 @@ setup_state(uct_t *u, board_t *b, enum stone color)
 	if (DEBUGL(3)) fprintf(stderr, "allocating %i Mb for search tree\n", (int)(size / (1024*1024)));
 	uct_main_board = b;
 	u->t = tree_init(color, size, stats_hbits(u));
+	if (u->transpositions)
+		tree_transpositions_init(u->t);
 	if (u->initial_extra_komi)
 		u->t->extra_komi = u->initial_extra_komi;
 	if (u->force_seed)
@@ -77,7 +83,9 @@ reset_state(uct_t *u)
 {
 	if (UDEBUGL(3)) fprintf(stderr, "resetting tree\n");
 	assert(u->t);
-	tree_done(u->t);
+	uct_tree_gc_wait(u);
+	if (u->t != u->treecache_t)	/* else freed after snapshot */
+		tree_done(u->t);
 	u->t = NULL;
 	uct_main_board = NULL;
 }
@@ -96,6 +104,10 @@ setup_dynkomi(uct_t *u, board_t *b, enum stone to_play)
 static void
 uct_prepare_move(uct_t *u, board_t *b, enum stone color)
 {
+	uct_tree_gc_wait(u);
+	if (!pondering(u))	/* else thread_manager() does it */
+		uct_treecache_flush(u);
+
 	/* Discard tree that can't be reused. */
 	if (u->t) {
 		/* Switching color to play ? Can't reuse tree of wrong color. */
@@ -114,6 +126,11 @@ uct_prepare_move(uct_t *u, board_t *b, enum stone color)
 #ifdef DISTRIBUTED
 		uct_htable_reset(u->t);
 #endif
+		/* Tree gc normally happens in the background after our move
+		 * (or when pondering starts), but can't search if tree is
+		 * almost full. */
+		if (!pondering(u) && tree_gc_urgent(u->t))
+			tree_garbage_collect(u->t);
 	} else  /* We need fresh state. */
 		setup_state(u, b, color);
 	ownermap_init(&u->initial_ownermap);
@@ -411,13 +428,14 @@ uct_result(engine_t *e, board_t *b)
 	uct_t *u = (uct_t*)e->data;
 	static char reply[1024];
 
+	uct_tree_gc_wait(u);
 	if (!u->t)
 		return NULL;
 	enum stone color = u->t->root_color;
 	tree_node_t *n = u->t->root;
 	snprintf(reply, 1024, "%s %s %d %.2f %.1f",
 		 stone2str(color), coord2sstr(node_coord(n)),
-		 n->u.playouts, tree_node_get_value(u->t, -1, n->u.value),
+		 n->u.playouts, tree_node_get_value(u->t, -1, node_stats_value(&n->u)),
 		 u->t->use_extra_komi ? u->t->extra_komi : 0);
 	return reply;
 }
@@ -427,11 +445,12 @@ uct_chat(engine_t *e, board_t *b, bool opponent, char *from, char *cmd)
 {
 	uct_t *u = (uct_t*)e->data;
 
+	uct_tree_gc_wait(u);
 	if (!u->t)
 		return generic_chat(b, opponent, from, cmd, S_NONE, pass, 0, 1, u->threads, 0.0, 0.0, "");
 
 	tree_node_t *n = u->t->root;
-	double winrate = tree_node_get_value(u->t, -1, n->u.value);
+	double winrate = tree_node_get_value(u->t, -1, node_stats_value(&n->u));
 	double extra_komi = u->t->use_extra_komi && fabs(u->t->extra_komi) >= 0.5 ? u->t->extra_komi : 0;
 	char *score_est = ownermap_score_est_str(b, &u->ownermap);
 
@@ -487,11 +506,14 @@ uct_done(engine_t *e)
 
 	uct_pondering_stop(u);
 	if (u->t)             reset_state(u);
+	uct_treecache_flush(u);
 	if (u->dynkomi)       u->dynkomi->done(u->dynkomi);
 	if (u->policy)        u->policy->done(u->policy);
 	if (u->random_policy) u->random_policy->done(u->random_policy);
 	playout_policy_done(u->playout);
 	uct_prior_done(u->prior);
+	if (u->poscache)      poscache_done(u->poscache);
+	free(u->poscache_file);
 #ifdef PACHI_PLUGINS
 	pluginset_done(u->plugins);
 #endif
@@ -544,6 +566,7 @@ static int
 uct_search(uct_t *u, board_t *b, time_info_t *ti, enum stone color, tree_t *t, bool print_progress)
 {
 	uct_search_state_t s;
+	uct_treecache_flush(u);		/* Tree may get gc'ed / realloc'ed */
 	uct_search_start(u, b, color, t, ti, &s, 0);
 	if (UDEBUGL(2) && s.base_playouts > 0)
 		fprintf(stderr, "<pre-simulated %d games>\n", s.base_playouts);
@@ -580,6 +603,8 @@ uct_search(uct_t *u, board_t *b, time_info_t *ti, enum stone color, tree_t *t, b
 	}
 
 	uct_thread_ctx_t *ctx = uct_search_stop();
+	if (u->poscache)
+		poscache_store(u->poscache, b, color, t);
 	if (UDEBUGL(3)) {
 		tree_dump(t, u->dumpthres);
 		fprintf(stderr, "expanded nodes: %i\n", u->expanded_nodes);
@@ -689,6 +714,9 @@ uct_pondering_start(uct_t *u, board_t *main_board, enum stone color, coord_t our
 	}
 
 	uct_prepare_move(u, b, color);  /* Always clear ownermap */
+	/* Not while genmove snapshot is pending, needs tree nodes. */
+	if (u->tree_cache_size && !u->treecache_t)
+		treecache_restore(u->t, b, color);
 	
 	setup_dynkomi(u, b, color);
 
@@ -702,6 +730,7 @@ uct_pondering_start(uct_t *u, board_t *main_board, enum stone color, coord_t our
 void
 uct_pondering_stop(uct_t *u)
 {
+	uct_tree_gc_wait(u);
 	if (!thread_manager_running)
 		return;
 
@@ -710,9 +739,15 @@ uct_pondering_stop(uct_t *u)
 	if (!pondering(u)) {  uct_search_stop();  return;  }
 
 	/* Stop the thread manager. */
+	bool genmove_pondering = genmove_pondering(u);
 	uct_thread_ctx_t *ctx = uct_search_stop();  /* clears search flags */
 	
 	if (UDEBUGL(1))  uct_progress_status(u, ctx->t, ctx->b, ctx->color, 0, NULL);
+	/* Analysis: save tree. Not after genmove pondering, we're on next
+	 * genmove critical path (opponent to play positions, undo usually
+	 * goes back to our positions anyway). */
+	if (u->tree_cache_size && !genmove_pondering)
+		treecache_save(ctx->t, ctx->b, ctx->color);
 
 	free(ctx->b);
 	u->reporting = u->reporting_opt;
@@ -732,6 +767,8 @@ uct_genmove_setup(uct_t *u, board_t *b, enum stone color)
 	}
 
 	uct_prepare_move(u, b, color);
+	if (u->tree_cache_size)
+		treecache_restore(u->t, b, color);
 
 	assert(u->t);
 	u->my_color = color;
@@ -770,6 +807,9 @@ genmove(engine_t *e, board_t *b, time_info_t *ti, enum stone color, bool pass_al
         /* Start the Monte Carlo Tree Search! */
 	int base_playouts = u->t->root->u.playouts;
 	int played_games = uct_search(u, b, ti, color, u->t, false);
+	/* Snapshot taken after the move is sent. */
+	if (u->tree_cache_size)
+		uct_treecache_pending(u, b, color);
 
 	tree_node_t *best;
 	best = uct_search_result(u, b, color, u->pass_all_alive, played_games, base_playouts, best_coord);
@@ -804,6 +844,7 @@ uct_genmove(engine_t *e, board_t *b, time_info_t *ti, enum stone color, bool pas
 		if (is_pass(best))
 			u->initial_extra_komi = u->t->extra_komi;
 		reset_state(u);
+		uct_tree_gc_start(u);	/* Tree cache snapshot */
 		return best;
 	}
 
@@ -820,8 +861,11 @@ uct_genmove(engine_t *e, board_t *b, time_info_t *ti, enum stone color, bool pas
 		reset_state(u);
 	}
 
+	/* Garbage collect tree while opponent is thinking. */
 	if (u->pondering_opt)
 		uct_genmove_pondering_start(u, b, color, best);
+	else
+		uct_tree_gc_start(u);
 	return best;
 }
 
@@ -910,14 +954,14 @@ uct_get_rave_best_moves(uct_t *u, best_moves_t *best, bool winrates, int min_pla
 	best->d = (void**)best_n;
 
 	/* Find RAVE best moves */
-	for (tree_node_t *n = u->t->root->children; n; n = n->sibling)
+	for (tree_node_t *n = node_children(u->t->root); n; n = tree_node_sibling(n))
 		if (n->amaf.playouts >= min_playouts)
 			best_moves_add_full(best, node_coord(n), n->amaf.playouts, n);
 
 	if (winrates)  /* Get RAVE winrates */
 		for (int i = 0; i < best->n; i++) {
 			tree_node_t *n = best->d[i];
-			best->r[i] = tree_node_get_value(u->t, 1, n->amaf.value);
+			best->r[i] = tree_node_get_value(u->t, 1, node_stats_value(&n->amaf));
 		}
 }
 
@@ -932,14 +976,14 @@ uct_get_best_moves_at(uct_t *u, tree_node_t *parent, best_moves_t *best,
 	best->d = (void**)best_n;
 	
 	/* Find best moves */
-	for (tree_node_t *n = parent->children; n; n = n->sibling)
+	for (tree_node_t *n = node_children(parent); n; n = tree_node_sibling(n))
 		if (n->u.playouts >= min_playouts)
 			best_moves_add_full(best, node_coord(n), n->u.playouts, n);
 
 	if (winrates)  /* Get winrates */
 		for (int i = 0; i < best->n; i++) {
 			tree_node_t *n = best->d[i];
-			best->r[i] = tree_node_get_value(u->t, 1, n->u.value);
+			best->r[i] = tree_node_get_value(u->t, 1, node_stats_value(&n->u));
 		}
 }
 
@@ -1023,7 +1067,7 @@ uct_evaluate_one(engine_t *e, board_t *b, time_info_t *ti, coord_t c, enum stone
 	if (!best) {
 		bestval = NAN; // the opponent has no reply!
 	} else {
-		bestval = tree_node_get_value(u->t, 1, best->u.value);
+		bestval = tree_node_get_value(u->t, 1, node_stats_value(&best->u));
 	}
 
 	reset_state(u); // clean our junk
@@ -1169,6 +1213,19 @@ uct_setoption(engine_t *e, board_t *b, const char *optname, char *optval,
 		/* Disable UCT opening tbook. */
 		u->no_tbook = true;
 	}
+	else if (!strcasecmp(optname, "poscache") && optval) {  NEED_RESET
+		/* Persistent position cache file: root moves stats are saved
+		 * after each search and used as priors when the same position
+		 * comes up again, in this game or a later one. File can be
+		 * shared by several instances. See also "poscache_size". */
+		free(u->poscache_file);
+		u->poscache_file = strdup(optval);
+	}
+	else if (!strcasecmp(optname, "poscache_size") && optval) {  NEED_RESET
+		/* Position cache size [MiB], least recently stored positions
+		 * are evicted when full. Default: 64 */
+		u->poscache_size = (size_t)atoll(optval) * 1048576;
+	}
 	else if (!strcasecmp(optname, "pass_all_alive")) {
 		/* Whether to consider passing only after all
 		 * dead groups were removed from the board;
@@ -1313,6 +1370,18 @@ uct_setoption(engine_t *e, board_t *b, const char *optname, char *optval,
 		/* Default: 1 thread per core. */
 		u->threads = atoi(optval);
 	}
+	else if (!strcasecmp(optname, "topology") && optval) {
+		/* Pin threads to cpus by role (linux only), see topology.h:
+		 * "cores" spreads search workers over physical cores first,
+		 * "split[=N]" dedicates N cores to dcnn evaluation, or give
+		 * explicit cpu sets ("search=0-7+16-23:dcnn=8-15"). */
+		if (!topology_setup(optval))
+			option_error("UCT: Invalid topology %s\n", optval);
+	}
+	else if (!strcasecmp(optname, "pin_threads")) {
+		/* Pin search workers to physical cores, same as topology=cores */
+		topology_setup((!optval || atoi(optval)) ? "cores" : "");
+	}
 	else if (!strcasecmp(optname, "thread_model") && optval) {
 		if (!strcasecmp(optval, "tree")) {
 			/* Tree parallelization - all threads
@@ -1372,6 +1441,53 @@ uct_setoption(engine_t *e, board_t *b, const char *optname, char *optval,
 		 * limit global memory usage instead. */
 		u->max_tree_size_opt = (size_t)atoll(optval) * 1048576;  /* long is 4 bytes on windows! */
 	}
+	else if (!strcasecmp(optname, "transpositions")) {  NEED_RESET
+		/* Share subtrees between nodes reaching the same position
+		 * through different move orders (tree becomes a DAG).
+		 * Saves memory in long searches where trees fill up with
+		 * duplicate subtrees. Not supported in distributed mode. */
+		u->transpositions = !optval || atoi(optval);
+	}
+	else if (!strcasecmp(optname, "tree_hugepages")) {  NEED_RESET
+		/* Back tree memory with huge pages (linux only), fewer tlb
+		 * misses when walking large trees. "tree_hugepages" uses
+		 * transparent hugepages, "tree_hugepages=hugetlb" reserved
+		 * hugetlb pages (falls back to transparent hugepages). */
+		if (!optval || !strcasecmp(optval, "thp") || !strcmp(optval, "1"))
+			u->tree_hugepages = TREE_HUGEPAGES_THP;
+		else if (!strcasecmp(optval, "hugetlb"))
+			u->tree_hugepages = TREE_HUGEPAGES_HUGETLB;
+		else if (!strcmp(optval, "0"))
+			u->tree_hugepages = TREE_HUGEPAGES_NONE;
+		else
+			option_error("UCT: Invalid tree_hugepages value %s\n", optval);
+	}
+	else if (!strcasecmp(optname, "tree_numa") && optval) {  NEED_RESET
+		/* Numa placement of tree memory (linux only):
+		 * "interleave" spreads pages over all memory nodes,
+		 * a node number keeps the tree on that node (run pachi on
+		 * that socket then, see numactl). */
+		if (!strcasecmp(optval, "interleave"))
+			u->tree_numa = TREE_NUMA_INTERLEAVE;
+		else if (isdigit(*optval) && atoi(optval) < 64)
+			u->tree_numa = atoi(optval);
+		else
+			option_error("UCT: Invalid tree_numa value %s\n", optval);
+	}
+	else if (!strcasecmp(optname, "tree_prefault")) {  NEED_RESET
+		/* Touch all tree memory at startup (linux only), so first
+		 * search doesn't page fault its way through the buffer.
+		 * Startup is slower and memory is committed upfront. */
+		u->tree_prefault = !optval || atoi(optval);
+	}
+	else if (!strcasecmp(optname, "tree_cache") && optval) {  NEED_RESET
+		/* Keep snapshots of recently searched trees, up to that
+		 * many MiB, and resume from them when going back to a known
+		 * position (undo, stepping through a game in analysis
+		 * frontends ...). Cache survives engine resets.
+		 * Not with transpositions. Default: off */
+		u->tree_cache_size = (size_t)atoll(optval) * 1048576;
+	}
 	else if (!strcasecmp(optname, "reset_tree")) {
 		/* Reset tree before each genmove ?
 		 * Default is to reuse previous tree when not using dcnn. 
@@ -1407,6 +1523,18 @@ uct_setoption(engine_t *e, board_t *b, const char *optname, char *optval,
 		size_t n = u->dcnn_pondering_mcts = atoi(optval);
 		assert(n <= sizeof(u->dcnn_pondering_mcts_c) / sizeof(u->dcnn_pondering_mcts_c[0]));
 	}
+	else if (!strcasecmp(optname, "leaf_dcnn") && optval) {
+		/* Dcnn priors for tree nodes, not just root:
+		 * Nodes reaching that many playouts get queued for dcnn
+		 * evaluation, a separate thread evaluates them in batches
+		 * and replaces their children priors while search goes on.
+		 * Worth it if dcnn evaluation is fast compared to playouts
+		 * rate (gpu, small board). Default is 0 (off). */
+#ifndef DCNN
+		option_error("UCT: %s requires dcnn support\n", optname);
+#endif
+		u->leaf_dcnn = atoi(optval);
+	}
 
 	/** Time control */
 
@@ -1651,6 +1779,8 @@ uct_state_init(engine_t *e, board_t *b)
 	u->auto_alloc = true;
 	u->tree_size = uct_default_tree_size();
 	u->max_tree_size_opt = 0;   /* unlimited */
+	u->tree_numa = TREE_NUMA_DEFAULT;
+	u->poscache_size = 64 * 1048576;
 	u->genmove_reset_tree = false;
 
 	u->threads = get_nprocessors();
@@ -1701,16 +1831,40 @@ uct_state_init(engine_t *e, board_t *b)
 	if (!!u->random_policy_chance ^ !!u->random_policy)
 		die("uct: Only one of random_policy and random_policy_chance is set\n");
 
-	uct_tree_size_init(u, u->tree_size);
+	if (u->tree_cache_size && u->transpositions) {
+		warning("uct: tree_cache doesn't work with transpositions, disabled.\n");
+		u->tree_cache_size = 0;
+	}
 
-	dcnn_set_threads(u->threads);
+	uct_tree_size_init(u, u->tree_size);
+	tree_mem_setup(u->tree_hugepages, u->tree_numa, u->tree_prefault);
+	treecache_init(u->tree_cache_size);
+
+	/* Split topology: dcnn gets its own cores, search threads default
+	 * to the remaining ones. */
+	if (topology_cpus(TOPO_DCNN)) {
+		if (u->threads == get_nprocessors() && topology_cpus(TOPO_SEARCH))
+			u->threads = topology_cpus(TOPO_SEARCH);
+		dcnn_set_threads(topology_cpus(TOPO_DCNN));
+	} else
+		dcnn_set_threads(u->threads);
 	dcnn_init(b);
 	if (!using_dcnn(b))		joseki_load(board_rsize(b));
+	if (u->leaf_dcnn && !using_dcnn(b)) {
+		warning("uct: dcnn not in use, leaf_dcnn disabled.\n");
+		u->leaf_dcnn = 0;
+	}
 	if (!pat_setup)			patterns_init(&u->pc, NULL, false, true);
 	log_nthreads(u);
+	topology_log();
+	tree_mem_log();
+	tree_mem_prealloc(u->tree_size, u->threads);
 	if (!u->prior)			u->prior = uct_prior_init(NULL, b, u);
+	if (u->poscache_file)		u->poscache = poscache_init(u->poscache_file, u->poscache_size);
 	if (!u->playout)		u->playout = playout_moggy_init(NULL, b);
 #ifdef DISTRIBUTED
+	if (u->slave && u->transpositions)
+		die("uct: transpositions not supported in distributed mode\n");
 	if (u->slave)			uct_slave_init(u, b);
 #endif
 	if (!u->dynkomi)		u->dynkomi = uct_dynkomi_init_linear(u, NULL, b);
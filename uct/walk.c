@@ -22,6 +22,7 @@
 #include "uct/walk.h"
 #include "uct/prior.h"
 #include "uct/policy.h"
+#include "uct/leaf_dcnn.h"
 #include "gogui.h"
 
 
@@ -41,7 +42,7 @@ uct_progress_text(FILE *fh, uct_t *u, tree_t *t, board_t *b, enum stone color, i
 		return;
 	}
 	fprintf(fh, "[%d] ", playouts);
-	fprintf(fh, "best %.1f%% ", 100 * tree_node_get_value(t, parity, best->u.value));
+	fprintf(fh, "best %.1f%% ", 100 * tree_node_get_value(t, parity, node_stats_value(&best->u)));
 
 	/* Dynamic komi */
 	if (want_dynkomi && t->use_extra_komi)
@@ -224,30 +225,31 @@ uct_progress_gogui_rave_amaf_criticality(uct_t *u, tree_t *t, board_t *b, enum s
 {
 	/* Find rave max playouts */
 	int max_playouts = 0;
-	for (tree_node_t *n = u->t->root->children; n; n = n->sibling)
+	for (tree_node_t *n = node_children(u->t->root); n; n = tree_node_sibling(n))
 		if (!is_pass(node_coord(n)))
 			max_playouts = MAX(max_playouts, n->amaf.playouts);
 
 	/* Get average winrate */
-	float winrate = tree_node_get_value(u->t, 1, u->t->root->u.value);
+	float winrate = tree_node_get_value(u->t, 1, node_stats_value(&u->t->root->u));
 
 	/* Compute rave ratings				(same logic as gogui rave criticality	*/
 	float ratings[BOARD_MAX_COORDS];	/*	 but with real rave data)		*/
 	memset(ratings, 0, sizeof(ratings));
 
 	float bottom_moves_filter = gogui_get_rave_amaf_criticality_filter();
-	for (tree_node_t *n = u->t->root->children; n; n = n->sibling)
+	for (tree_node_t *n = node_children(u->t->root); n; n = tree_node_sibling(n))
 		if (!is_pass(node_coord(n)) &&
 		    n->amaf.playouts >= max_playouts * bottom_moves_filter) {
 			/* rating = rave winrate - average winrate */
-			ratings[node_coord(n)] = tree_node_get_value(u->t, 1, n->amaf.value) - winrate;
+			ratings[node_coord(n)] = tree_node_get_value(u->t, 1, node_stats_value(&n->amaf)) - winrate;
 		}
 
 	/* Colormap */
 	gogui_signed_colormap_linear(stderr, b, ratings);
 
 	/* Status bar */
-	gogui_criticality_text_display(stderr, b, pass, ratings, &u->t->root->u);
+	move_stats_t root_stats = node_stats_get(&u->t->root->u);
+	gogui_criticality_text_display(stderr, b, pass, ratings, &root_stats);
 }
 
 static void
@@ -255,11 +257,12 @@ uct_progress_gogui_rave_playouts(uct_t *u, tree_t *t, board_t *b, enum stone col
 {
 	float amaf_playouts[BOARD_MAX_COORDS] = { 0, };
 
-	for (tree_node_t *n = u->t->root->children; n; n = n->sibling)
+	for (tree_node_t *n = node_children(u->t->root); n; n = tree_node_sibling(n))
 		if (!is_pass(node_coord(n)))
 			amaf_playouts[node_coord(n)] = n->amaf.playouts;
 
-	gogui_amaf_playouts_display(stderr, b, &u->t->root->u, amaf_playouts, pass);
+	move_stats_t root_stats = node_stats_get(&u->t->root->u);
+	gogui_amaf_playouts_display(stderr, b, &root_stats, amaf_playouts, pass);
 }
 
 static void
@@ -287,7 +290,7 @@ uct_progress_json(FILE *fh, uct_t *u, tree_t *t, board_t *b, enum stone color, i
 			/* Best move */
 			fprintf(fh, ", \"best\": {\"%s\": %f}",
 				coord2sstr(best->coord),
-				tree_node_get_value(t, parity, best->u.value));
+				tree_node_get_value(t, parity, node_stats_value(&best->u)));
 		}
 	}
 
@@ -295,13 +298,13 @@ uct_progress_json(FILE *fh, uct_t *u, tree_t *t, board_t *b, enum stone color, i
 	int cans = 20;
 	tree_node_t *can[cans];
 	memset(can, 0, sizeof(can));
-	tree_node_t *best = t->root->children;
+	tree_node_t *best = node_children(t->root);
 	while (best) {        /* XXX clean this up, use uct_get_best_moves() instead */
 		int c = 0;
 		while ((!can[c] || best->u.playouts > can[c]->u.playouts) && ++c < cans);
 		for (int d = 0; d < c; d++) can[d] = can[d + 1];
 		if (c > 0) can[c - 1] = best;
-		best = best->sibling;
+		best = tree_node_sibling(best);
 	}
 	fprintf(fh, ", \"can\": [");
 	bool first = true;
@@ -317,7 +320,7 @@ uct_progress_json(FILE *fh, uct_t *u, tree_t *t, board_t *b, enum stone color, i
 			best = tree_get_node(best, coord);  assert(best);
 			fprintf(fh, "%s{\"%s\": [%.3f, %i]}", (depth > 0 ? "," : ""),
 				coord2sstr(coord),
-				tree_node_get_value(t, parity, best->u.value),
+				tree_node_get_value(t, parity, node_stats_value(&best->u)),
 				best->u.playouts);
 		}
 		fprintf(fh, "]");
@@ -394,6 +397,11 @@ uct_progress_status(uct_t *u, tree_t *t, board_t *b, enum stone color, int playo
 	uct_progress_gogui_livegfx(u, t, b, color, playouts, final);
 }
 
+/* Worker's own ownermap, merged into u->ownermap every
+ * OWNERMAP_MERGE_PLAYOUTS playouts and at the end of search. */
+#define OWNERMAP_MERGE_PLAYOUTS 64
+static __thread ownermap_t *thread_ownermap = NULL;
+
 static floating_t
 uct_leaf_node(uct_t *u, board_t *b, enum stone player_color, amafmap_t *amaf,
               tree_t *t, tree_node_t *n, enum stone node_color, int spaces)
@@ -405,11 +413,12 @@ uct_leaf_node(uct_t *u, board_t *b, enum stone player_color, amafmap_t *amaf,
 	if (UDEBUGL(7))
 		fprintf(stderr, "%*s*-- UCT playout #%d start [%s] %f\n",
 			spaces, "", n->u.playouts, coord2sstr(node_coord(n)),
-			tree_node_get_value(t, -parity, n->u.value));
+			tree_node_get_value(t, -parity, node_stats_value(&n->u)));
 
 	playout_setup_t ps = playout_setup(u->gamelen, u->mercymin);
 	playout_t playout = { &ps, u->playout };
-	floating_t score = playout_play_game(&playout, b, next_color, amaf, &u->ownermap);
+	ownermap_t *ownermap = (thread_ownermap ? thread_ownermap : &u->ownermap);
+	floating_t score = playout_play_game(&playout, b, next_color, amaf, ownermap);
 
 	/* Get score from black's perspective. */
 	score = -score;
@@ -438,7 +447,7 @@ scale_value(uct_t *u, board_t *b, enum stone node_color, tree_node_t *significan
 		if (u->val_bytemp) {
 			/* xvalue is 0 at 0.5, 1 at 0 or 1 */
 			/* No correction for parity necessary. */
-			double xvalue = significant[node_color - 1] ? fabs(significant[node_color - 1]->u.value - 0.5) * 2 : 0;
+			double xvalue = significant[node_color - 1] ? fabs(node_stats_value(&significant[node_color - 1]->u) - 0.5) * 2 : 0;
 			scale = u->val_bytemp_min + (u->val_scale - u->val_bytemp_min) * xvalue;
 		}
 
@@ -460,8 +469,10 @@ scale_value(uct_t *u, board_t *b, enum stone node_color, tree_node_t *significan
 	return rval;
 }
 
+/* Nodes visited are recorded in @path (virtual loss needs to be undone
+ * by caller). */
 static tree_node_t *
-uct_playout_descent(uct_t *u, board_t *b, enum stone player_color, tree_t *t)
+uct_playout_descent(uct_t *u, board_t *b, enum stone player_color, tree_t *t, tree_path_t *path)
 {
 	amafmap_t amaf;
 	amaf_init(&amaf);
@@ -471,6 +482,8 @@ uct_playout_descent(uct_t *u, board_t *b, enum stone player_color, tree_t *t)
 	tree_node_t *n = t->root;
 	enum stone node_color = stone_other(player_color);
 	assert(node_color == t->root_color);
+	path->nodes[0] = n;
+	path->len = 1;
 
 	/* Make sure root node is expanded. Normally that's the case,
 	 * except direct calls to uct_playout() */
@@ -513,12 +526,13 @@ uct_playout_descent(uct_t *u, board_t *b, enum stone player_color, tree_t *t)
 			significant[node_color - 1] = n;
 
 		spaces++;
-		assert(n == t->root || n->parent);
+		assert(n == t->root || node_parent(n));
+		path->nodes[path->len++] = n;
 		if (UDEBUGL(7))
 			fprintf(stderr, "%*s+-- UCT sent us to [%s:%d] %d,%f\n",
 			        spaces, "", coord2sstr(node_coord(n)),
 				node_coord(n), n->u.playouts,
-				tree_node_get_value(t, parity, n->u.value));
+				tree_node_get_value(t, parity, node_stats_value(&n->u)));
 
 		if (u->virtual_loss)
 			__sync_fetch_and_add(&n->descents, u->virtual_loss);
@@ -530,8 +544,8 @@ uct_playout_descent(uct_t *u, board_t *b, enum stone player_color, tree_t *t)
 		    || b->superko_violation) {
 			if (UDEBUGL(4)) {
 #ifdef DEBUG_TREE
-				for (tree_node_t *ni = n; ni; ni = ni->parent)
-					fprintf(stderr, "%s<%" PRIhash "> ", coord2sstr(node_coord(ni)), ni->hash);
+				for (int i = path->len - 1; i >= 0; i--)
+					fprintf(stderr, "%s<%" PRIhash "> ", coord2sstr(node_coord(path->nodes[i])), path->nodes[i]->hash);
 #endif
 				fprintf(stderr, "marking invalid %s node %d,%d res %d group %d spk %d\n",
 				        stone2str(node_color), coord_x(node_coord(n)), coord_y(node_coord(n)),
@@ -548,6 +562,13 @@ uct_playout_descent(uct_t *u, board_t *b, enum stone player_color, tree_t *t)
 		else                         passes = 0;
 
 		enum stone next_color = stone_other(node_color);
+
+		/* Busy node without dcnn priors ? Have it evaluated. */
+		if (u->leaf_dcnn && !tree_leaf_node(n) &&
+		    n->u.playouts >= u->leaf_dcnn &&
+		    !(n->hints & (TREE_HINT_DCNN | TREE_HINT_DCNN_PENDING)))
+			leaf_dcnn_queue(u, t, n, b, next_color, -parity);
+
 		/* We need to make sure only one thread expands the node. If
 		 * we are unlucky enough for two threads to meet in the same
 		 * node, the latter one will simply do another simulation from
@@ -593,9 +614,9 @@ uct_playout_descent(uct_t *u, board_t *b, enum stone player_color, tree_t *t)
 
 	/* Record the result. */
 
-	assert(n == t->root || n->parent);
+	assert(n == t->root || node_parent(n));
 	floating_t rval = scale_value(u, b, node_color, significant, score);
-	u->policy->update(u->policy, t, n, node_color, player_color, &amaf, b, rval);
+	u->policy->update(u->policy, t, path, node_color, player_color, &amaf, b, rval);
 
 	/* TODO Now that ownermap keeps track of real playouts average score
 	 *      can we remove avg_score and use only that ? */
@@ -608,32 +629,51 @@ uct_playout_descent(uct_t *u, board_t *b, enum stone player_color, tree_t *t)
 	return n;
 }
 
+/* @b2: thread's playout board, reset to root position @cp first. */
 static void
-uct_playout(uct_t *u, board_t *b, enum stone player_color, tree_t *t)
+uct_playout(uct_t *u, board_checkpoint_t *cp, board_t *b2, enum stone player_color, tree_t *t)
 {
-#ifdef EXTRA_CHECKS
-	assert(!quick_board(b));
-#endif
-	board_t b2;
-	board_copy(&b2, b);
+	board_restore(b2, cp);
 
-	tree_node_t *n = uct_playout_descent(u, &b2, player_color, t);
+	tree_path_t path;
+	uct_playout_descent(u, b2, player_color, t, &path);
 
 	/* We need to undo the virtual loss we added during descend. */
 	if (u->virtual_loss) {
-		for (; n->parent; n = n->parent) {
-			__sync_fetch_and_sub(&n->descents, u->virtual_loss);
-		}
+		for (int i = path.len - 1; i > 0; i--)
+			__sync_fetch_and_sub(&path.nodes[i]->descents, u->virtual_loss);
 	}
-
-	board_done(&b2);
 }
 
 int
 uct_playouts(uct_t *u, board_t *b, enum stone color, tree_t *t, time_info_t *ti)
 {
+#ifdef EXTRA_CHECKS
+	assert(!quick_board(b));
+#endif
+	/* Same playout board for all iterations, restored from root
+	 * checkpoint each time (only root groups' info gets copied) */
+	board_checkpoint_t *cp = malloc2(board_checkpoint_t);
+	board_checkpoint(cp, b);
+	board_t *b2 = malloc2(board_t);
+	board_copy_playout(b2, b);
+
+	thread_ownermap = calloc2(1, ownermap_t);
+
 	int i;
-	for (i = 0; !uct_halt; i++)
-		uct_playout(u, b, color, t);
+	for (i = 0; !uct_halt; i++) {
+		uct_playout(u, cp, b2, color, t);
+		if (thread_ownermap->playouts >= OWNERMAP_MERGE_PLAYOUTS) {
+			ownermap_merge(b, &u->ownermap, thread_ownermap);
+			ownermap_init(thread_ownermap);
+		}
+	}
+
+	ownermap_merge(b, &u->ownermap, thread_ownermap);
+	free(thread_ownermap);
+	thread_ownermap = NULL;
+	board_done(b2);
+	free(b2);
+	free(cp);
 	return i;
 }